@@ -3,15 +3,59 @@
 
 #include "stdafx.h"
 #include <stdint.h>
+#include <time.h>
 #include "defs.h"
 #include <d3dx9.h>
 #include <d3d9.h>
 #include <ddraw.h>
 #include "resource.h"
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
 
 extern void core_decode(uchar* opcodes);
-extern void core_init(uchar* buffer, int len);
+typedef struct nes_rom nes_rom;
+extern nes_rom* rom_open(const char* path, uchar* error);
+extern const char* rom_error(uchar code);
+extern void rom_start(const nes_rom* rom);
+extern void rom_close(nes_rom* rom);
 extern uchar core_exec(uchar* vbuffer);
+extern void ppu_set_profile(uchar profile);
+extern uchar rewind_init(size_t arena);
+extern void rewind_push();
+extern uchar rewind_step(uint32 frames);
+extern uint32 rewind_get_frames();
+extern size_t rewind_get_usage();
+extern size_t core_state_size();
+extern size_t core_save_state(uchar* buffer, size_t size);
+extern uchar core_load_state(const uchar* buffer, size_t size);
+extern void ppu_set_video(uchar enable);
+extern void ppu_set_logic(uchar enable);
+extern uchar hash_init(uint8 shift, const char* path);
+extern uint64 hash_frame();
+extern void hash_close();
+extern int32 hash_compare(const char* path_a, const char* path_b);
+extern uchar snap_init(uint32 capacity, const char* spill);
+extern uint32 snap_get_pages();
+extern uchar snap_save(uint32* ids);
+extern uchar snap_load(const uint32* ids);
+extern void snap_free(const uint32* ids);
+extern void snap_report();
+extern void snap_release();
+extern uchar input_push(uint8 port, uint32 frame, uint32 cycle, uint8 buttons);
+extern uint32 core_get_frame();
+extern uint64 hash_bytes(const uchar* data, size_t size, uint64 seed);
+extern void lat_enable(uchar enable);
+extern void lat_frame(uint32 frame, uint64 output);
+extern void lat_present(uint32 frame);
+extern uint32 lat_get_count();
+extern void lat_report();
+extern uchar apu_init(uint32 rate);
+extern uint32 apu_pull(int16* samples, uint32 count);
+extern void apu_set_mute(uchar mute);
+extern double apu_get_time();
+extern void skip_enable(double target, uint8 max);
+extern uchar skip_frame();
+extern void skip_report();
 //-----------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------
@@ -31,6 +75,38 @@ LPDIRECT3DSURFACE9			g_pSurface = NULL;
 
 static uchar _lcdbuffer[VM_LCD_WIDTH * VM_LCD_HEIGHT * 4];
 
+static const WPARAM _pad_keys[8] = { 'X', 'Z', VK_SHIFT, VK_RETURN, VK_UP, VK_DOWN, VK_LEFT, VK_RIGHT };	//A B Select Start Up Down Left Right
+static uint8 _pad_state = 0;
+
+#define VM_REWIND_ARENA		(4 << 20)		//packed rewind history
+static uchar _rewind_hold = 0;			//backspace held, play history backwards
+
+#define VM_RUNAHEAD_REPORT	600				//host frames per timing report
+static int _runahead = 0;				//frames emulated ahead of the real timeline, 0 = off
+static uchar* _runahead_state = NULL;
+static size_t _runahead_size = 0;
+static LONGLONG _runahead_time[4];		//real frame, save, frames ahead, load (performance counter ticks)
+static uint32 _runahead_count = 0;
+
+#define VM_HASH_SHIFT		8				//256 byte pages per state hash leaf
+static uchar _hash_record = 0;			//append the state hash of every frame to the -hash stream
+
+static uint32 _latency_report = 0;		//probe key presses, report every n probes, 0 = off
+
+#define VM_SKIP_MAX			16				//at least one frame in 16 drawn while fast forwarding
+#define VM_SKIP_REPORT		600				//fast forward frames per speed report
+static uchar _ffwd_hold = 0;			//tab held, fast forward
+static uchar _ffwd_on = 0;
+static double _ffwd_target = 0;			//emulated fps while fast forwarding, 0 = uncapped
+
+#define VM_AUDIO_RATE		48000
+#define VM_AUDIO_BUFFERS	4				//frames of sound queued to the device
+#define VM_AUDIO_SAMPLES	(VM_AUDIO_RATE / 60)
+static volatile LONG _audio_quit = 0;
+
+#define VM_SNAP_CAPACITY	(1 << 16)		//snapshot store pages
+#define VM_SNAP_HISTORY		600				//snapshots kept by the bench
+
 //-----------------------------------------------------------------------------
 // Name: InitD3D()
 // Desc: Initializes Direct3D
@@ -233,6 +309,8 @@ void Render()
 LRESULT WINAPI MsgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	HICON hIcon, hIconSm;
+	uint8 pad = _pad_state;
+	int i;
 	switch (msg)
 	{
 	case WM_CREATE:
@@ -243,6 +321,22 @@ LRESULT WINAPI MsgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		default: break;
 		}
 		break;
+	case WM_KEYDOWN:
+		if (wParam == VK_BACK) _rewind_hold = 1;
+		if (wParam == VK_TAB) _ffwd_hold = 1;
+		for (i = 0; i < 8; i++) {
+			if (wParam == _pad_keys[i]) _pad_state |= (1 << i);
+		}
+		if (_pad_state != pad) input_push(0, 0, 0, _pad_state);			//applied at the next strobe
+		break;
+	case WM_KEYUP:
+		if (wParam == VK_BACK) _rewind_hold = 0;
+		if (wParam == VK_TAB) _ffwd_hold = 0;
+		for (i = 0; i < 8; i++) {
+			if (wParam == _pad_keys[i]) _pad_state &= ~(1 << i);
+		}
+		if (_pad_state != pad) input_push(0, 0, 0, _pad_state);
+		break;
 	case WM_DESTROY:
 		//Cleanup();
 		//_active_core->command(VM_QUIT, 0, NULL);
@@ -253,7 +347,203 @@ LRESULT WINAPI MsgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 	return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
-char codespace[65536 * 16];
+DWORD WINAPI vnes_audio(LPVOID param) {
+	//host audio thread, refills finished device buffers from the apu ring, silence when it runs dry
+	static int16 samples[VM_AUDIO_BUFFERS][VM_AUDIO_SAMPLES];
+	WAVEHDR hdr[VM_AUDIO_BUFFERS];
+	WAVEFORMATEX fmt = { WAVE_FORMAT_PCM, 1, VM_AUDIO_RATE, VM_AUDIO_RATE * 2, 2, 16, 0 };
+	HWAVEOUT wo;
+	uint32 n;
+	int i;
+	if (waveOutOpen(&wo, WAVE_MAPPER, &fmt, 0, 0, CALLBACK_NULL) != MMSYSERR_NOERROR) return 0;
+	memset(hdr, 0, sizeof(hdr));
+	for (i = 0; i < VM_AUDIO_BUFFERS; i++) {
+		hdr[i].lpData = (LPSTR)samples[i];
+		hdr[i].dwBufferLength = sizeof(samples[i]);
+		hdr[i].dwFlags = WHDR_DONE;
+	}
+	while (!_audio_quit) {
+		for (i = 0; i < VM_AUDIO_BUFFERS; i++) {
+			if (!(hdr[i].dwFlags & WHDR_DONE)) continue;
+			if (hdr[i].dwFlags & WHDR_PREPARED) waveOutUnprepareHeader(wo, &hdr[i], sizeof(WAVEHDR));
+			n = apu_pull(samples[i], VM_AUDIO_SAMPLES);
+			memset(samples[i] + n, 0, (VM_AUDIO_SAMPLES - n) * sizeof(int16));
+			hdr[i].dwFlags = 0;
+			waveOutPrepareHeader(wo, &hdr[i], sizeof(WAVEHDR));
+			waveOutWrite(wo, &hdr[i], sizeof(WAVEHDR));
+		}
+		Sleep(2);
+	}
+	waveOutReset(wo);
+	for (i = 0; i < VM_AUDIO_BUFFERS; i++) {
+		if (hdr[i].dwFlags & WHDR_PREPARED) waveOutUnprepareHeader(wo, &hdr[i], sizeof(WAVEHDR));
+	}
+	waveOutClose(wo);
+	return 0;
+}
+
+uchar vnes_run_frame() {
+	//emulate up to the next frame boundary
+	uchar ret;
+	while ((ret = core_exec((uchar *)_lcdbuffer)) == 0);
+	return ret;
+}
+
+void vnes_runahead(uchar present) {
+	//advance the real timeline one frame, show the frame _runahead frames past it, roll back
+	LARGE_INTEGER t[5], freq;
+	int i;
+	if (_runahead_state == NULL) {
+		_runahead_size = core_state_size();
+		_runahead_state = (uchar*)malloc(_runahead_size);
+	}
+	QueryPerformanceCounter(&t[0]);
+	ppu_set_video(0);
+	vnes_run_frame();
+	if (_hash_record) hash_frame();
+	rewind_push();
+	if (_rewind_hold && rewind_get_frames() > 3) rewind_step(3);
+	QueryPerformanceCounter(&t[1]);
+	core_save_state(_runahead_state, _runahead_size);
+	QueryPerformanceCounter(&t[2]);
+	apu_set_mute(1);				//only the real timeline is heard
+	for (i = 1; i < _runahead; i++) vnes_run_frame();
+	ppu_set_video(1);
+	if (vnes_run_frame() == 1 && present) Render();
+	QueryPerformanceCounter(&t[3]);
+	core_load_state(_runahead_state, _runahead_size);
+	apu_set_mute(0);
+	QueryPerformanceCounter(&t[4]);
+	for (i = 0; i < 4; i++) _runahead_time[i] += t[i + 1].QuadPart - t[i].QuadPart;
+	if (++_runahead_count == VM_RUNAHEAD_REPORT) {
+		//a host frame has 16.7ms for the real frame, _runahead frames ahead and save/load
+		QueryPerformanceFrequency(&freq);
+		printf("runahead %d: real frame %.2f ms, save %.1f us, %.2f ms per frame ahead, load %.1f us\n", _runahead,
+			_runahead_time[0] * 1000.0 / freq.QuadPart / _runahead_count,
+			_runahead_time[1] * 1000000.0 / freq.QuadPart / _runahead_count,
+			_runahead_time[2] * 1000.0 / freq.QuadPart / _runahead_count / _runahead,
+			_runahead_time[3] * 1000000.0 / freq.QuadPart / _runahead_count);
+		memset(_runahead_time, 0, sizeof(_runahead_time));
+		_runahead_count = 0;
+	}
+}
+
+void vnes_bench(const nes_rom* rom, int frames) {
+	//emulation speed of each ppu accuracy profile on the same rom, no display
+	static const char* names[] = { "frame", "scanline", "dot" };
+	clock_t start;
+	double elapsed;
+	int count;
+	LARGE_INTEGER t[2], freq;
+	LONGLONG ticks;
+	for (uchar profile = 0; profile < 3; profile++) {
+		rom_start(rom);
+		ppu_set_profile(profile);
+		count = 0;
+		start = clock();
+		while (count < frames) {
+			if (core_exec((uchar *)_lcdbuffer) != 0) count++;
+		}
+		elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%-8s %d frames %.2fs %.1f fps\n", names[profile], frames, elapsed, frames / elapsed);
+	}
+	ppu_set_profile(0);
+	//logic only, what bots and batch runs need, one core
+	rom_start(rom);
+	ppu_set_logic(1);
+	start = clock();
+	for (count = 0; count < frames; ) {
+		if (core_exec((uchar *)_lcdbuffer) != 0) count++;
+	}
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	ppu_set_logic(0);
+	printf("%-8s %d frames %.2fs %.1f fps per core\n", "logic", frames, elapsed, frames / elapsed);
+	//rewind history cost, one push per frame
+	rom_start(rom);
+	rewind_init(VM_REWIND_ARENA);
+	count = 0;
+	start = clock();
+	while (count < frames) {
+		if (core_exec((uchar *)_lcdbuffer) != 0) {
+			rewind_push();
+			count++;
+		}
+	}
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("rewind   %u frames kept, %.1f KB per second of history, %.1f fps\n", rewind_get_frames(),
+		rewind_get_usage() / 1024.0 / (rewind_get_frames() / 60.0), frames / elapsed);
+	start = clock();
+	for (count = 0; count < 100 && rewind_get_frames() > 1; count++) rewind_step(1);
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (count) printf("rewind   step %.3f ms\n", elapsed * 1000 / count);
+	//host frame rate with 1 and 2 frames of run-ahead
+	for (_runahead = 1; _runahead <= 2; _runahead++) {
+		rom_start(rom);
+		start = clock();
+		for (count = 0; count < frames; count++) vnes_runahead(0);
+		elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("runahead %d frames %.1f host fps\n", _runahead, frames / elapsed);
+	}
+	_runahead = 0;
+	//incremental state hash cost per frame
+	QueryPerformanceFrequency(&freq);
+	rom_start(rom);
+	hash_init(VM_HASH_SHIFT, NULL);
+	ticks = 0;
+	for (count = 0; count < frames; count++) {
+		vnes_run_frame();
+		QueryPerformanceCounter(&t[0]);
+		hash_frame();
+		QueryPerformanceCounter(&t[1]);
+		ticks += t[1].QuadPart - t[0].QuadPart;
+	}
+	printf("hash     %.1f us per frame\n", ticks * 1000000.0 / freq.QuadPart / frames);
+	//apu catch-up cost, measured inside the apu
+	rom_start(rom);
+	elapsed = apu_get_time();
+	QueryPerformanceCounter(&t[0]);
+	for (count = 0; count < frames; count++) vnes_run_frame();
+	QueryPerformanceCounter(&t[1]);
+	elapsed = apu_get_time() - elapsed;
+	printf("apu      %.1f us per frame, %.1f%% of emulated frame time, %.3f%% of a 60Hz frame\n", elapsed * 1e6 / frames,
+		elapsed * 100 * freq.QuadPart / (t[1].QuadPart - t[0].QuadPart), elapsed * 100 * 60 / frames);
+	//uncapped fast forward, one frame in VM_SKIP_MAX drawn and presented
+	rom_start(rom);
+	skip_enable(0, VM_SKIP_MAX);
+	for (count = 0; count < frames; count++) {
+		if (vnes_run_frame() == 1) Render();
+		skip_frame();
+	}
+	skip_report();
+	skip_enable(0, 0);
+	//snapshot store, one snapshot per frame, the last VM_SNAP_HISTORY kept
+	rom_start(rom);
+	if (snap_init(VM_SNAP_CAPACITY, NULL)) {
+		uint32 pages = snap_get_pages();
+		uint32* ids = (uint32*)calloc(VM_SNAP_HISTORY, pages * sizeof(uint32));
+		ticks = 0;
+		for (count = 0; count < frames; count++) {
+			vnes_run_frame();
+			if (count >= VM_SNAP_HISTORY) snap_free(ids + (count % VM_SNAP_HISTORY) * pages);
+			QueryPerformanceCounter(&t[0]);
+			if (!snap_save(ids + (count % VM_SNAP_HISTORY) * pages)) break;
+			QueryPerformanceCounter(&t[1]);
+			ticks += t[1].QuadPart - t[0].QuadPart;
+		}
+		snap_report();
+		if (count == frames) {
+			printf("snap     save %.1f MB/s", (double)count * core_state_size() * freq.QuadPart / ticks / (1 << 20));
+			if (count > VM_SNAP_HISTORY) count = VM_SNAP_HISTORY;
+			QueryPerformanceCounter(&t[0]);
+			for (int i = 0; i < count; i++) snap_load(ids + i * pages);
+			QueryPerformanceCounter(&t[1]);
+			printf(", load %.1f MB/s\n", (double)count * core_state_size() * freq.QuadPart / (t[1].QuadPart - t[0].QuadPart) / (1 << 20));
+		}
+		free(ids);
+		snap_release();
+	}
+}
+
 int _tmain(int argc, CHAR* argv[], CHAR* envp[])
 {
 	HMENU hMenu, hSubMenu;
@@ -287,9 +577,15 @@ int _tmain(int argc, CHAR* argv[], CHAR* envp[])
 	wc.style = CS_HREDRAW | CS_VREDRAW;
 	RegisterClassEx(&wc);
 
+	if (argc > 3 && strcmp(argv[1], "-hashcmp") == 0) {
+		//VNES -hashcmp run1.hash run2.hash, first frame and pages where two recorded runs diverge
+		return (hash_compare(argv[2], argv[3]) < 0) ? 0 : 1;
+	}
+
 	hMenu = CreateMenu();
 	//wchar_t * dirname = _T(".\\plugins\\*");
 	size_t i;
+	const char* hash_path = NULL;
 	//memcpy(varm_config.global, LPCTSTR(L"smdk2440.dll"), 256);
 
 	// initialize MFC and print and error on failure
@@ -324,17 +620,42 @@ int _tmain(int argc, CHAR* argv[], CHAR* envp[])
 		ZeroMemory(&msg, sizeof(msg));
 		ShowWindow(hWnd, SW_SHOWDEFAULT);
 		UpdateWindow(hWnd);
-		char buffer[256];
-		int len;
-		int index = 0;
-		FILE * ff = fopen("D:\\Workspace\\VSProjects\\VNES\\debug\\SMB.nes", "rb");
-		while ((len = fread(buffer, 1, 256, ff)) == 256) {
-			memcpy(codespace + index, buffer, len);
-			index += len;
+		const char* rom_path = "D:\\Workspace\\VSProjects\\VNES\\debug\\SMB.nes";
+		nes_rom* rom;
+		HANDLE audio;
+		uchar error;
+		for (i = 1; i + 1 < (size_t)argc; i++) {
+			//VNES -runahead 2
+			if (strcmp(argv[i], "-runahead") == 0) _runahead = atoi(argv[i + 1]);
+			//VNES -hash run1.hash
+			if (strcmp(argv[i], "-hash") == 0) hash_path = argv[i + 1];
+			//VNES -rom game.nes
+			if (strcmp(argv[i], "-rom") == 0) rom_path = argv[i + 1];
+			//VNES -latency 20
+			if (strcmp(argv[i], "-latency") == 0) _latency_report = atoi(argv[i + 1]);
+			//VNES -ffwd 600, fast forward (tab) target in emulated fps, 0 uncapped
+			if (strcmp(argv[i], "-ffwd") == 0) _ffwd_target = atof(argv[i + 1]);
 		}
-		memcpy(codespace + index, buffer, len);
-		index += len;
-		core_init((uchar *)codespace, index);
+		rom = rom_open(rom_path, &error);
+		if (rom == NULL) {
+			printf("%s: %s\n", rom_path, rom_error(error));
+			Cleanup();
+			UnregisterClass(LPCTSTR(L"VNES"), wc.hInstance);
+			return 1;
+		}
+		if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+			vnes_bench(rom, (argc > 2) ? atoi(argv[2]) : 600);
+			rom_close(rom);
+			Cleanup();
+			UnregisterClass(LPCTSTR(L"VNES"), wc.hInstance);
+			return nRetCode;
+		}
+		apu_init(VM_AUDIO_RATE);
+		rom_start(rom);
+		audio = CreateThread(NULL, 0, vnes_audio, NULL, 0, NULL);
+		rewind_init(VM_REWIND_ARENA);
+		if (hash_path != NULL) _hash_record = hash_init(VM_HASH_SHIFT, hash_path);
+		if (_latency_report) lat_enable(1);
 		while (msg.message != WM_QUIT)
 		{
 			if (PeekMessage(&msg, NULL, 0U, 0U, PM_REMOVE))
@@ -342,14 +663,52 @@ int _tmain(int argc, CHAR* argv[], CHAR* envp[])
 				TranslateMessage(&msg);
 				DispatchMessage(&msg);
 			}
+			else if (_ffwd_hold != _ffwd_on) {
+				//fast forward draws one frame in n, sound would only overrun the ring
+				_ffwd_on = _ffwd_hold;
+				if (!_ffwd_on) skip_report();
+				skip_enable(_ffwd_target, _ffwd_on ? VM_SKIP_MAX : 0);
+				apu_set_mute(_ffwd_on);
+			}
+			else if (_runahead > 0 && !_ffwd_on) {
+				vnes_runahead(1);
+			}
 			else {
-				if (core_exec((uchar *)_lcdbuffer)) {
+				switch (core_exec((uchar *)_lcdbuffer)) {
+				case 1:
+					//photon is the first frame after a key press whose pixels change
+					if (_latency_report) lat_frame(core_get_frame() - 1, hash_bytes(_lcdbuffer, sizeof(_lcdbuffer), 0));
 					Render();
+					if (_latency_report) {
+						lat_present(core_get_frame() - 1);
+						if (lat_get_count() >= _latency_report) {
+							lat_report();
+							lat_enable(1);
+						}
+					}
+					//fall through
+				case 2:
+					//frame boundary, while rewinding restore two frames before the one shown and replay one
+					if (_hash_record) hash_frame();
+					rewind_push();
+					if (_rewind_hold && rewind_get_frames() > 3) rewind_step(3);
+					if (_ffwd_on) {
+						skip_frame();
+						if (core_get_frame() % VM_SKIP_REPORT == 0) skip_report();
+					}
+					break;
 				}
 				//Sleep(10);
 				//printf("%x\n", _active_core->address);
 			}
 		}
+		_audio_quit = 1;
+		if (audio != NULL) {
+			WaitForSingleObject(audio, INFINITE);
+			CloseHandle(audio);
+		}
+		hash_close();
+		rom_close(rom);
 		Cleanup();
 		UnregisterClass(LPCTSTR(L"VNES"), wc.hInstance);
 		
@@ -0,0 +1,776 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+2A03 apu, pulse x2, triangle, noise, dmc and the frame counter
+
+the apu is not clocked with the cpu. it keeps the cycle it has reached and
+catches up to the cpu when a register is read or written, when an audio block
+is due, when the frame counter may raise an irq or when the dmc reads its next
+sample byte, the core only compares _cycles against the cycle apu_sync returned.
+
+catching up runs each channel from one timer expiry to the next, output only
+changes at those points and every change is added to the output as a band
+limited step: a windowed sinc kernel at one of APU_PHASES sub-sample offsets,
+applied with sse where the host has it. integrating the steps gives samples at
+the host rate with no aliasing from the square waves, a 90Hz high pass removes
+the dc like the nes output stage. channels are mixed with the linear weights of
+the nes mixer so each channel steps on its own.
+
+finished blocks go to a single producer, single consumer ring of int16 samples,
+the host audio thread pulls from it. offline drivers take blocks through a sink
+on the emulation thread instead. channel registers are machine state and part
+of the save state, the synthesis buffer and the ring are host state.
+*/
+
+extern uchar core_get_mem(uint16 address);
+
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define APU_SSE				1
+#else
+#define APU_SSE				0
+#endif
+
+#define APU_CLOCK			1789773			//ntsc cpu cycles per second
+#define APU_DEFAULT_RATE	48000
+#define APU_TAPS			16				//kernel width in samples, multiple of 4
+#define APU_PHASES			32				//sub-sample offsets
+#define APU_PHASE_SHIFT		(32 - 5)
+#define APU_BUFFER			2048			//samples, more than a block at 96kHz
+#define APU_RING			16384			//power of two
+#define APU_HIGHPASS		90.0
+#define APU_CUTOFF			0.45			//kernel cutoff, fraction of the output rate
+#define APU_PI				3.14159265358979323846
+
+enum { APU_PULSE1 = 0, APU_PULSE2, APU_TRIANGLE, APU_NOISE, APU_DMC, APU_CHANNELS };
+
+static const float _apu_weight[APU_CHANNELS] = { 0.00752f, 0.00752f, 0.00851f, 0.00494f, 0.00335f };	//linear mixer
+static const uint8 _apu_length[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30 };
+static const uint8 _apu_duty[4] = { 0x02, 0x06, 0x1E, 0xF9 };		//bit per sequencer step
+static const uint8 _apu_triangle[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const uint16 _apu_noise_period[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static const uint16 _apu_dmc_period[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+static const uint16 _apu_frame_step[2][5] = { { 7457, 14913, 22371, 29829, 0 }, { 7457, 14913, 22371, 29829, 37281 } };
+static const uint16 _apu_frame_period[2] = { 29830, 37282 };
+
+typedef struct apu_envelope {
+	uint8 start;
+	uint8 divider;
+	uint8 decay;
+	uint8 period;					//also the constant volume
+	uint8 constant;
+	uint8 loop;						//also halts the length counter
+} apu_envelope;
+
+typedef struct apu_pulse {
+	uint32 timer;					//cycles to the next sequencer step
+	uint16 period;
+	uint8 duty;
+	uint8 step;
+	uint8 length;
+	uint8 sweep;					//$4001/$4005
+	uint8 sweep_divider;
+	uint8 sweep_reload;
+	apu_envelope env;
+} apu_pulse;
+
+typedef struct apu_triangle {
+	uint32 timer;
+	uint16 period;
+	uint8 step;
+	uint8 length;
+	uint8 control;					//$4008
+	uint8 linear;
+	uint8 linear_reload;
+} apu_triangle;
+
+typedef struct apu_noise {
+	uint32 timer;
+	uint16 period;
+	uint16 lfsr;
+	uint8 mode;
+	uint8 length;
+	apu_envelope env;
+} apu_noise;
+
+typedef struct apu_dmc {
+	uint32 timer;
+	uint16 period;
+	uint16 address;					//next byte fetched
+	uint16 remaining;				//bytes left in the sample
+	uint16 sample_address;
+	uint16 sample_length;
+	uint8 control;					//$4010
+	uint8 level;
+	uint8 shift;
+	uint8 bits;
+	uint8 buffer;
+	uint8 buffered;
+	uint8 silence;
+} apu_dmc;
+
+typedef struct apu_state {
+	uint32 time;					//cpu cycle the apu has caught up to
+	uint32 frame_cycle;				//cycles into the frame counter sequence
+	uint8 frame_mode;				//0 = 4 step, 1 = 5 step
+	uint8 frame_step;
+	uint8 frame_inhibit;
+	uint8 frame_irq;
+	uint8 dmc_irq;
+	uint8 enable;					//$4015
+	uint8 out[APU_CHANNELS];		//channel outputs already mixed into the synthesis
+	apu_pulse pulse[2];
+	apu_triangle triangle;
+	apu_noise noise;
+	apu_dmc dmc;
+} apu_state;
+
+static apu_state _apu;
+
+//synthesis, host side
+#if defined(_MSC_VER)
+__declspec(align(16)) static float _apu_kernel[APU_PHASES][APU_TAPS];
+#else
+static float _apu_kernel[APU_PHASES][APU_TAPS] __attribute__((aligned(16)));
+#endif
+static float _apu_buffer[APU_BUFFER + APU_TAPS];
+static uint16 _apu_noise_jump[2][32][15];		//lfsr after 2^j steps from each single bit state, per mode
+static uint32 _apu_rate = 0;
+static uint32 _apu_block;						//samples per block
+static uint32 _apu_step;						//samples per cpu cycle, 32.32
+static uint32 _apu_base;						//cpu cycle at _apu_offset
+static uint64 _apu_offset;						//buffer position of _apu_base, 32.32
+static float _apu_level = 0;					//mix the buffer integrates to
+static float _apu_sum = 0;						//integrator
+static float _apu_dc = 0;						//high pass
+static float _apu_highpass;
+static uchar _apu_mute = 0;
+static uchar _apu_wait = 0;
+static void (*_apu_sink)(const int16* samples, uint32 count) = NULL;
+static void (*_apu_log)(uint16 address, uchar val, uint32 now) = NULL;
+static double _apu_seconds = 0;				//host time spent catching up
+
+//ring, host side
+static int16 _apu_ring[APU_RING];
+static std::atomic<uint32> _apu_head(0);		//written by the emulation thread
+static std::atomic<uint32> _apu_tail(0);		//written by the audio thread
+static uint32 _apu_dropped = 0;
+
+static __forceinline uint16 apu_noise_step(uint16 lfsr, uint8 mode) {
+	uint16 feedback = (lfsr ^ (lfsr >> (mode ? 6 : 1))) & 1;
+	return (lfsr >> 1) | (feedback << 14);
+}
+
+static uint16 apu_noise_apply(const uint16* columns, uint16 lfsr) {
+	uint16 ret = 0;
+	for (uint8 k = 0; lfsr != 0; k++, lfsr >>= 1) {
+		if (lfsr & 1) ret ^= columns[k];
+	}
+	return ret;
+}
+
+uchar apu_init(uint32 rate) {
+	//output sample rate, builds the step kernels, the ring is emptied
+	double x, w, sum;
+	uint32 p, k;
+	if (rate < 8000 || rate / 60 > APU_BUFFER - APU_TAPS) return 0;
+	for (p = 0; p < APU_PHASES; p++) {
+		sum = 0;
+		for (k = 0; k < APU_TAPS; k++) {
+			//impulse of a step at p / APU_PHASES past sample 0, delayed by half the kernel
+			x = k - (double)p / APU_PHASES - (APU_TAPS / 2 - 1);
+			w = 0.42 + 0.5 * cos(APU_PI * x / (APU_TAPS / 2)) + 0.08 * cos(2 * APU_PI * x / (APU_TAPS / 2));
+			if (fabs(x) >= APU_TAPS / 2) w = 0;
+			_apu_kernel[p][k] = (float)(((x == 0) ? 1 : sin(APU_PI * 2 * APU_CUTOFF * x) / (APU_PI * 2 * APU_CUTOFF * x)) * w);
+			sum += _apu_kernel[p][k];
+		}
+		for (k = 0; k < APU_TAPS; k++) _apu_kernel[p][k] = (float)(_apu_kernel[p][k] / sum);		//a step of 1 settles at 1
+	}
+	//the lfsr is linear over gf(2), 2^j steps of it are a 15x15 bit matrix
+	for (p = 0; p < 2; p++) {
+		for (k = 0; k < 15; k++) _apu_noise_jump[p][0][k] = apu_noise_step(1 << k, p);
+		for (uint32 j = 1; j < 32; j++) {
+			for (k = 0; k < 15; k++) _apu_noise_jump[p][j][k] = apu_noise_apply(_apu_noise_jump[p][j - 1], _apu_noise_jump[p][j - 1][k]);
+		}
+	}
+	_apu_rate = rate;
+	_apu_block = rate / 60;
+	_apu_step = (uint32)(((uint64)rate << 32) / APU_CLOCK);
+	_apu_highpass = (float)(1 - exp(-2 * APU_PI * APU_HIGHPASS / rate));
+	_apu_base = _apu.time;
+	_apu_offset = 0;
+	_apu_sum = _apu_level;
+	_apu_dc = _apu_level;
+	memset(_apu_buffer, 0, sizeof(_apu_buffer));
+	_apu_tail.store(_apu_head.load());
+	return 1;
+}
+
+static __forceinline uint64 apu_pos(uint32 time) {
+	//buffer position of a cpu cycle, 32.32 samples
+	return _apu_offset + (uint64)(time - _apu_base) * _apu_step;
+}
+
+static __forceinline void apu_add(float* dst, const float* kernel, float delta) {
+#if APU_SSE
+	__m128 d = _mm_set1_ps(delta);
+	for (uint32 k = 0; k < APU_TAPS; k += 4) {
+		_mm_storeu_ps(dst + k, _mm_add_ps(_mm_loadu_ps(dst + k), _mm_mul_ps(_mm_load_ps(kernel + k), d)));
+	}
+#else
+	for (uint32 k = 0; k < APU_TAPS; k++) dst[k] += kernel[k] * delta;
+#endif
+}
+
+static __forceinline void apu_output(uint8 channel, uint32 time, uint8 out) {
+	//channel output changed at time, add the step to the synthesis
+	uint64 pos;
+	float delta;
+	if (out == _apu.out[channel]) return;
+	delta = _apu_weight[channel] * ((int)out - (int)_apu.out[channel]);
+	_apu.out[channel] = out;
+	_apu_level += delta;
+	pos = apu_pos(time);
+	if ((pos >> 32) > APU_BUFFER) return;			//never with blocks taken on time
+	apu_add(_apu_buffer + (pos >> 32), _apu_kernel[(pos >> APU_PHASE_SHIFT) & (APU_PHASES - 1)], delta);
+}
+
+static void apu_push(const int16* samples, uint32 count) {
+	//producer, a block goes in whole or not at all
+	uint32 head = _apu_head.load(std::memory_order_relaxed);
+	uint32 i;
+	while (head + count - _apu_tail.load(std::memory_order_acquire) > APU_RING) {
+		if (!_apu_wait) {
+			_apu_dropped++;
+			return;
+		}
+		std::this_thread::yield();
+	}
+	for (i = 0; i < count; i++) _apu_ring[(head + i) & (APU_RING - 1)] = samples[i];
+	_apu_head.store(head + count, std::memory_order_release);
+}
+
+uint32 apu_pull(int16* samples, uint32 count) {
+	//consumer, up to count samples, returns how many were available
+	uint32 tail = _apu_tail.load(std::memory_order_relaxed);
+	uint32 avail = _apu_head.load(std::memory_order_acquire) - tail;
+	uint32 i;
+	if (count > avail) count = avail;
+	for (i = 0; i < count; i++) samples[i] = _apu_ring[(tail + i) & (APU_RING - 1)];
+	_apu_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+static void apu_take_block() {
+	//integrate one block of steps into samples, the buffer moves down by a block
+	static int16 block[APU_BUFFER];
+	float y;
+	uint32 i;
+	for (i = 0; i < _apu_block; i++) {
+		_apu_sum += _apu_buffer[i];
+		_apu_dc += (_apu_sum - _apu_dc) * _apu_highpass;
+		y = (_apu_sum - _apu_dc) * 32767.0f;
+		block[i] = (y > 32767.0f) ? 32767 : (y < -32768.0f) ? -32768 : (int16)y;
+	}
+	memmove(_apu_buffer, _apu_buffer + _apu_block, (APU_BUFFER + APU_TAPS - _apu_block) * sizeof(float));
+	memset(_apu_buffer + APU_BUFFER + APU_TAPS - _apu_block, 0, _apu_block * sizeof(float));
+	_apu_offset = apu_pos(_apu.time) - ((uint64)_apu_block << 32);
+	_apu_base = _apu.time;
+	if (_apu_mute) return;
+	if (_apu_sink != NULL) _apu_sink(block, _apu_block);
+	else apu_push(block, _apu_block);
+}
+
+static __forceinline uint32 apu_block_due() {
+	//first cycle at which a whole block of samples is final
+	uint64 end = (uint64)_apu_block << 32;
+	uint64 pos = apu_pos(_apu.time);
+	if (pos >= end) return _apu.time;
+	return _apu.time + (uint32)((end - pos + _apu_step - 1) / _apu_step);
+}
+
+static __forceinline uint8 apu_volume(const apu_envelope* env) {
+	return env->constant ? env->period : env->decay;
+}
+
+static __forceinline uchar apu_pulse_muted(const apu_pulse* p) {
+	//period too low or the sweep target out of range silence the channel, sweep enabled or not
+	uint16 change = p->period >> (p->sweep & 7);
+	if (p->period < 8) return 1;
+	if (p->sweep & 0x08) return 0;
+	return (p->period + change) > 0x7FF;
+}
+
+static __forceinline uint8 apu_pulse_out(const apu_pulse* p) {
+	if (p->length == 0 || apu_pulse_muted(p)) return 0;
+	return ((_apu_duty[p->duty] >> p->step) & 1) ? apu_volume(&p->env) : 0;
+}
+
+static __forceinline uint8 apu_noise_out(const apu_noise* n) {
+	if (n->length == 0 || (n->lfsr & 1)) return 0;
+	return apu_volume(&n->env);
+}
+
+static void apu_outputs(uint32 time) {
+	//after a register write or a frame counter clock, outputs may change without a timer step
+	apu_output(APU_PULSE1, time, apu_pulse_out(&_apu.pulse[0]));
+	apu_output(APU_PULSE2, time, apu_pulse_out(&_apu.pulse[1]));
+	apu_output(APU_TRIANGLE, time, _apu_triangle[_apu.triangle.step]);
+	apu_output(APU_NOISE, time, apu_noise_out(&_apu.noise));
+	apu_output(APU_DMC, time, _apu.dmc.level);
+}
+
+static void apu_pulse_run(uint8 channel, uint32 from, uint32 to) {
+	apu_pulse* p = &_apu.pulse[channel];
+	uint32 period = (p->period + 1) * 2;
+	uint32 t = from, n;
+	if (p->length == 0 || apu_pulse_muted(p) || apu_volume(&p->env) == 0) {
+		//silent for the whole span, only the sequencer position matters
+		if (to - t < p->timer) {
+			p->timer -= to - t;
+			return;
+		}
+		t += p->timer;
+		n = (to - t) / period;
+		p->step = (p->step + 1 + n) & 7;
+		p->timer = period - ((to - t) - n * period);
+		return;
+	}
+	while (to - t >= p->timer) {
+		t += p->timer;
+		p->timer = period;
+		p->step = (p->step + 1) & 7;
+		apu_output(channel, t, apu_pulse_out(p));
+	}
+	p->timer -= to - t;
+}
+
+static void apu_triangle_run(uint32 from, uint32 to) {
+	apu_triangle* tr = &_apu.triangle;
+	uint32 period = tr->period + 1;
+	uint32 t = from, n;
+	if (tr->length == 0 || tr->linear == 0 || tr->period < 2) {
+		//sequencer halted, ultrasonic periods are held too instead of aliasing
+		if (to - t < tr->timer) {
+			tr->timer -= to - t;
+			return;
+		}
+		t += tr->timer;
+		n = (to - t) / period;
+		tr->timer = period - ((to - t) - n * period);
+		return;
+	}
+	while (to - t >= tr->timer) {
+		t += tr->timer;
+		tr->timer = period;
+		tr->step = (tr->step + 1) & 31;
+		apu_output(APU_TRIANGLE, t, _apu_triangle[tr->step]);
+	}
+	tr->timer -= to - t;
+}
+
+static void apu_noise_run(uint32 from, uint32 to) {
+	apu_noise* n = &_apu.noise;
+	uint32 t = from, count, j;
+	if (n->length == 0 || apu_volume(&n->env) == 0) {
+		//silent, jump the lfsr over the steps of the span
+		if (to - t < n->timer) {
+			n->timer -= to - t;
+			return;
+		}
+		t += n->timer;
+		count = (to - t) / n->period;
+		n->timer = n->period - ((to - t) - count * n->period);
+		count++;
+		for (j = 0; count != 0; j++, count >>= 1) {
+			if (count & 1) n->lfsr = apu_noise_apply(_apu_noise_jump[n->mode][j], n->lfsr);
+		}
+		return;
+	}
+	while (to - t >= n->timer) {
+		t += n->timer;
+		n->timer = n->period;
+		n->lfsr = apu_noise_step(n->lfsr, n->mode);
+		apu_output(APU_NOISE, t, apu_noise_out(n));
+	}
+	n->timer -= to - t;
+}
+
+static void apu_dmc_fetch() {
+	//memory reader, refills the sample buffer
+	apu_dmc* d = &_apu.dmc;
+	if (d->buffered || d->remaining == 0) return;
+	d->buffer = core_get_mem(d->address);
+	d->buffered = 1;
+	d->address = (d->address == 0xFFFF) ? 0x8000 : d->address + 1;
+	if (--d->remaining == 0) {
+		if (d->control & 0x40) {
+			d->address = d->sample_address;
+			d->remaining = d->sample_length;
+		} else if (d->control & 0x80) _apu.dmc_irq = 1;
+	}
+}
+
+static void apu_dmc_run(uint32 from, uint32 to) {
+	apu_dmc* d = &_apu.dmc;
+	uint32 t = from, n;
+	if (d->silence && !d->buffered && d->remaining == 0) {
+		//idle, only the bit counter turns
+		if (to - t < d->timer) {
+			d->timer -= to - t;
+			return;
+		}
+		t += d->timer;
+		n = (to - t) / d->period;
+		d->bits = (uint8)(((d->bits - 1 + 8 - (n + 1) % 8) % 8) + 1);
+		d->timer = d->period - ((to - t) - n * d->period);
+		return;
+	}
+	while (to - t >= d->timer) {
+		t += d->timer;
+		d->timer = d->period;
+		if (!d->silence) {
+			if (d->shift & 1) {
+				if (d->level <= 125) d->level += 2;
+			} else if (d->level >= 2) d->level -= 2;
+			apu_output(APU_DMC, t, d->level);
+		}
+		d->shift >>= 1;
+		if (--d->bits == 0) {
+			d->bits = 8;
+			d->silence = !d->buffered;
+			d->shift = d->buffer;
+			d->buffered = 0;
+			apu_dmc_fetch();
+		}
+	}
+	d->timer -= to - t;
+}
+
+static void apu_envelope_clock(apu_envelope* env) {
+	if (env->start) {
+		env->start = 0;
+		env->decay = 15;
+		env->divider = env->period;
+	} else if (env->divider == 0) {
+		env->divider = env->period;
+		if (env->decay) env->decay--;
+		else if (env->loop) env->decay = 15;
+	} else env->divider--;
+}
+
+static void apu_quarter_frame() {
+	apu_triangle* tr = &_apu.triangle;
+	apu_envelope_clock(&_apu.pulse[0].env);
+	apu_envelope_clock(&_apu.pulse[1].env);
+	apu_envelope_clock(&_apu.noise.env);
+	if (tr->linear_reload) tr->linear = tr->control & 0x7F;
+	else if (tr->linear) tr->linear--;
+	if (!(tr->control & 0x80)) tr->linear_reload = 0;
+}
+
+static void apu_half_frame() {
+	apu_pulse* p;
+	uint16 change;
+	for (uint8 i = 0; i < 2; i++) {
+		p = &_apu.pulse[i];
+		if (p->length && !p->env.loop) p->length--;
+		//sweep, pulse 1 negates in ones' complement
+		change = p->period >> (p->sweep & 7);
+		if (p->sweep & 0x08) change = (i == 0) ? change + 1 : change;
+		if (p->sweep_divider == 0 && (p->sweep & 0x80) && (p->sweep & 7) && !apu_pulse_muted(p)) {
+			p->period = (p->sweep & 0x08) ? p->period - change : p->period + change;
+		}
+		if (p->sweep_divider == 0 || p->sweep_reload) {
+			p->sweep_divider = (p->sweep >> 4) & 7;
+			p->sweep_reload = 0;
+		} else p->sweep_divider--;
+	}
+	if (_apu.triangle.length && !(_apu.triangle.control & 0x80)) _apu.triangle.length--;
+	if (_apu.noise.length && !_apu.noise.env.loop) _apu.noise.length--;
+}
+
+static void apu_frame_clock() {
+	//frame counter step reached
+	uint8 step = _apu.frame_step;
+	if (_apu.frame_mode == 0 || step != 3) apu_quarter_frame();
+	if (step == 1 || (_apu.frame_mode == 0 && step == 3) || step == 4) apu_half_frame();
+	if (_apu.frame_mode == 0 && step == 3 && !_apu.frame_inhibit) _apu.frame_irq = 1;
+	if (++_apu.frame_step == 4 + _apu.frame_mode) {
+		_apu.frame_step = 0;
+		_apu.frame_cycle -= _apu_frame_period[_apu.frame_mode];
+	}
+	apu_outputs(_apu.time);
+}
+
+static void apu_run(uint32 to) {
+	//catch up to cycle to, split at frame counter steps
+	uint32 end, step;
+	while (_apu.time != to) {
+		step = _apu.time + (_apu_frame_step[_apu.frame_mode][_apu.frame_step] - _apu.frame_cycle);
+		end = ((int32)(step - to) < 0) ? step : to;
+		apu_pulse_run(0, _apu.time, end);
+		apu_pulse_run(1, _apu.time, end);
+		apu_triangle_run(_apu.time, end);
+		apu_noise_run(_apu.time, end);
+		apu_dmc_run(_apu.time, end);
+		_apu.frame_cycle += end - _apu.time;
+		_apu.time = end;
+		if (end == step) apu_frame_clock();
+	}
+}
+
+static void apu_catch_up(uint32 now) {
+	//run to now, taking every block that completes on the way
+	uint32 due;
+	for (;;) {
+		due = apu_block_due();
+		if (due == _apu.time) {
+			apu_take_block();
+			continue;
+		}
+		if (_apu.time == now) break;
+		apu_run(((int32)(due - now) < 0) ? due : now);
+	}
+}
+
+uint32 apu_get_due() {
+	//next cycle the apu needs the cpu to call apu_sync: block end, frame irq or dmc fetch
+	uint32 due = apu_block_due();
+	uint32 t;
+	if (_apu.frame_mode == 0 && !_apu.frame_inhibit && !_apu.frame_irq) {
+		t = _apu.time + (_apu_frame_step[0][3] - _apu.frame_cycle);
+		if ((int32)(t - due) < 0) due = t;
+	}
+	if (_apu.dmc.remaining != 0) {
+		//the buffer refills when the shift register reloads, memory is read at that cycle
+		t = _apu.time + _apu.dmc.timer + (_apu.dmc.bits - 1) * _apu.dmc.period;
+		if ((int32)(t - due) < 0) due = t;
+	}
+	return due;
+}
+
+static __forceinline std::chrono::steady_clock::time_point apu_clock() {
+	return std::chrono::steady_clock::now();
+}
+
+static __forceinline void apu_account(std::chrono::steady_clock::time_point start) {
+	_apu_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32 apu_sync(uint32 now) {
+	//catch up to the cpu, returns the next cycle to call again
+	auto start = apu_clock();
+	apu_catch_up(now);
+	apu_account(start);
+	return apu_get_due();
+}
+
+uchar apu_get_irq() {
+	return _apu.frame_irq | _apu.dmc_irq;
+}
+
+uchar apu_read(uint32 now) {
+	//$4015, reading acknowledges the frame irq
+	uchar val;
+	auto start = apu_clock();
+	apu_catch_up(now);
+	val = (_apu.pulse[0].length ? 0x01 : 0) | (_apu.pulse[1].length ? 0x02 : 0) |
+		(_apu.triangle.length ? 0x04 : 0) | (_apu.noise.length ? 0x08 : 0) |
+		(_apu.dmc.remaining ? 0x10 : 0) | (_apu.frame_irq ? 0x40 : 0) | (_apu.dmc_irq ? 0x80 : 0);
+	_apu.frame_irq = 0;
+	apu_account(start);
+	return val;
+}
+
+void apu_write(uint16 address, uchar val, uint32 now) {
+	//$4000-$4013, $4015, $4017 at cpu cycle now
+	apu_pulse* p;
+	apu_envelope* env = NULL;
+	auto start = apu_clock();
+	if (_apu_log != NULL) _apu_log(address, val, now);
+	apu_catch_up(now);
+	switch (address) {
+	case 0x4000: case 0x4004:
+		p = &_apu.pulse[(address >> 2) & 1];
+		p->duty = val >> 6;
+		env = &p->env;
+		break;
+	case 0x4001: case 0x4005:
+		p = &_apu.pulse[(address >> 2) & 1];
+		p->sweep = val;
+		p->sweep_reload = 1;
+		break;
+	case 0x4002: case 0x4006:
+		p = &_apu.pulse[(address >> 2) & 1];
+		p->period = (p->period & 0x700) | val;
+		break;
+	case 0x4003: case 0x4007:
+		p = &_apu.pulse[(address >> 2) & 1];
+		p->period = (p->period & 0xFF) | ((val & 7) << 8);
+		if (_apu.enable & (1 << ((address >> 2) & 1))) p->length = _apu_length[val >> 3];
+		p->step = 0;
+		p->env.start = 1;
+		break;
+	case 0x4008:
+		_apu.triangle.control = val;
+		break;
+	case 0x400A:
+		_apu.triangle.period = (_apu.triangle.period & 0x700) | val;
+		break;
+	case 0x400B:
+		_apu.triangle.period = (_apu.triangle.period & 0xFF) | ((val & 7) << 8);
+		if (_apu.enable & 0x04) _apu.triangle.length = _apu_length[val >> 3];
+		_apu.triangle.linear_reload = 1;
+		break;
+	case 0x400C:
+		env = &_apu.noise.env;
+		break;
+	case 0x400E:
+		_apu.noise.mode = val >> 7;
+		_apu.noise.period = _apu_noise_period[val & 15];
+		break;
+	case 0x400F:
+		if (_apu.enable & 0x08) _apu.noise.length = _apu_length[val >> 3];
+		_apu.noise.env.start = 1;
+		break;
+	case 0x4010:
+		_apu.dmc.control = val;
+		_apu.dmc.period = _apu_dmc_period[val & 15];
+		if (!(val & 0x80)) _apu.dmc_irq = 0;
+		break;
+	case 0x4011:
+		_apu.dmc.level = val & 0x7F;
+		break;
+	case 0x4012:
+		_apu.dmc.sample_address = 0xC000 | (val << 6);
+		break;
+	case 0x4013:
+		_apu.dmc.sample_length = (val << 4) | 1;
+		break;
+	case 0x4015:
+		_apu.enable = val & 0x1F;
+		if (!(val & 0x01)) _apu.pulse[0].length = 0;
+		if (!(val & 0x02)) _apu.pulse[1].length = 0;
+		if (!(val & 0x04)) _apu.triangle.length = 0;
+		if (!(val & 0x08)) _apu.noise.length = 0;
+		_apu.dmc_irq = 0;
+		if (!(val & 0x10)) _apu.dmc.remaining = 0;
+		else if (_apu.dmc.remaining == 0) {
+			_apu.dmc.address = _apu.dmc.sample_address;
+			_apu.dmc.remaining = _apu.dmc.sample_length;
+			apu_dmc_fetch();
+		}
+		break;
+	case 0x4017:
+		_apu.frame_mode = val >> 7;
+		_apu.frame_inhibit = (val >> 6) & 1;
+		if (_apu.frame_inhibit) _apu.frame_irq = 0;
+		_apu.frame_cycle = 0;
+		_apu.frame_step = 0;
+		if (_apu.frame_mode) {
+			apu_quarter_frame();
+			apu_half_frame();
+		}
+		break;
+	}
+	if (env != NULL) {
+		env->loop = (val >> 5) & 1;
+		env->constant = (val >> 4) & 1;
+		env->period = val & 15;
+	}
+	apu_outputs(now);
+	apu_account(start);
+}
+
+void apu_reset() {
+	//power on, called by core_start
+	if (_apu_rate == 0) apu_init(APU_DEFAULT_RATE);
+	memset(&_apu, 0, sizeof(_apu));
+	_apu.noise.lfsr = 1;
+	_apu.noise.period = _apu_noise_period[0];
+	_apu.dmc.period = _apu_dmc_period[0];
+	_apu.dmc.bits = 8;
+	_apu.dmc.silence = 1;
+	_apu.pulse[0].timer = _apu.pulse[1].timer = 2;
+	_apu.triangle.timer = _apu.noise.timer = 1;
+	_apu.dmc.timer = _apu.dmc.period;
+	_apu_level = 0;
+	_apu_sum = _apu_dc = 0;
+	_apu_base = 0;
+	_apu_offset = 0;
+	memset(_apu_buffer, 0, sizeof(_apu_buffer));
+}
+
+size_t apu_state_size() {
+	return sizeof(apu_state);
+}
+
+void apu_save_state(void* buffer) {
+	//caught up by the core first
+	memcpy(buffer, &_apu, sizeof(_apu));
+}
+
+void apu_load_state(const void* buffer) {
+	//the synthesis carries on where it was, the level jumps to the loaded outputs
+	uint64 pos = apu_pos(_apu.time);
+	float level = 0;
+	memcpy(&_apu, buffer, sizeof(_apu));
+	_apu_base = _apu.time;
+	_apu_offset = pos;
+	for (uint8 i = 0; i < APU_CHANNELS; i++) level += _apu_weight[i] * _apu.out[i];
+	if ((pos >> 32) <= APU_BUFFER) apu_add(_apu_buffer + (pos >> 32), _apu_kernel[(pos >> APU_PHASE_SHIFT) & (APU_PHASES - 1)], level - _apu_level);
+	_apu_level = level;
+}
+
+size_t apu_get_regs(uchar* buffer) {
+	//channel state for the state hash, caught up by the core first
+	memcpy(buffer, &_apu, sizeof(_apu));
+	return sizeof(_apu);
+}
+
+void apu_set_mute(uchar mute) {
+	//blocks of muted frames are synthesized but not queued, for frames emulated ahead
+	_apu_mute = mute;
+}
+
+void apu_set_wait(uchar wait) {
+	//wait for the audio thread on a full ring instead of dropping the block, for offline output
+	_apu_wait = wait;
+}
+
+void apu_set_sink(void (*sink)(const int16* samples, uint32 count)) {
+	//blocks go to sink on the emulation thread instead of the ring, NULL for the ring
+	_apu_sink = sink;
+}
+
+void apu_set_log(void (*log)(uint16 address, uchar val, uint32 now)) {
+	//every register write with its cpu cycle, before the apu takes it
+	_apu_log = log;
+}
+
+uint32 apu_get_rate() {
+	return _apu_rate;
+}
+
+uint32 apu_get_dropped() {
+	return _apu_dropped;
+}
+
+double apu_get_time() {
+	//host seconds spent catching up the apu
+	return _apu_seconds;
+}
@@ -0,0 +1,131 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+startup snapshot cache
+
+batch sessions all emulate the same reset code and title screen. the first
+session to reach the chosen frame saves the machine to
+
+	dir/<rom hash>-<frame>-<state size>.boot		boot_header, machine state
+
+and later sessions map that file and load it instead of emulating. the key has
+the rom hash and BOOT_VERSION, the state size in the name keeps the full and
+the USE_LOWMEM layouts in files of their own when builds share a dir.
+core_load_state still rejects states of another build, a rejected file is
+rebuilt.
+*/
+
+typedef struct nes_rom nes_rom;
+extern void rom_start(const nes_rom* rom);
+extern uint64 rom_hash(const nes_rom* rom);
+extern const uchar* rom_map(const char* path, size_t* size);
+extern void rom_unmap(const uchar* base, size_t size);
+extern uchar core_exec(uchar* vbuffer);
+extern size_t core_state_size();
+extern size_t core_save_state(uchar* buffer, size_t size);
+extern uchar core_load_state(const uchar* buffer, size_t size);
+extern void ppu_set_video(uchar enable);
+
+#include <chrono>
+
+#define BOOT_MAGIC			0x544F4F42		//"BOOT"
+#define BOOT_VERSION		1				//bump when a change makes the same frame compute a different machine
+#define BOOT_PATH			512				//cache file name, longer dirs run without the cache
+
+typedef struct boot_header {
+	uint32 magic;
+	uint32 version;
+	uint64 hash;
+	uint32 frame;
+	uint32 size;					//machine state bytes that follow
+} boot_header;
+
+static double _boot_time = 0;		//seconds to the first useful frame of the last boot_start
+
+#if !defined(_WIN32)
+#include <unistd.h>
+
+#define BOOT_PID()			((int)getpid())
+
+static uchar boot_replace(const char* from, const char* to) {
+	return rename(from, to) == 0;
+}
+#else
+#define BOOT_PID()			((int)GetCurrentProcessId())
+
+static uchar boot_replace(const char* from, const char* to) {
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#endif
+
+static uchar boot_load(const char* path, uint64 hash, uint32 frame) {
+	size_t size = 0;
+	const uchar* base = rom_map(path, &size);
+	const boot_header* h = (const boot_header*)base;
+	uchar ret = 0;
+	if (base == NULL) return 0;
+	if (size >= sizeof(boot_header) && h->magic == BOOT_MAGIC && h->version == BOOT_VERSION && h->hash == hash &&
+		h->frame == frame && size >= sizeof(boot_header) + h->size) {
+		ret = core_load_state(base + sizeof(boot_header), h->size);
+	}
+	rom_unmap(base, size);
+	return ret;
+}
+
+static void boot_save(const char* path, uint64 hash, uint32 frame) {
+	//written under a private name and renamed, concurrent sessions never see half a file
+	char temp[BOOT_PATH + 16];			//path, pid and suffix
+	boot_header h;
+	uchar* state;
+	FILE* ff;
+	int len = snprintf(temp, sizeof(temp), "%s.%d.tmp", path, BOOT_PID());
+	if (len < 0 || len >= (int)sizeof(temp)) return;
+	h.magic = BOOT_MAGIC;
+	h.version = BOOT_VERSION;
+	h.hash = hash;
+	h.frame = frame;
+	h.size = (uint32)core_state_size();
+	state = (uchar*)malloc(h.size);
+	if (state == NULL) return;
+	core_save_state(state, h.size);
+	ff = fopen(temp, "wb");
+	if (ff != NULL) {
+		uchar ok = fwrite(&h, sizeof(h), 1, ff) == 1 && fwrite(state, h.size, 1, ff) == 1;
+		if (fclose(ff) != 0) ok = 0;
+		if (!ok || !boot_replace(temp, path)) remove(temp);
+	}
+	free(state);
+}
+
+uchar boot_start(const nes_rom* rom, const char* dir, uint32 frame, uchar* vbuffer) {
+	//power on and bring the machine to frame, from the cache when possible, returns 1 on a cache hit
+	char path[BOOT_PATH];
+	uint64 hash = rom_hash(rom);
+	uchar hit, cached;
+	auto start = std::chrono::steady_clock::now();
+	int len = snprintf(path, sizeof(path), "%s/%016llx-%u-%u.boot", dir, (unsigned long long)hash, frame, (uint32)core_state_size());
+	cached = (frame != 0) && len > 0 && len < (int)sizeof(path);
+	rom_start(rom);
+	hit = cached && boot_load(path, hash, frame);
+	if (!hit) {
+		//nothing shown before the snapshot point
+		ppu_set_video(0);
+		for (uint32 n = 0; n < frame; ) {
+			if (core_exec(vbuffer) != 0) n++;
+		}
+		ppu_set_video(1);
+		if (cached) boot_save(path, hash, frame);
+	}
+	_boot_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return hit;
+}
+
+double boot_get_time() {
+	//time to the first useful frame of the last boot_start, seconds
+	return _boot_time;
+}
@@ -0,0 +1,137 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+instance cloning for tree search
+
+the machine lives in globals, so a clone is a fork of the process. rom, chr rom,
+the prerendered background plane and code stay shared, ram pages are copied by
+the kernel on first write. a clone that runs a few frames in logic only mode
+owns the pages of cpu ram, oam, the touched vram and the stack.
+
+clones are also the instances of batch simulation, logic_bench runs one per
+core at the same time to give frames per second per core.
+*/
+
+extern uchar core_exec(uchar* vbuffer);
+extern void ppu_fork_prepare();
+extern void ppu_fork_child();
+extern void ppu_set_logic(uchar enable);
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#include <time.h>
+
+int core_clone() {
+	//fork the running instance, returns 0 in the clone, clone pid in the caller, -1 on failure
+	int pid;
+	fflush(stdout);
+	ppu_fork_prepare();
+	pid = fork();
+	if (pid == 0) ppu_fork_child();
+	return pid;
+}
+
+static size_t clone_private_size() {
+	//pages this process no longer shares with its parent
+	char line[128];
+	size_t kb = 0;
+	FILE* ff = fopen("/proc/self/smaps_rollup", "r");
+	if (ff == NULL) return 0;
+	while (fgets(line, sizeof(line), ff) != NULL) {
+		if (sscanf(line, "Private_Dirty: %zu kB", &kb) == 1) break;
+	}
+	fclose(ff);
+	return kb;
+}
+
+void clone_bench(uchar* vbuffer, uint32 count, uint32 frames) {
+	//clones per second, each clone runs frames frames without video and reports its own pages
+	struct timespec start, end;
+	int fd[2];
+	int pid;
+	uint32 i, n;
+	size_t kb, total = 0;
+	double elapsed;
+	if (pipe(fd) != 0) return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		pid = core_clone();
+		if (pid < 0) break;
+		if (pid == 0) {
+			ppu_set_logic(1);
+			for (n = 0; n < frames; ) {
+				if (core_exec(vbuffer) != 0) n++;
+			}
+			kb = clone_private_size();
+			if (write(fd[1], &kb, sizeof(kb)) != sizeof(kb)) _exit(1);
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+		if (read(fd[0], &kb, sizeof(kb)) == sizeof(kb)) total += kb;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(fd[0]);
+	close(fd[1]);
+	if (i == 0) return;
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("clone    %u clones, %u frames each, %.0f clones/s, %zu KB private per clone\n", i, frames, i / elapsed, total / i);
+}
+
+void logic_bench(uchar* vbuffer, uint32 instances, uint32 frames) {
+	//instances clones in logic only mode at once, each times its own frames
+	struct timespec start, end;
+	int fd[2];
+	uint32 i, n, count = 0;
+	double fps, sum = 0, low = 0, high = 0, elapsed;
+	if (pipe(fd) != 0) return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < instances; i++) {
+		int pid = core_clone();
+		if (pid < 0) break;
+		if (pid == 0) {
+			struct timespec t0, t1;
+			close(fd[0]);
+			ppu_set_logic(1);
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (n = 0; n < frames; ) {
+				if (core_exec(vbuffer) != 0) n++;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			fps = frames / ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+			if (write(fd[1], &fps, sizeof(fps)) != sizeof(fps)) _exit(1);
+			_exit(0);
+		}
+	}
+	close(fd[1]);
+	while (read(fd[0], &fps, sizeof(fps)) == sizeof(fps)) {
+		if (count == 0 || fps < low) low = fps;
+		if (fps > high) high = fps;
+		sum += fps;
+		count++;
+	}
+	close(fd[0]);
+	while (wait(NULL) > 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (count == 0) return;
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("logic    %u instances, %u frames each, %.0f fps per core (%.0f - %.0f), %.0f fps together\n", count, frames,
+		sum / count, low, high, count * (double)frames / elapsed);
+}
+#else
+int core_clone() {
+	//no copy-on-write process duplication on this host
+	return -1;
+}
+
+void clone_bench(uchar* vbuffer, uint32 count, uint32 frames) {
+}
+
+void logic_bench(uchar* vbuffer, uint32 instances, uint32 frames) {
+}
+#endif
@@ -1,5 +1,9 @@
+#ifdef _WIN32
 #include "stdafx.h"
 #include "defs.h"
+#else
+#include "port.h"
+#endif
 
 typedef struct nes_mmc1 {
 	uint8 cr;
@@ -19,6 +23,7 @@ typedef struct nes_mapper {
 	uint8* chrom;		//character rom
 	int chsize;
 	void* payload;
+	uint16 base;		//lowest register address, below $8000 only the expansion area up to $5FFF
 	void (*read)(void * payload, uint16 address, uint8 data);
 	void (*write)(void* payload, uint16 address, uint8 data);
 } nes_mapper;
@@ -50,12 +55,28 @@ extern uchar ppu_get_spr_data();
 extern void ppu_set_mem_data(uint8 data);
 extern uchar ppu_get_mem_data();
 extern void ppu_init(uint8 config);
-extern void ppu_render(uchar* output);
+extern uchar ppu_render(uchar* output);
+extern void ppu_render_begin();
 extern void ppu_set_vblank(uchar flag);
 extern uchar ppu_get_vblank();
+extern size_t ppu_state_size();
+extern void ppu_save_state(void* buffer);
+extern void input_drain(uint8* buttons, uint32 frame, uint32 cycle);
+extern void ppu_load_state(const void* buffer);
+extern void apu_reset();
+extern uint32 apu_sync(uint32 now);
+extern uint32 apu_get_due();
+extern uchar apu_get_irq();
+extern uchar apu_read(uint32 now);
+extern void apu_write(uint16 address, uchar val, uint32 now);
+extern size_t apu_state_size();
+extern void apu_save_state(void* buffer);
+extern void apu_load_state(const void* buffer);
+extern size_t apu_get_regs(uchar* buffer);
 
 #define SR_FLAG_N			0x80
 #define SR_FLAG_V			0x40
+#define SR_FLAG_U			0x20		//unused, reads as 1 on the stack
 #define SR_FLAG_B			0x10
 #define SR_FLAG_D			0x08
 #define SR_FLAG_I			0x04
@@ -69,10 +90,61 @@ uchar _y = 0;				//y register
 uchar _sr = 0;			//status register
 uchar _sp = 0xfd;				//stack pointer
 
+#if USE_LOWMEM
+uchar _sram[0x800];			//nes internal ram, mirrored up to 0x1FFF
+uchar _wram[0x2000];		//cartridge ram (0x6000-0x7FFF)
+uchar* _prg[4] = { NULL, NULL, NULL, NULL };			//8KB program rom windows (0x8000-0xFFFF), read in place
+uchar _fetch[3];			//opcode bytes crossing a window boundary
+#else
 uchar _sram[65536];			//nes sram
+#endif
 uchar* _stack = _sram + 0x100;
+uint32 _cycles = 0;			//cpu cycles since reset
+
+//dirty page bitmaps, 1 bit per (1 << _dirty_shift) bytes, set on every write and cleared by the reader
+#define DIRTY_RAM			0			//_sram as stored (whole 64KB without USE_LOWMEM)
+#define DIRTY_SRAM			1			//cartridge ram, inside DIRTY_RAM without USE_LOWMEM
+#define DIRTY_VRAM			2
+#define DIRTY_OAM			3
+#define DIRTY_MIN_SHIFT		6			//64 byte pages
+#define DIRTY_MAX_SHIFT		12
+#define DIRTY_WORDS(size)	((((size) >> DIRTY_MIN_SHIFT) + 63) / 64)
+static uint8 _dirty_shift = 8;
+static uint64 _dirty_ram[DIRTY_WORDS(sizeof(_sram))];
+#if USE_LOWMEM
+static uint64 _dirty_wram[DIRTY_WORDS(sizeof(_wram))];
+#endif
+#define DIRTY_MARK(map, offset)		{ uint32 _p = (uint32)(offset) >> _dirty_shift; map[_p >> 6] |= (uint64)1 << (_p & 63); }
+extern void ppu_dirty_config(uint8 shift);
+extern uint32 ppu_dirty_get(uint8 oam, uint64* bitmap, uchar clear);
+extern uint8* ppu_dirty_memory(uint8 oam, uint32* size);
+extern size_t ppu_get_regs(uchar* buffer);
+
+void core_dirty_range(uint64* map, uint32 offset, uint32 size) {
+	uint32 last = (offset + size - 1) >> _dirty_shift;
+	for (uint32 p = offset >> _dirty_shift; p <= last; p++) map[p >> 6] |= (uint64)1 << (p & 63);
+}
+
+static const uint8 _cycle_table[256] = {		//base cycles per opcode, no page crossing penalty
+	7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+	2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+	2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+};
 nes_mapper _mmc = {
-	NULL, 0, NULL, NULL
+	NULL, 0, NULL, 0, NULL, 0x8000
 };
 
 
@@ -158,101 +230,132 @@ __forceinline uchar core_ror(uchar a, uchar l) {
 	}	\
 }
 
-__forceinline uchar add_is_overflow(int8 lhs, int8 rhs) {
-	if (lhs > 0 && rhs > 0 && (rhs > (INT8_MAX - lhs))) return 1;
-	if (lhs < 0 && rhs < 0 && (lhs < (INT8_MIN - rhs))) return 1;
-	return 0;
+__forceinline uchar add_is_overflow(uchar lhs, uchar rhs, uchar result) {
+	//operands of the same sign and a result of the other sign, result includes the carry in
+	return (~(lhs ^ rhs) & (lhs ^ result) & 0x80) != 0;
 }
 
-__forceinline uchar sub_is_overflow(int8 lhs, int8 rhs) {
-	register int8 diff = lhs - rhs;
-	//printf("diff:%x, lhs:%x, rhs:%x\n", diff, lhs, rhs);
-	if (rhs >= 0 && diff > lhs)return 1;
-	if (rhs < 0 && diff < lhs)return 1;
-	//printf("return 0;\n");
-	return 0;
+__forceinline uchar sub_is_overflow(uchar lhs, uchar rhs, uchar result) {
+	//operands of different sign and a result with the sign of rhs, result includes the borrow
+	return ((lhs ^ rhs) & (lhs ^ result) & 0x80) != 0;
 }
 
-__forceinline uchar core_add(uchar a, uchar operand, uchar* sr) {
+template<class variant> __forceinline uchar core_add(uchar a, uchar operand, uchar* sr) {
 	//check D flag for BCD operation, C flag for carry operation, set C if needed
-	uchar nb = 0;
 	register uchar bcr = 0;
 	register uint16 ret;
-	if (add_is_overflow(a, operand)) sr[0] |= SR_FLAG_V;
+	uint8 lo, hi;
+	ret = a + operand + (sr[0] & SR_FLAG_C);
+	if (add_is_overflow(a, operand, ret)) sr[0] |= SR_FLAG_V;
 	else sr[0] &= ~SR_FLAG_V;
-	//if (_sr & SR_FLAG_D) {
-	if (0) {
-		nb = ((a & 0x0F) + (operand & 0x0F) + (sr[0] & SR_FLAG_C));
-		bcr = nb / 10;
-		nb = nb % 10;
-		a = (a / 16) + (operand / 16) + bcr;
-		bcr = a / 10;
-		a = a % 10;
-		a <<= 4;
-		a |= nb;
-		ret = a;
-	}
-	else {
-		ret = a + operand + (sr[0] & SR_FLAG_C);
-		if (ret > 255) bcr = 1;
+	if (variant::decimal && (sr[0] & SR_FLAG_D)) {
+		lo = (a & 0x0F) + (operand & 0x0F) + (sr[0] & SR_FLAG_C);
+		if (lo > 9) lo += 6;
+		hi = (a >> 4) + (operand >> 4) + (lo > 0x0F);
+		if (hi > 9) hi += 6;
+		if (hi > 0x0F) bcr = 1;
+		ret = (hi << 4) | (lo & 0x0F);
 	}
+	else if (ret > 255) bcr = 1;
 	if (bcr) sr[0] |= SR_FLAG_C;
 	else sr[0] &= ~SR_FLAG_C;
 	return ret;
 }
 
-__forceinline uchar core_sub(int8 a, int8 operand, uchar* sr) {
-	uchar nb = 0;
-	register uchar op1;
+template<class variant> __forceinline uchar core_sub(uchar a, uchar operand, uchar* sr) {
+	register uchar op1 = a;
 	uchar temp;
-	uint16 res;
 	int16 ires;
 	register uchar carry = 0;
-	uchar bcr = 0;
-	int16 ret = 0;
-	uchar a_0;
-	uchar a_1;
-	uchar o_0;
-	uchar o_1 = (operand & 0x0F) % 10;
-	if (sub_is_overflow(a, operand)) sr[0] |= SR_FLAG_V;
+	int16 lo, hi;
+	carry = !(sr[0] & SR_FLAG_C);
+	ires = ((uchar)op1 - (uchar)carry) - (uchar)operand;
+	temp = ires;
+	if (sub_is_overflow(op1, operand, temp)) sr[0] |= SR_FLAG_V;
 	else sr[0] &= ~SR_FLAG_V;
-	//if (_sr & SR_FLAG_D) {
-	if (0) {
-		a_0 = a / 16;
-		a_1 = (a & 0x0F) % 10;
-		o_0 = operand / 16;
-		o_1 = (operand & 0x0F) % 10;
-		if (a_1 < (o_1 + (sr[0] & SR_FLAG_C))) {
-			nb = a_1 + 10 - (o_1 + (sr[0] & SR_FLAG_C));
-			bcr = 1;
-		}
-		else {
-			nb = a_1 - (o_1 + (sr[0] & SR_FLAG_C));
-		}
-		if (a_0 < (o_0 + bcr)) {
-			a = a_0 + 10 - (o_0 + bcr);
-			bcr = 1;
-		}
-		else {
-			a = a_0 - (o_0 + bcr);
+	if (variant::decimal && (sr[0] & SR_FLAG_D)) {
+		//borrow per nibble, carry same as binary
+		lo = ((uchar)op1 & 0x0F) - ((uchar)operand & 0x0F) - carry;
+		hi = ((uchar)op1 >> 4) - ((uchar)operand >> 4);
+		if (lo < 0) {
+			lo -= 6;
+			hi--;
 		}
-		a = a % 10;
-		a <<= 4;
-		a |= nb;
-		ret = a;
-	}
-	else {
-		carry = !(sr[0] & SR_FLAG_C);
-		op1 = _acc;
-		res = (int16)((int8)op1 - carry) - (int16)operand;
-		ires = ((uchar)op1 - (uchar)carry) - (uchar)operand;
-		temp = ires;
-		if (ires & 0x100) { sr[0] &= ~SR_FLAG_C; }
-		else { sr[0] |= SR_FLAG_C; }
+		if (hi < 0) hi -= 6;
+		temp = (hi << 4) | (lo & 0x0F);
 	}
+	if (ires & 0x100) { sr[0] &= ~SR_FLAG_C; }
+	else { sr[0] |= SR_FLAG_C; }
+	return temp;
+}
 
-	ret = temp;
-	return ret;
+#if USE_LOWMEM
+__forceinline uchar* core_map(uint16 address) {
+	//resolve address to backing memory, NULL for unmapped region
+	if (address < 0x2000) return _sram + (address & 0x7FF);
+	if (address & 0x8000) return _prg[(address >> 13) & 0x03] + (address & 0x1FFF);
+	if (address >= 0x6000) return _wram + (address & 0x1FFF);
+	return NULL;
+}
+
+__forceinline uchar core_peek(uint16 address) {
+	uchar* ptr = core_map(address);
+	if (ptr == NULL) return 0;
+	return ptr[0];
+}
+
+__forceinline uchar* core_fetch(uint16 address) {
+	//opcode pointer, instructions crossing a 2KB window are copied
+	if ((address & 0x7FF) < 0x7FE) return core_map(address);
+	_fetch[0] = core_peek(address);
+	_fetch[1] = core_peek(address + 1);
+	_fetch[2] = core_peek(address + 2);
+	return _fetch;
+}
+#endif
+
+#define PAD_PORT1			0x4016		//write: strobe both pads, read: pad 1 serial
+#define PAD_PORT2			0x4017		//read: pad 2 serial
+
+uint8 _pad_buttons[2] = { 0, 0 };		//A B Select Start Up Down Left Right, bit 0 shifted out first
+uint8 _pad_shift[2] = { 0, 0 };
+uint8 _pad_strobe = 0;
+uint32 _frame = 0;						//frames since power on
+uint32 _frame_start = 0;				//_cycles when _frame began
+
+#define APU_STATUS			0x4015		//read: channel and irq status, write: channel enables
+
+uint32 _apu_due = 0;					//_cycles at which the apu has to catch up
+uchar _apu_irq = 0;						//frame counter or dmc irq pending
+
+__forceinline void core_apu_poll() {
+	//after an apu access, when to sync next and the irq line
+	_apu_due = apu_get_due();
+	_apu_irq = apu_get_irq();
+}
+
+__forceinline void core_apu_sync() {
+	_apu_due = apu_sync(_cycles);
+	_apu_irq = apu_get_irq();
+}
+
+__forceinline uchar pad_read(uint8 port) {
+	//serial bit of one pad, 1 after the eighth read like standard controllers
+	uchar bit;
+	if (_pad_strobe) return 0x40 | (_pad_buttons[port] & 1);
+	bit = _pad_shift[port] & 1;
+	_pad_shift[port] = (_pad_shift[port] >> 1) | 0x80;
+	return 0x40 | bit;				//upper bits read back as open bus
+}
+
+__forceinline void pad_strobe(uchar val) {
+	//queued input up to this cycle is applied when the game latches
+	if (val & 1) {
+		input_drain(_pad_buttons, _frame, _cycles - _frame_start);
+		_pad_shift[0] = _pad_buttons[0];
+		_pad_shift[1] = _pad_buttons[1];
+	}
+	_pad_strobe = val & 1;
 }
 
 uchar core_get_mem(uint16 address) {
@@ -286,11 +389,28 @@ uchar core_get_mem(uint16 address) {
 		break;
 	case 0x4014:			//DMA
 		break;
+	case APU_STATUS: {
+		uchar val = apu_read(_cycles);
+		core_apu_poll();
+		return val;
+	}
+	case PAD_PORT1:
+		return pad_read(0);
+	case PAD_PORT2:
+		return pad_read(1);
 	default:
+#if USE_LOWMEM
+		return core_peek(address);
+#else
 		return _sram[address];
+#endif
 		break;
 	}
+#if USE_LOWMEM
+	return core_peek(address);
+#else
 	return _sram[address];
+#endif
 
 }
 
@@ -323,41 +443,209 @@ uchar core_set_mem(uint16 address, uchar val) {
 		ppu_set_mem_data(val);
 		break;
 	case 0x4014:			//DMA
+#if USE_LOWMEM
+		if (core_map(val * 0x100) != NULL) ppu_dma_write(core_map(val * 0x100), 0x100);
+#else
 		ppu_dma_write(_sram + (val * 0x100), 0x100);
+#endif
+		_cycles += 513;			//cpu halted during oam dma
+		break;
+	case PAD_PORT1:
+		pad_strobe(val);
 		break;
 	default:
 		if (address & 0x8000) {
 			if (_mmc.write != NULL) _mmc.write(_mmc.payload, address, val);
+		} else if (address >= _mmc.base && address < 0x6000) {
+			if (_mmc.write != NULL) _mmc.write(_mmc.payload, address, val);		//registers in the expansion area
+		} else if (address >= 0x4000 && address <= 0x4017) {
+			apu_write(address, val, _cycles);		//sound registers, $4015 and the frame counter at $4017
+			core_apu_poll();
 		} else {
+#if USE_LOWMEM
+			uchar* ptr = core_map(address);
+			if (ptr != NULL) {
+				ptr[0] = val;
+				if (address < 0x2000) DIRTY_MARK(_dirty_ram, ptr - _sram)
+				else DIRTY_MARK(_dirty_wram, ptr - _wram)
+			}
+#else
 			_sram[address] = val;
+			DIRTY_MARK(_dirty_ram, address);
+#endif
 		}
 		break;
 	}
 	return val;
 }
 
-uint16 core_get_word(uint16 address) {
+void core_debug(char* opcode, uint8 operand, uint16 address) {
+	printf("%04X : %s %04X\r\n", _pc, opcode, address);
+}
+
+#define USE_CARRY		(_sr & 0x01)
+#define USE_CARRY		0
+#define CPU_DEBUG(x)	//core_debug(x, operand, address);
+
+//cpu variants, resolved at compile time
+struct cpu_2a03 { enum { decimal = 0, cmos = 0 }; };		//nes cpu, D flag has no effect
+struct cpu_6502 { enum { decimal = 1, cmos = 0 }; };		//nmos with bcd
+struct cpu_65c02 { enum { decimal = 1, cmos = 1 }; };		//cmos extensions, undocumented opcodes are nops
+
+//memory buses
+struct bus_nes {			//ppu registers, dma and mapper through core_get_mem/core_set_mem
+	static __forceinline uchar read(uint16 address) { return core_get_mem(address); }
+	static __forceinline void write(uint16 address, uchar val) { core_set_mem(address, val); }
+	static __forceinline uchar* stack() { return _stack; }
+	static __forceinline void pushed(uchar sp, uchar n) { DIRTY_MARK(_dirty_ram, 0x100 + (uchar)(sp + 1)); DIRTY_MARK(_dirty_ram, 0x100 + (uchar)(sp + n)); }
+};
+
+uchar* _flat = NULL;		//64KB ram of a bare 6502 system
+struct bus_flat {
+	static __forceinline uchar read(uint16 address) { return _flat[address]; }
+	static __forceinline void write(uint16 address, uchar val) { _flat[address] = val; }
+	static __forceinline uchar* stack() { return _flat + 0x100; }
+	static __forceinline void pushed(uchar sp, uchar n) { }
+};
+
+template<class bus> __forceinline uint16 core_read_word(uint16 address) {
+	//high byte wraps within the page
 	register uint16 hh = 0;
-	register uchar ll = core_get_mem(address);
+	register uchar ll = bus::read(address);
 	if ((address & 0xFF) == 0xFF) {
-		hh = core_get_mem(address & 0xFF00);
+		hh = bus::read(address & 0xFF00);
 	}
 	else {
-		hh = core_get_mem(address + 1);
+		hh = bus::read(address + 1);
 	}
 	return (hh * 256) + ll;
 }
 
-void core_debug(char* opcode, uint8 operand, uint16 address) {
-	printf("%04X : %s %04X\r\n", _pc, opcode, address);
+uint16 core_get_word(uint16 address) {
+	return core_read_word<bus_nes>(address);
 }
 
-#define USE_CARRY		(_sr & 0x01)
-#define USE_CARRY		0
-#define CPU_DEBUG(x)	//core_debug(x, operand, address);
+//operations, the undocumented set is decoded in core_step_cold
+#define OP_COLD			0
+#define OP_ORA			1
+#define OP_AND			2
+#define OP_EOR			3
+#define OP_ADC			4
+#define OP_STA			5
+#define OP_LDA			6
+#define OP_CMP			7
+#define OP_SBC			8
+#define OP_ASL			9
+#define OP_ROL			10
+#define OP_LSR			11
+#define OP_ROR			12
+#define OP_STX			13
+#define OP_LDX			14
+#define OP_DEC			15
+#define OP_INC			16
+#define OP_BIT			17
+#define OP_STY			18
+#define OP_LDY			19
+#define OP_CPY			20
+#define OP_CPX			21
+#define OP_JMP			22
+#define OP_JMI			23			//JMP indirect
+#define OP_JSR			24
+#define OP_RTS			25
+#define OP_RTI			26
+#define OP_BRK			27
+#define OP_BRANCH		28
+#define OP_FLAG			29			//CLC SEC CLI SEI CLV CLD SED
+#define OP_PHP			30
+#define OP_PLP			31
+#define OP_PHA			32
+#define OP_PLA			33
+#define OP_TAX			34
+#define OP_TAY			35
+#define OP_TXA			36
+#define OP_TYA			37
+#define OP_TSX			38
+#define OP_TXS			39
+#define OP_INX			40
+#define OP_INY			41
+#define OP_DEX			42
+#define OP_DEY			43
+#define OP_NOP			44
+
+//addressing modes
+#define MODE_IMP		0			//implied, accumulator
+#define MODE_IMM		1
+#define MODE_REL		2
+#define MODE_ZP			3
+#define MODE_ZPX		4
+#define MODE_ZPY		5
+#define MODE_ABS		6
+#define MODE_ABX		7
+#define MODE_ABY		8
+#define MODE_IZX		9			//(indirect, X)
+#define MODE_IZY		10			//(indirect), Y
+
+typedef struct core_opcode {
+	uint8 op;
+	uint8 mode;
+} core_opcode;
+
+static constexpr uint8 _mode_size[] = { 1, 2, 2, 2, 2, 2, 3, 3, 3, 2, 2 };
+
+static constexpr core_opcode _opcode_table[256] = {
+	{ OP_BRK, MODE_IMM }, { OP_ORA, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ORA, MODE_ZP }, { OP_ASL, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_PHP, MODE_IMP }, { OP_ORA, MODE_IMM }, { OP_ASL, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ORA, MODE_ABS }, { OP_ASL, MODE_ABS }, { OP_COLD, MODE_IMP },		//00
+	{ OP_BRANCH, MODE_REL }, { OP_ORA, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ORA, MODE_ZPX }, { OP_ASL, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_ORA, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ORA, MODE_ABX }, { OP_ASL, MODE_ABX }, { OP_COLD, MODE_IMP },		//10
+	{ OP_JSR, MODE_ABS }, { OP_AND, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_BIT, MODE_ZP }, { OP_AND, MODE_ZP }, { OP_ROL, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_PLP, MODE_IMP }, { OP_AND, MODE_IMM }, { OP_ROL, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_BIT, MODE_ABS }, { OP_AND, MODE_ABS }, { OP_ROL, MODE_ABS }, { OP_COLD, MODE_IMP },		//20
+	{ OP_BRANCH, MODE_REL }, { OP_AND, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_AND, MODE_ZPX }, { OP_ROL, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_AND, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_AND, MODE_ABX }, { OP_ROL, MODE_ABX }, { OP_COLD, MODE_IMP },		//30
+	{ OP_RTI, MODE_IMP }, { OP_EOR, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_EOR, MODE_ZP }, { OP_LSR, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_PHA, MODE_IMP }, { OP_EOR, MODE_IMM }, { OP_LSR, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_JMP, MODE_ABS }, { OP_EOR, MODE_ABS }, { OP_LSR, MODE_ABS }, { OP_COLD, MODE_IMP },		//40
+	{ OP_BRANCH, MODE_REL }, { OP_EOR, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_EOR, MODE_ZPX }, { OP_LSR, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_EOR, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_EOR, MODE_ABX }, { OP_LSR, MODE_ABX }, { OP_COLD, MODE_IMP },		//50
+	{ OP_RTS, MODE_IMP }, { OP_ADC, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ADC, MODE_ZP }, { OP_ROR, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_PLA, MODE_IMP }, { OP_ADC, MODE_IMM }, { OP_ROR, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_JMI, MODE_ABS }, { OP_ADC, MODE_ABS }, { OP_ROR, MODE_ABS }, { OP_COLD, MODE_IMP },		//60
+	{ OP_BRANCH, MODE_REL }, { OP_ADC, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ADC, MODE_ZPX }, { OP_ROR, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_ADC, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_ADC, MODE_ABX }, { OP_ROR, MODE_ABX }, { OP_COLD, MODE_IMP },		//70
+	{ OP_COLD, MODE_IMP }, { OP_STA, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_STY, MODE_ZP }, { OP_STA, MODE_ZP }, { OP_STX, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_DEY, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_TXA, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_STY, MODE_ABS }, { OP_STA, MODE_ABS }, { OP_STX, MODE_ABS }, { OP_COLD, MODE_IMP },		//80
+	{ OP_BRANCH, MODE_REL }, { OP_STA, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_STY, MODE_ZPX }, { OP_STA, MODE_ZPX }, { OP_STX, MODE_ZPY }, { OP_COLD, MODE_IMP }, { OP_TYA, MODE_IMP }, { OP_STA, MODE_ABY }, { OP_TXS, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_STA, MODE_ABX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP },		//90
+	{ OP_LDY, MODE_IMM }, { OP_LDA, MODE_IZX }, { OP_LDX, MODE_IMM }, { OP_COLD, MODE_IMP }, { OP_LDY, MODE_ZP }, { OP_LDA, MODE_ZP }, { OP_LDX, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_TAY, MODE_IMP }, { OP_LDA, MODE_IMM }, { OP_TAX, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_LDY, MODE_ABS }, { OP_LDA, MODE_ABS }, { OP_LDX, MODE_ABS }, { OP_COLD, MODE_IMP },		//A0
+	{ OP_BRANCH, MODE_REL }, { OP_LDA, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_LDY, MODE_ZPX }, { OP_LDA, MODE_ZPX }, { OP_LDX, MODE_ZPY }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_LDA, MODE_ABY }, { OP_TSX, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_LDY, MODE_ABX }, { OP_LDA, MODE_ABX }, { OP_LDX, MODE_ABY }, { OP_COLD, MODE_IMP },		//B0
+	{ OP_CPY, MODE_IMM }, { OP_CMP, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CPY, MODE_ZP }, { OP_CMP, MODE_ZP }, { OP_DEC, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_INY, MODE_IMP }, { OP_CMP, MODE_IMM }, { OP_DEX, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CPY, MODE_ABS }, { OP_CMP, MODE_ABS }, { OP_DEC, MODE_ABS }, { OP_COLD, MODE_IMP },		//C0
+	{ OP_BRANCH, MODE_REL }, { OP_CMP, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CMP, MODE_ZPX }, { OP_DEC, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_CMP, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CMP, MODE_ABX }, { OP_DEC, MODE_ABX }, { OP_COLD, MODE_IMP },		//D0
+	{ OP_CPX, MODE_IMM }, { OP_SBC, MODE_IZX }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CPX, MODE_ZP }, { OP_SBC, MODE_ZP }, { OP_INC, MODE_ZP }, { OP_COLD, MODE_IMP }, { OP_INX, MODE_IMP }, { OP_SBC, MODE_IMM }, { OP_NOP, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_CPX, MODE_ABS }, { OP_SBC, MODE_ABS }, { OP_INC, MODE_ABS }, { OP_COLD, MODE_IMP },		//E0
+	{ OP_BRANCH, MODE_REL }, { OP_SBC, MODE_IZY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_SBC, MODE_ZPX }, { OP_INC, MODE_ZPX }, { OP_COLD, MODE_IMP }, { OP_FLAG, MODE_IMP }, { OP_SBC, MODE_ABY }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_COLD, MODE_IMP }, { OP_SBC, MODE_ABX }, { OP_INC, MODE_ABX }, { OP_COLD, MODE_IMP },		//F0
+};
 
+#if defined(_MSC_VER)
+#define CORE_COLD		__declspec(noinline)
+#else
+#define CORE_COLD		__attribute__((noinline, cold))
+#endif
 
-void core_decode(uchar* opcodes) {
+#define core_flag_nz(val, psr) {	\
+	if (val == 0) psr |= SR_FLAG_Z;		\
+	else psr &= ~SR_FLAG_Z;		\
+	if (val & 0x80) psr |= SR_FLAG_N;		\
+	else psr &= ~SR_FLAG_N;		\
+}
+
+template<class bus, uchar mode> __forceinline uint16 core_address(uchar* opcodes, uchar lx, uchar ly) {
+	//effective address, mode is a constant so only its case is compiled, pointers in zeropage wrap within the page
+	switch (mode) {
+	case MODE_ZP: return opcodes[1];
+	case MODE_ZPX: return (opcodes[1] + lx) & 0xFF;
+	case MODE_ZPY: return (opcodes[1] + ly) & 0xFF;
+	case MODE_ABS: return ((uint16)opcodes[2] * 256) + opcodes[1];
+	case MODE_ABX: return (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
+	case MODE_ABY: return (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+	case MODE_IZX: return core_read_word<bus>((opcodes[1] + (uint16)lx) & 0xFF);
+	case MODE_IZY: return core_read_word<bus>(opcodes[1]) + (uint16)ly;
+	}
+	return 0;
+}
+
+template<class bus, uchar mode> __forceinline uchar core_load(uchar* opcodes, uint16 address) {
+	if (mode == MODE_IMM) return opcodes[1];
+	return bus::read(address);
+}
+
+template<class variant, class bus> CORE_COLD void core_step_cold(uchar* opcodes) {
+	//undocumented opcodes, kept out of the hot interpreter
 	uchar opcode = opcodes[0];
 	register uchar operand = 0;
 	register uint16 address = 0;
@@ -369,1767 +657,1127 @@ void core_decode(uchar* opcodes) {
 	register uchar ly = _y;
 	register uchar psr = _sr;
 	switch (opcode) {
-	case 0x00:		//BRK
-#if USE_ASM
-		__asm {
-			orr psr, psr, SR_FLAG_B
-			sub operand, lsp, 1
-			//sub lsp, lsp, 1
-			add ptr, _stack, operand
-			strh address, [ptr]
-			//sub lsp, lsp, 1
-			sub operand, operand, 1
-			ldrb psr, [_stack, operand]
-			sub operand, operand, 1
-			mov lsp, operand
-		}
-#else
-		psr |= SR_FLAG_B;			//set break flag
-		_stack[lsp--] = (lpc + 2) >> 8;			//PCH
-		_stack[lsp--] = (lpc + 2);				//PCL
-		_stack[lsp--] = psr;					//SR
-#endif
-		CPU_DEBUG("BRK");
-		//should jump to break interrupt vector (to do)
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x40:			//RTI		return from interrupt pull sr pull pc
-#if USE_ASM
-		__asm {
-			//load sr from stack, clear break flag
-			add lsp, lsp, 1
-			ldrb psr, [_stack, lsp]
-			and psr, psr, ~SR_FLAG_B
-			//load address from stack	
-			add lsp, lsp, 1
-			add ptr, _stack, lsp
-			ldrh address, [ptr]
-			add lsp, lsp, 1
-			//set pc to loaded address
-			mov lpc, address
-
-		}
-#else
-		psr = _stack[++lsp];
-		psr &= ~SR_FLAG_B;			//clear break flag
-		opcode = _stack[++lsp];
-		address = _stack[++lsp];
-		lpc = (((uint16)address << 8) | opcode);
-#endif
-		CPU_DEBUG("RTI");
+	case 0x1A:			//illegal nop
+	case 0x3A:
+	case 0x5A:
+	case 0x7A:
+	case 0xDA:
+	case 0xFA:
+		lpc += 1;
+		CPU_DEBUG("NOP");
 		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
 		//break;
-	case 0x20:			//JSR
-#if USE_ASM
-		__asm {
-			//calculate address = pc+2
-			mov address, lpc
-			add address, address, 2
-			//store calculated address to stack
-			sub lsp, lsp, 1
-			add ptr, _stack, lsp
-			strh address, [ptr]
-			sub lsp, lsp, 1
-			//load new address = [opcodes + 1]
-			add ptr, opcodes, 1
-			ldrh lpc, [ptr]
-		}
-#else
-		_stack[lsp--] = (lpc + 2) >> 8;			//PCH
-		_stack[lsp--] = (lpc + 2);				//PCL
-		lpc = ((uint16)opcodes[2] * 256) + opcodes[1];		//absolute addressing mode
-#endif
-		CPU_DEBUG("JSR");
+	case 0x04:			//illegal nop
+	case 0x44:
+	case 0x64:
+	case 0x14:
+	case 0x34:
+	case 0x54:
+	case 0x74:
+	case 0xd4:
+	case 0xf4:
+	case 0x80:
+	case 0x82:
+	case 0x89:
+		lpc += 2;
+		CPU_DEBUG("NOP");
 		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
 		//break;
-	case 0x60:			//RTS			return from subroutine
-#if USE_ASM
-		__asm {
-			//load address from stack	
-			add lsp, lsp, 1
-			add ptr, _stack, lsp
-			ldrh address, [ptr]
-			add lsp, lsp, 1
-			//set pc to loaded address
-			add lpc, address, 1
-		}
-#else
-		opcode = _stack[++lsp];
-		address = _stack[++lsp];
-		lpc = (((uint16)address << 8) | opcode) + 1;
-#endif
-		CPU_DEBUG("RTS");
+	case 0x0c:			//illegal nop
+	case 0x1c:
+	case 0x3c:
+	case 0x5c:
+	case 0x7c:
+	case 0xdc:
+	case 0xfc:
+		lpc += 3;
+		CPU_DEBUG("NOP");
 		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
 		//break;
-	case 0x01:			//ORA Or with accumulator//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_orl(lacc, core_get_mem(core_get_word(address)));
-		lpc += 2;
-		CPU_DEBUG("ORA");
-		break;
-	case 0x05://zeropage  (+2)
-		lacc = core_orl(lacc, core_get_mem(opcodes[1]));
-		lpc += 2;
-		CPU_DEBUG("ORA");
-		break;
-	case 0x09://immdt  (+2)
-		lacc = core_orl(lacc, opcodes[1]);
-		lpc += 2;
-		break;
-	case 0x0d://absolute (+3)
-		lacc = core_orl(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]));
-		lpc += 3;
-		CPU_DEBUG("ORA");
-		break;
-	case 0x11://(indirect), Y  (+2)
-		lacc = core_orl(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly));
-		lpc += 2;
-		CPU_DEBUG("ORA");
-		break;
-	case 0x15://zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		lacc = core_orl(lacc, core_get_mem(address));
+	case 0xAB:			//LAX #immdt
+		lacc = core_lda(lacc, opcodes[1]);
+		lx = lacc;
 		lpc += 2;
-		CPU_DEBUG("ORA");
+		CPU_DEBUG("LAX");
 		break;
-	case 0x19://absolute, Y (+3)
-		lacc = core_orl(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly));
-		lpc += 3;
-		CPU_DEBUG("ORA");
+	case 0xA7:			//LAX
+	case 0xB7:
+	case 0xAF:
+	case 0xBF:
+	case 0xA3:
+	case 0xB3:
+		switch (opcode & 0x1c) {
+		case 0x00:		//(indirect, X)  (+2)
+			address = (opcodes[1] + (uint16)lx) & 0xFF;
+			lacc = core_lda(lacc, bus::read(core_read_word<bus>(address)));
+			lpc += 2;
+			break;
+		case 0x04:		//zeropage  (+2)
+			lacc = core_lda(lacc, bus::read(opcodes[1]));
+			lpc += 2;
+			break;
+		case 0x0c:		//absolute (+3)
+			lacc = core_lda(lacc, bus::read(((uint16)opcodes[2] * 256) + opcodes[1]));
+			lpc += 3;
+			break;
+		case 0x10:		//(indirect), Y  (+2)
+			lacc = core_lda(lacc, bus::read((core_read_word<bus>(opcodes[1])) + (uint16)ly));
+			lpc += 2;
+			break;
+		case 0x14:		//zeropage, Y  (+2)
+			lacc = core_lda(lacc, bus::read((opcodes[1] + ly) & 0xff));
+			lpc += 2;
+			break;
+		case 0x1c:		//absolute, Y (+3)
+			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+			lacc = core_lda(lacc, bus::read(address));
+			lpc += 3;
+			break;
+		}
+		lx = lacc;
+		CPU_DEBUG("LAX");
 		break;
-	case 0x1d://absolute, X (+3)
-		lacc = core_orl(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx));
+	case 0x83:			//SAX
+	case 0x87:
+	case 0x8F:
+	case 0x97:
+		operand = lacc & lx;
+		switch (opcode & 0x1c) {
+		case 0x00:		//(indirect, X)  (+2)
+			address = (opcodes[1] + (uint16)lx) & 0xFF;
+			bus::write(core_read_word<bus>(address), operand);
+			lpc += 2;
+			break;
+		case 0x04:		//zeropage  (+2)
+			bus::write(opcodes[1], operand);
+			lpc += 2;
+			break;
+		case 0x0c:		//absolute (+3)
+			bus::write(((uint16)opcodes[2] * 256) + opcodes[1], operand);
+			lpc += 3;
+			break;
+		case 0x14:		//zeropage, Y  (+2)
+			bus::write((opcodes[1] + ly) & 0xFF, operand);
+			lpc += 2;
+			break;
+		}
+		CPU_DEBUG("SAX");
+		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
+		//break;
+	case 0xDB:			//DCP
+		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+		operand = bus::read(address);
+		bus::write(address, operand - 1);
 		lpc += 3;
-		CPU_DEBUG("ORA");
-		break;
-	case 0x0a:				//ASL arithmetic shift left
-		//lacc = core_asl(lacc, 1);
-		ptr = (uint16)lacc << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		lacc = ptr;
-		lpc += 1;
-		CPU_DEBUG("ASL");
-		break;
-	case 0x06:					//ASL arithmetic shift left//zeropage  (+2)
-		//operand = core_asl(core_get_mem(opcodes[1]), 1);
-		address = opcodes[1];
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		lpc += 2;
-		CPU_DEBUG("ASL");
-		break;
-	case 0x0e://absolute (+3)
-		//operand = core_asl(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
-		lpc += 3;
-		CPU_DEBUG("ASL");
-		break;
-	case 0x16:	//zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		//operand = core_asl(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 2;
-		CPU_DEBUG("ASL");
-		break;
-	case 0x1e://absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		//operand = core_asl(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 3;
-		CPU_DEBUG("ASL");
-		break;
-	case 0x08:			//PHP			push status register
-		_stack[lsp--] = psr;
-		lpc += 1;
-		CPU_DEBUG("PHP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x28:			//PLP			pull status register		10
-		psr = _stack[++lsp];
-		psr &= ~SR_FLAG_B;
-		lpc += 1;
-		CPU_DEBUG("PLP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x48:			//PHA			push accumulator
-		_stack[lsp--] = lacc;
-		lpc += 1;
-		CPU_DEBUG("PHA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x68:			//PLA			pull accumulator
-		lacc = _stack[++lsp];
-		lpc += 1;
-		CPU_DEBUG("PLA");
-		break;
-	case 0x18:			//CLC
-		psr &= ~SR_FLAG_C;
-		lpc += 1;
-		CPU_DEBUG("CLC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x58:			//CLI
-		psr &= ~SR_FLAG_I;
-		lpc += 1;
-		CPU_DEBUG("CLI");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xB8:			//CLV
-		psr &= ~SR_FLAG_V;
-		lpc += 1;
-		CPU_DEBUG("CLV");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xD8:			//CLD
-		psr &= ~SR_FLAG_D;
-		lpc += 1;
-		CPU_DEBUG("CLD");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x24:			//BIT//zeropage
-		operand = core_get_mem(opcodes[1]);
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		if (operand & 0x40) psr |= SR_FLAG_V;
-		else psr &= ~SR_FLAG_V;
-		if (core_and(lacc, operand) == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		lpc += 2;
-		CPU_DEBUG("BIT");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x2c://absolute
-		operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		if (operand & 0x40) psr |= SR_FLAG_V;
-		else psr &= ~SR_FLAG_V;
-		if (core_and(lacc, operand) == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		lpc += 3;
-		CPU_DEBUG("BIT");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0x21:			//AND//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_and(lacc, core_get_mem(core_get_word(address)));
-		lpc += 2;
-		CPU_DEBUG("AND");
-		break;
-	case 0x25:	//zeropage  (+2)
-		lacc = core_and(lacc, core_get_mem(opcodes[1]));
-		lpc += 2;
-		CPU_DEBUG("AND");
-		break;
-	case 0x29:	//immdt  (+2)
-		lacc = core_and(lacc, opcodes[1]);
-		lpc += 2;
-		CPU_DEBUG("AND");
-		break;
-	case 0x2d:	//absolute (+3)
-		lacc = core_and(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]));
-		lpc += 3;
-		CPU_DEBUG("AND");
-		break;
-	case 0x31:	//(indirect), Y  (+2)
-		lacc = core_and(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly));
-		lpc += 2;
-		CPU_DEBUG("AND");
-		break;
-	case 0x35:	//zeropage, X  (+2)
-		lacc = core_and(lacc, core_get_mem((opcodes[1] + lx) & 0xFF));
-		lpc += 2;
-		CPU_DEBUG("AND");
-		break;
-	case 0x39:	//absolute, Y (+3)
-		lacc = core_and(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly));
-		lpc += 3;
-		CPU_DEBUG("AND");
-		break;
-	case 0x3d:	//absolute, X (+3)
-		lacc = core_and(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx));
-		lpc += 3;
-		CPU_DEBUG("AND");
-		break;
-
-	case 0x2a:			//ROL accumulator
-		//lacc = core_rol(lacc, 1);
-		ptr = (uint16)lacc << 1;
-		ptr |= (psr & SR_FLAG_C);
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		lacc = ptr;
-		lpc += 1;
-		CPU_DEBUG("ROL");
-		break;
-	case 0x26:			//ROL	//zeropage  (+2)
-		address = opcodes[1];
-		//operand = core_rol(core_get_mem(opcodes[1]), 1);
-		operand = core_get_mem(opcodes[1]);
-		ptr = (uint16)operand << 1;
-		ptr |= (psr & SR_FLAG_C);
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(opcodes[1], operand);
-		lpc += 2;
-		CPU_DEBUG("ROL");
-		break;
-	case 0x2e://absolute (+3)
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		//operand = core_rol(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		ptr |= (psr & SR_FLAG_C);
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 3;
-		CPU_DEBUG("ROL");
-		break;
-	case 0x36://zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		//operand = core_rol(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		ptr |= (psr & SR_FLAG_C);
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 2;
-		CPU_DEBUG("ROL");
-		break;
-	case 0x3e:	//absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		//operand = core_rol(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		ptr = (uint16)operand << 1;
-		ptr |= (psr & SR_FLAG_C);
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 3;
-		CPU_DEBUG("ROL");
-		break;
-
-	case 0x4c:			//JMP	//absolute
-		lpc = ((uint16)opcodes[2] * 256) + opcodes[1];
-		CPU_DEBUG("JMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x6c://indirect
-		if (opcodes[1] != 0xFF) {
-			lpc = core_get_word(((uint16)opcodes[2] * 256) + opcodes[1]);
-		}
-		else {
-			operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-			address = core_get_mem(((uint16)opcodes[2] * 256));
-			address = (address << 8) | operand;
-			lpc = address;
-		}
-		CPU_DEBUG("JMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0x41:			//EOR//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_xor(lacc, core_get_mem(core_get_word(address)));
-		lpc += 2;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x45:	//zeropage  (+2)
-		lacc = core_xor(lacc, core_get_mem(opcodes[1]));
-		lpc += 2;
-		break;
-	case 0x49:	//immdt  (+2)
-		lacc = core_xor(lacc, opcodes[1]);
-		lpc += 2;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x4d:	//absolute (+3)
-		lacc = core_xor(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]));
-		lpc += 3;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x51:	//(indirect), Y  (+2)
-		lacc = core_xor(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly));
-		lpc += 2;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x55:	//zeropage, X  (+2)
-		lacc = core_xor(lacc, core_get_mem((opcodes[1] + lx) & 0xFF));
-		lpc += 2;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x59:	//absolute, Y (+3)
-		lacc = core_xor(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly));
-		lpc += 3;
-		CPU_DEBUG("EOR");
-		break;
-	case 0x5d:	//absolute, X (+3)
-		lacc = core_xor(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx));
-		lpc += 3;
-		CPU_DEBUG("EOR");
-		break;
-
-	case 0x4a:			//LSR accumulator
-		//lacc = core_lsr(lacc, 1);
-		if (lacc & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		lacc = (uint16)lacc >> 1;
-		lpc += 1;
-		CPU_DEBUG("LSR");
-		break;
-	case 0x46:			//LSR//zeropage  (+2)
-		//operand = core_lsr(core_get_mem(opcodes[1]), 1);
-		address = opcodes[1];
-		operand = core_get_mem(address);
-		if (operand & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		operand = (uint16)operand >> 1;
-		core_set_mem(address, operand);
-		//core_set_mem(opcodes[1], operand);
-		lpc += 2;
-		CPU_DEBUG("LSR");
-		break;
-	case 0x4e://absolute (+3)
-		//operand = core_lsr(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		operand = core_get_mem(address);
-		if (operand & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		operand = (uint16)operand >> 1;
-		core_set_mem(address, operand);
-		//core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
-		lpc += 3;
-		CPU_DEBUG("LSR");
-		break;
-	case 0x56://zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		//operand = core_lsr(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		if (operand & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		operand = (uint16)operand >> 1;
-		core_set_mem(address, operand);
-		//core_set_mem(address, operand);
-		lpc += 2;
-		CPU_DEBUG("LSR");
-		break;
-	case 0x5e://absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		//operand = core_lsr(core_get_mem(address), 1);
-		operand = core_get_mem(address);
-		if (operand & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		operand = (uint16)operand >> 1;
-		core_set_mem(address, operand);
-		//core_set_mem(address, operand);
-		lpc += 3;
-		CPU_DEBUG("LSR");
-		break;
-
-	case 0x61:			//ADC		22//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_add(lacc, core_get_mem(core_get_word(address)), &psr);
-		lpc += 2;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x65:	//zeropage  (+2)
-		lacc = core_add(lacc, core_get_mem(opcodes[1]), &psr);
-		lpc += 2;
-		break;
-	case 0x69:	//immdt  (+2)
-		lacc = core_add(lacc, opcodes[1], &psr);
-		lpc += 2;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x6d:	//absolute (+3)
-		lacc = core_add(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), &psr);
-		lpc += 3;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x71:	//(indirect), Y  (+2)
-		lacc = core_add(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly), &psr);
-		lpc += 2;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x75:	//zeropage, X  (+2)
-		lacc = core_add(lacc, core_get_mem((opcodes[1] + lx) & 0xFF), &psr);
-		lpc += 2;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x79:	//absolute, Y (+3)
-		lacc = core_add(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly), &psr);
-		lpc += 3;
-		CPU_DEBUG("ADC");
-		break;
-	case 0x7d:	//absolute, X (+3)
-		lacc = core_add(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx), &psr);
-		lpc += 3;
-		CPU_DEBUG("ADC");
-		break;
-
-	case 0x6a:			//ROR accumulator
-		//lacc = core_ror(lacc, 1);
-		//csr = (psr & SR_FLAG_C);
-		ptr = lacc;
-		if ((psr & SR_FLAG_C)) ptr |= 0x100;
-		if (ptr & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		lacc = (uint16)ptr >> 1;
-		lpc += 1;
-		CPU_DEBUG("ROR");
-		break;
-	case 0x66:			//ROR//zeropage  (+2)
-		address = opcodes[1];
-		ptr = core_get_mem(address);
-		//operand = core_ror(core_get_mem(opcodes[1]), 1);
-		if ((psr & SR_FLAG_C)) ptr |= 0x100;
-		if (ptr & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		ptr = (uint16)ptr >> 1;
-		core_set_mem(address, ptr);
-		lpc += 2;
-		CPU_DEBUG("ROR");
-		break;
-	case 0x6e://absolute (+3)
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		ptr = core_get_mem(address);
-		//operand = core_ror(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-		if ((psr & SR_FLAG_C)) ptr |= 0x100;
-		if (ptr & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		ptr = (uint16)ptr >> 1;
-		core_set_mem(address, ptr);
-		lpc += 3;
-		CPU_DEBUG("ROR");
-		break;
-	case 0x76://zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		ptr = core_get_mem(address);
-		//operand = core_ror(core_get_mem(address), 1);
-		if ((psr & SR_FLAG_C)) ptr |= 0x100;
-		if (ptr & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		ptr = (uint16)ptr >> 1;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 2;
-		CPU_DEBUG("ROR");
-		break;
-	case 0x7e://absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		ptr = core_get_mem(address);
-		//operand = core_ror(core_get_mem(address), 1);
-		if ((psr & SR_FLAG_C)) ptr |= 0x100;
-		if (ptr & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		ptr = (uint16)ptr >> 1;
-		core_set_mem(address, ptr);
-		//core_set_mem(address, operand);
-		lpc += 3;
-		CPU_DEBUG("ROR");
-		break;
-
-	case 0x81:			//STA//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		core_set_mem(core_get_word(address), lacc);
-		lpc += 2;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x85://zeropage  (+2)
-		core_set_mem(opcodes[1], lacc);
-		lpc += 2;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x8d://absolute (+3)
-		core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], lacc);
-		lpc += 3;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x91://(indirect), Y  (+2)
-		core_set_mem((core_get_word(opcodes[1])) + (uint16)ly, lacc);
-		lpc += 2;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x95://zeropage, X  (+2)
-		core_set_mem((opcodes[1] + lx) & 0xFF, lacc);
-		lpc += 2;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x99:	//absolute, Y (+3)
-		core_set_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly, lacc);
-		lpc += 3;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x9d:	//absolute, X (+3)
-		core_set_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx, lacc);
-		lpc += 3;
-		CPU_DEBUG("STA");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0x84:			//STY	//zeropage  (+2)
-		core_set_mem(opcodes[1], ly);
-		lpc += 2;
-		CPU_DEBUG("STY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x8c://absolute (+3)
-		core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], ly);
-		lpc += 3;
-		CPU_DEBUG("STY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x94:	//zeropage, X  (+2)
-		core_set_mem((opcodes[1] + lx) & 0xFF, ly);
-		lpc += 2;
-		CPU_DEBUG("STY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0x86:			//STX//zeropage  (+2)
-		core_set_mem(opcodes[1], lx);
-		lpc += 2;
-		CPU_DEBUG("STX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x8e://absolute (+3)
-		core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], lx);
-		lpc += 3;
-		CPU_DEBUG("STX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0x96://zeropage, Y  (+2)
-		core_set_mem((opcodes[1] + ly) & 0xFF, lx);
-		lpc += 2;
-		CPU_DEBUG("STX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xA0:			//LDY
-		ly = opcodes[1];
-		lpc += 2;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xA4:			//LDY	//zeropage  (+2)
-		ly = core_get_mem(opcodes[1]);
-		lpc += 2;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xAc://absolute (+3)
-		ly = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-		lpc += 3;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xB4://zeropage, X  (+2)
-		ly = core_get_mem((opcodes[1] + lx) & 0xFF);
-		lpc += 2;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xBc://absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		ly = core_get_mem(address);
-		lpc += 3;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xA1:			//LDA//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_lda(lacc, core_get_mem(core_get_word(address)));
-		lpc += 2;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xA5:	//zeropage  (+2)
-		address = opcodes[1];
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 2;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xA9:	//immdt  (+2)
-		lacc = core_lda(lacc, opcodes[1]);
-		lpc += 2;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xAd://absolute (+3)
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 3;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xB1:	//(indirect), Y  (+2)
-		address = (core_get_word(opcodes[1])) + (uint16)ly;
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 2;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xB5:	//zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 2;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xB9:		//absolute, Y (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 3;
-		CPU_DEBUG("LDA");
-		break;
-	case 0xBd:	//absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		lacc = core_lda(lacc, core_get_mem(address));
-		lpc += 3;
-		CPU_DEBUG("LDA");
-		break;
-
-	case 0xA2:			//LDX
-		lx = opcodes[1];
-		lpc += 2;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xA6:	//zeropage  (+2)
-		lx = core_get_mem(opcodes[1]);
-		lpc += 2;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xAe:	//absolute (+3)
-		lx = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-		lpc += 3;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xB6:	//zeropage, Y  (+2)
-		lx = core_get_mem((opcodes[1] + ly) & 0xFF);
-		lpc += 2;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xBe:	//absolute, Y (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		lx = core_get_mem(address);
-		lpc += 3;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("LDX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xA8:			//TAY		accumulator to y
-		ly = lacc;
-		lpc += 1;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("TAY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xAA:			//TAX		accumulator to x
-		lx = lacc;
-		lpc += 1;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("TAX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xBA:			//TSX		sp to x
-		lx = lsp;
-		lpc += 1;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("TSX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x8A:			//TXA		x to accumulator
-		lacc = lx;
-		lpc += 1;
-		CPU_DEBUG("TXA");
-		break;
-	case 0x98:			//TYA		y to accumulator
-		lacc = ly;
-		lpc += 1;
-		CPU_DEBUG("TYA");
-		break;
-	case 0x9A:			//TXS		x to stack pointer
-		lsp = lx;
-		lpc += 1;
-		CPU_DEBUG("TXS");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xC0:			//CPY	//immediate  (+2)
-		core_cmp(ly, opcodes[1], psr);
-		lpc += 2;
-		CPU_DEBUG("CPY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xC4://zeropage  (+2)
-		core_cmp(ly, core_get_mem(opcodes[1]), psr);
-		lpc += 2;
-		CPU_DEBUG("CPY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xCc://absolute (+3)
-		core_cmp(ly, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), psr);
-		lpc += 3;
-		CPU_DEBUG("CPY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xC1:			//CMP//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		core_cmp(lacc, core_get_mem(core_get_word(address)), psr);
-		lpc += 2;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xC5://zeropage  (+2)
-		core_cmp(lacc, core_get_mem(opcodes[1]), psr);
-		lpc += 2;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xC9:	//immdt  (+2)
-		core_cmp(lacc, opcodes[1], psr);
-		lpc += 2;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xCd:	//absolute (+3)
-		core_cmp(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), psr);
-		lpc += 3;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xd1:	//(indirect), Y  (+2)
-		core_cmp(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly), psr);
-		lpc += 2;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xd5:	//zeropage, X  (+2)
-		core_cmp(lacc, core_get_mem((opcodes[1] + lx) & 0xFF), psr);
-		lpc += 2;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xd9:	//absolute, Y (+3)
-		core_cmp(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly), psr);
-		lpc += 3;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xdd:	//absolute, X (+3)
-		core_cmp(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx), psr);
-		lpc += 3;
-		CPU_DEBUG("CMP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xC6:			//DEC//zeropage  (+2)
-		operand = core_get_mem(opcodes[1]);
-		operand--;
-		core_set_mem(opcodes[1], operand);
-		lpc += 2;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xCE:	//absolute (+3)
-		operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-		operand--;
-		core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
-		lpc += 3;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xD6:		//zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		operand = core_get_mem(address);
-		operand--;
-		core_set_mem(address, operand);
-		lpc += 2;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xDE:	//absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		operand = core_get_mem(address);
-		operand--;
-		core_set_mem(address, operand);
-		lpc += 3;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xC8:			//INY		increment y
-		ly++;
-		lpc += 1;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xCA:			//DEX		decrement x
-		lx--;
-		lpc += 1;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x88:			//DEY			30
-		ly--;
-		lpc += 1;
-		if (ly == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (ly & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("DEY");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xe8:			//INX
-		lx++;
-		lpc += 1;
-		if (lx == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (lx & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xE0:			//CPX			50//immediate  (+2)
-		core_cmp(lx, opcodes[1], psr);
-		lpc += 2;
-		CPU_DEBUG("CPX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xE4:		//zeropage  (+2)
-		core_cmp(lx, core_get_mem(opcodes[1]), psr);
-		lpc += 2;
-		CPU_DEBUG("CPX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xEC:	//absolute (+3)
-		core_cmp(lx, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), psr);
-		lpc += 3;
-		CPU_DEBUG("CPX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xE1:			//SBC	//(indirect, X)  (+2)
-		address = (opcodes[1] + (uint16)lx) & 0xFF;
-		lacc = core_sub(lacc, core_get_mem(core_get_word(address)), &psr);
-		lpc += 2;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xE5://zeropage  (+2)
-		lacc = core_sub(lacc, core_get_mem(opcodes[1]), &psr);
-		lpc += 2;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xE9:	//immdt  (+2)
-		lacc = core_sub(lacc, opcodes[1], &psr);
-		lpc += 2;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xED:	//absolute (+3)
-		lacc = core_sub(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), &psr);
-		lpc += 3;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xF1:	//(indirect), Y  (+2)
-		lacc = core_sub(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly), &psr);
-		lpc += 2;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xF5:		//zeropage, X  (+2)
-		lacc = core_sub(lacc, core_get_mem((opcodes[1] + lx) & 0xFF), &psr);
-		lpc += 2;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xF9:		//absolute, Y (+3)
-		lacc = core_sub(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + ly), &psr);
-		lpc += 3;
-		CPU_DEBUG("SBC");
-		break;
-	case 0xFD:	//absolute, X (+3)
-		lacc = core_sub(lacc, core_get_mem((((uint16)opcodes[2] * 256) + opcodes[1]) + lx), &psr);
-		lpc += 3;
-		CPU_DEBUG("SBC");
-		break;
-
-	case 0xe6:			//INC//zeropage  (+2)
-		operand = core_get_mem(opcodes[1]);
-		operand++;
-		core_set_mem(opcodes[1], operand);
-		lpc += 2;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xeE:	//absolute (+3)
-		operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-		operand++;
-		core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
-		lpc += 3;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xf6:	//zeropage, X  (+2)
-		address = (opcodes[1] + lx) & 0xFF;
-		operand = core_get_mem(address);
-		operand++;
-		core_set_mem(address, operand);
-		lpc += 2;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-	case 0xfE:	//absolute, X (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-		operand = core_get_mem(address);
-		operand++;
-		core_set_mem(address, operand);
-		lpc += 3;
-		if (operand == 0) psr |= SR_FLAG_Z;
-		else psr &= ~SR_FLAG_Z;
-		if (operand & 0x80) psr |= SR_FLAG_N;
-		else psr &= ~SR_FLAG_N;
-		CPU_DEBUG("INC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-
-	case 0xea:			//NOP
-		lpc += 1;
-		CPU_DEBUG("NOP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xF0:			//BEQ  branch on equal
-		if ((psr & SR_FLAG_Z)) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BEQ");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xD0:			//BNE  branch on not equal
-		if ((psr & SR_FLAG_Z) == 0) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BNE");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xB0:			//BCS	branch on carry set	40
-		if ((psr & SR_FLAG_C)) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BCS");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x90:			//BCC  branch on carry clear
-		if ((psr & SR_FLAG_C) == 0) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BCC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x70:			//BVS   branch on overflow set
-		if ((psr & SR_FLAG_V)) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BVS");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x50:			//BVC  branch on overflow clear
-		if ((psr & SR_FLAG_V) == 0) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BVC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x30:			//BMI   branch on minus
-		if ((psr & SR_FLAG_N)) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BMI");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x10:			//BPL branch on plus
-		if ((psr & SR_FLAG_N) == 0) lpc += (int8)opcodes[1];
-		lpc += 2;
-		CPU_DEBUG("BPL");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xF8:			//SED
-		psr |= SR_FLAG_D;
-		lpc += 1;
-		CPU_DEBUG("SED");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x78:			//SEI
-		psr |= SR_FLAG_I;
-		lpc += 1;
-		CPU_DEBUG("SEI");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0x38:			//SEC
-		psr |= SR_FLAG_C;
-		lpc += 1;
-		CPU_DEBUG("SEC");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
+		core_cmp(lacc, operand - 1, psr);
 
-		//ILLEGAL INSTRUCTION CODES
-	case 0x1A:			//illegal nop
-	case 0x3A:
-	case 0x5A:
-	case 0x7A:
-	case 0xDA:
-	case 0xFA:
-		lpc += 1;
-		CPU_DEBUG("NOP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
+		CPU_DEBUG("DCP");
+		goto skip_flag_test;
 		//break;
-	case 0x04:			//illegal nop
-	case 0x44:
-	case 0x64:
-	case 0x14:
-	case 0x34:
-	case 0x54:
-	case 0x74:
-	case 0xd4:
-	case 0xf4:
-	case 0x80:
-	case 0x82:
-	case 0x89:
-		lpc += 2;
-		CPU_DEBUG("NOP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
+	case 0xC7:			//DCP
+	case 0xD7:
+	case 0xCF:
+	case 0xDF:
+	case 0xC3:
+	case 0xD3:
+		switch (opcode & 0x1C) {
+		case 0x00:		//(indirect, X)  (+2)
+			address = (opcodes[1] + (uint16)lx) & 0xFF;
+			operand = bus::read(core_read_word<bus>(address));
+			bus::write(core_read_word<bus>(address), operand - 1);
+			lpc += 2;
+			break;
+		case 0x10:		//(indirect), Y  (+2)
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			operand = bus::read(address);
+			bus::write(address, operand - 1);
+			lpc += 2;
+			break;
+		case 0x04:		//zeropage  (+2)
+			operand = bus::read(opcodes[1]);
+			bus::write(opcodes[1], operand - 1);
+			lpc += 2;
+			break;
+		case 0x0c:		//absolute (+3)
+			operand = bus::read(((uint16)opcodes[2] * 256) + opcodes[1]);
+			bus::write(((uint16)opcodes[2] * 256) + opcodes[1], operand - 1);
+			lpc += 3;
+			break;
+		case 0x14:		//zeropage, X  (+2)
+			address = (opcodes[1] + lx) & 0xFF;
+			operand = bus::read(address);
+			bus::write(address, operand - 1);
+			lpc += 2;
+			break;
+		case 0x1c:		//absolute, X (+3)
+			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
+			operand = bus::read(address);
+			bus::write(address, operand - 1);
+			lpc += 3;
+			break;
+		}
+		core_cmp(lacc, operand - 1, psr);
+		CPU_DEBUG("DCP");
+		goto skip_flag_test;
 		//break;
-	case 0x0c:			//illegal nop
-	case 0x1c:
-	case 0x3c:
-	case 0x5c:
-	case 0x7c:
-	case 0xdc:
-	case 0xfc:
+	case 0x3B:				//RLA  absolute, Y (+3)
+		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+		operand = bus::read(address);
+		//operand = core_rol(bus::read(address), 1);
+		ptr = (uint16)operand << 1;
+		ptr |= (psr & SR_FLAG_C);
+		if (ptr & 0x100) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		bus::write(address, ptr);
 		lpc += 3;
-		CPU_DEBUG("NOP");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xAB:			//LAX #immdt
-		lacc = core_lda(lacc, opcodes[1]);
-		lx = lacc;
-		lpc += 2;
-		CPU_DEBUG("LAX");
+		lacc = core_and(lacc, (uchar)ptr);
+		CPU_DEBUG("RLA");
 		break;
-	case 0xA7:			//LAX
-	case 0xB7:
-	case 0xAF:
-	case 0xBF:
-	case 0xA3:
-	case 0xB3:
+	case 0x27:				//RLA
+	case 0x37:
+	case 0x2F:
+	case 0x3F:
+	case 0x23:
+	case 0x33:
 		switch (opcode & 0x1c) {
 		case 0x00:		//(indirect, X)  (+2)
 			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			lacc = core_lda(lacc, core_get_mem(core_get_word(address)));
+			address = core_read_word<bus>(address);
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(core_read_word<bus>(address)), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(add, operand);
+			lpc += 2;
+			break;
+		case 0x10:		//(indirect), Y  (+2)
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(address), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(address, operand);
 			lpc += 2;
 			break;
 		case 0x04:		//zeropage  (+2)
-			lacc = core_lda(lacc, core_get_mem(opcodes[1]));
+			address = opcodes[1];
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(opcodes[1]), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(opcodes[1], operand);
 			lpc += 2;
 			break;
 		case 0x0c:		//absolute (+3)
-			lacc = core_lda(lacc, core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]));
+			address = ((uint16)opcodes[2] * 256) + opcodes[1];
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(address, operand);
+			lpc += 3;
+			break;
+		case 0x14:		//zeropage, X  (+2)
+			address = (opcodes[1] + lx) & 0xFF;
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(address), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(address, operand);
+			lpc += 2;
+			break;
+		case 0x1c:		//absolute, X (+3)
+			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
+			operand = bus::read(address);
+			//operand = core_rol(bus::read(address), 1);
+			ptr = (uint16)operand << 1;
+			ptr |= (psr & SR_FLAG_C);
+			if (ptr & 0x100) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			bus::write(address, ptr);
+			//bus::write(address, operand);
 			lpc += 3;
 			break;
+		}
+		lacc = core_and(lacc, operand);
+		CPU_DEBUG("RLA");
+		break;
+	case 0x7B:				//RRA  absolute, Y (+3)
+		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+		//operand = core_ror(bus::read(address), 1);
+		ptr = bus::read(address);
+		if ((psr & SR_FLAG_C)) ptr |= 0x100;
+		if (ptr & 0x01) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		operand = (uint16)ptr >> 1;
+
+		bus::write(address, operand);
+		lpc += 3;
+		lacc = core_add<variant>(lacc, operand, &psr);
+		CPU_DEBUG("RRA");
+		break;
+	case 0x67:				//RRA
+	case 0x77:
+	case 0x6F:
+	case 0x7F:
+	case 0x63:
+	case 0x73:
+		switch (opcode & 0x1c) {
+		case 0x00:		//(indirect, X)  (+2)
+			address = (opcodes[1] + (uint16)lx) & 0xFF;
+			address = core_read_word<bus>(address);
+			//operand = core_ror(bus::read(core_read_word<bus>(address)), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+
+			bus::write(core_read_word<bus>(address), operand);
+			lpc += 2;
+			break;
 		case 0x10:		//(indirect), Y  (+2)
-			lacc = core_lda(lacc, core_get_mem((core_get_word(opcodes[1])) + (uint16)ly));
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			//operand = core_ror(bus::read(address), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+			bus::write(address, operand);
 			lpc += 2;
 			break;
-		case 0x14:		//zeropage, Y  (+2)
-			lacc = core_lda(lacc, core_get_mem((opcodes[1] + ly) & 0xff));
+		case 0x04:		//zeropage  (+2)
+			address = opcodes[1];
+			//operand = core_ror(bus::read(opcodes[1]), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+			bus::write(address, operand);
 			lpc += 2;
 			break;
-		case 0x1c:		//absolute, Y (+3)
-			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-			lacc = core_lda(lacc, core_get_mem(address));
+		case 0x0c:		//absolute (+3)
+			address = ((uint16)opcodes[2] * 256) + opcodes[1];
+			//operand = core_ror(bus::read(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+			bus::write(address, operand);
+			lpc += 3;
+			break;
+		case 0x14:		//zeropage, X  (+2)
+			address = (opcodes[1] + lx) & 0xFF;
+			//operand = core_ror(bus::read(address), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+			bus::write(address, operand);
+			lpc += 2;
+			break;
+		case 0x1c:		//absolute, X (+3)
+			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
+			//operand = core_ror(bus::read(address), 1);
+			ptr = bus::read(address);
+			if ((psr & SR_FLAG_C)) ptr |= 0x100;
+			if (ptr & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)ptr >> 1;
+			bus::write(address, operand);
 			lpc += 3;
 			break;
 		}
-		lx = lacc;
-		CPU_DEBUG("LAX");
+		lacc = core_add<variant>(lacc, operand, &psr);
+		CPU_DEBUG("RRA");
 		break;
-	case 0x83:			//SAX
-	case 0x87:
-	case 0x8F:
-	case 0x97:
-		operand = lacc & lx;
+	case 0x5B:				//SRE  absolute, Y (+3)
+		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
+		operand = bus::read(address);
+		//operand = core_lsr(bus::read(address), 1);
+		if (operand & 0x01) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		operand = (uint16)operand >> 1;
+		//bus::write(address, operand);
+		lpc += 3;
+		lacc = core_xor(lacc, operand);
+
+		CPU_DEBUG("SRE");
+		break;
+	case 0x47:				//SRE
+	case 0x57:
+	case 0x4F:
+	case 0x5F:
+	case 0x43:
+	case 0x53:
 		switch (opcode & 0x1c) {
 		case 0x00:		//(indirect, X)  (+2)
 			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			core_set_mem(core_get_word(address), operand);
+			address = core_read_word<bus>(address);
+			operand = bus::read(address);
+			//operand = core_lsr(bus::read(core_read_word<bus>(address)), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
+			lpc += 2;
+			break;
+		case 0x10:		//(indirect), Y  (+2)
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			operand = bus::read(address);
+			//operand = core_lsr(bus::read(address), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
 			lpc += 2;
 			break;
 		case 0x04:		//zeropage  (+2)
-			core_set_mem(opcodes[1], operand);
+			address = opcodes[1];
+			operand = bus::read(address);
+			//operand = core_lsr(bus::read(opcodes[1]), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
 			lpc += 2;
 			break;
 		case 0x0c:		//absolute (+3)
-			core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
+			address = ((uint16)opcodes[2] * 256) + opcodes[1];
+			operand = bus::read(((uint16)opcodes[2] * 256) + opcodes[1]);
+			//operand = core_lsr(bus::read(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
 			lpc += 3;
 			break;
-		case 0x14:		//zeropage, Y  (+2)
-			core_set_mem((opcodes[1] + ly) & 0xFF, operand);
+		case 0x14:		//zeropage, X  (+2)
+			address = (opcodes[1] + lx) & 0xFF;
+			operand = bus::read(address);
+			//operand = core_lsr(bus::read(address), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
 			lpc += 2;
 			break;
+		case 0x1c:		//absolute, X (+3)
+			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
+			operand = bus::read(address);
+			//operand = core_lsr(bus::read(address), 1);
+			if (operand & 0x01) psr |= SR_FLAG_C;
+			else psr &= ~SR_FLAG_C;
+			operand = (uint16)operand >> 1;
+			bus::write(address, operand);
+			lpc += 3;
+			break;
 		}
-		CPU_DEBUG("SAX");
-		goto skip_flag_test;			//skip checking for accumulator value (zero flag, negative flag)
-		//break;
-	case 0xDB:			//DCP
+		lacc = core_xor(lacc, operand);
+		CPU_DEBUG("SRE");
+		break;
+	case 0x9B:			//TAS
+		address = ((uint16)opcodes[2] * 256) + opcodes[1];
+		lsp = lacc & lx;
+		operand = core_read_word<bus>(address) >> 8;
+		bus::write(address, operand & lacc & lx);
+		lpc += 3;
+		CPU_DEBUG("TAS");
+		break;
+	case 0xEB:				//USBC  (SBC+NOP)
+		lacc = core_sub<variant>(lacc, opcodes[1], &psr);
+		lpc += 2;
+		CPU_DEBUG("USBC");
+		break;
+	case 0xFB:			//ISB
 		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		operand = core_get_mem(address);
-		core_set_mem(address, operand - 1);
+		operand = bus::read(address);
+		bus::write(address, operand + 1);
 		lpc += 3;
-		core_cmp(lacc, operand - 1, psr);
-
-		CPU_DEBUG("DCP");
+		lacc = core_sub<variant>(lacc, operand + 1, &psr);
+		CPU_DEBUG("ISB");
 		goto skip_flag_test;
 		//break;
-	case 0xC7:			//DCP
-	case 0xD7:
-	case 0xCF:
-	case 0xDF:
-	case 0xC3:
-	case 0xD3:
+	case 0xE7:			//ISB
+	case 0xF7:
+	case 0xEF:
+	case 0xFF:
+	case 0xE3:
+	case 0xF3:
 		switch (opcode & 0x1C) {
 		case 0x00:		//(indirect, X)  (+2)
 			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			operand = core_get_mem(core_get_word(address));
-			core_set_mem(core_get_word(address), operand - 1);
+			operand = bus::read(core_read_word<bus>(address));
+			bus::write(core_read_word<bus>(address), operand + 1);
 			lpc += 2;
 			break;
 		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand - 1);
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			operand = bus::read(address);
+			bus::write(address, operand + 1);
 			lpc += 2;
 			break;
 		case 0x04:		//zeropage  (+2)
-			operand = core_get_mem(opcodes[1]);
-			core_set_mem(opcodes[1], operand - 1);
+			operand = bus::read(opcodes[1]);
+			bus::write(opcodes[1], operand + 1);
 			lpc += 2;
 			break;
 		case 0x0c:		//absolute (+3)
-			operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-			core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand - 1);
+			operand = bus::read(((uint16)opcodes[2] * 256) + opcodes[1]);
+			bus::write(((uint16)opcodes[2] * 256) + opcodes[1], operand + 1);
 			lpc += 3;
 			break;
 		case 0x14:		//zeropage, X  (+2)
 			address = (opcodes[1] + lx) & 0xFF;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand - 1);
+			operand = bus::read(address);
+			bus::write(address, operand + 1);
 			lpc += 2;
 			break;
 		case 0x1c:		//absolute, X (+3)
 			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand - 1);
+			operand = bus::read(address);
+			bus::write(address, operand + 1);
 			lpc += 3;
 			break;
 		}
-		core_cmp(lacc, operand - 1, psr);
-		CPU_DEBUG("DCP");
+		lacc = core_sub<variant>(lacc, operand + 1, &psr);
+		CPU_DEBUG("ISB");
 		goto skip_flag_test;
 		//break;
-	case 0x3B:				//RLA  absolute, Y (+3)
+	case 0x1B:				//SLO  absolute, Y (+3)
 		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		operand = core_get_mem(address);
-		//operand = core_rol(core_get_mem(address), 1);
+		operand = bus::read(address);
+		//operand = core_asl(bus::read(address), 1);
 		ptr = (uint16)operand << 1;
-		ptr |= (psr & SR_FLAG_C);
 		if (ptr & 0x100) psr |= SR_FLAG_C;
 		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
+		bus::write(address, ptr);
 		lpc += 3;
-		lacc = core_and(lacc, (uchar)ptr);
-		CPU_DEBUG("RLA");
+		lacc = core_orl(lacc, operand);
+		CPU_DEBUG("SLO");
 		break;
-	case 0x27:				//RLA
-	case 0x37:
-	case 0x2F:
-	case 0x3F:
-	case 0x23:
-	case 0x33:
+	case 0x07:				//SLO
+	case 0x17:
+	case 0x0F:
+	case 0x1F:
+	case 0x03:
+	case 0x13:
 		switch (opcode & 0x1c) {
 		case 0x00:		//(indirect, X)  (+2)
 			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			address = core_get_word(address);
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(core_get_word(address)), 1);
+			address = core_read_word<bus>(address);
+			//operand = core_asl(bus::read(core_read_word<bus>(address)), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(add, operand);
+			bus::write(address, ptr);
+			//bus::write(core_read_word<bus>(address), operand);
 			lpc += 2;
 			break;
 		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(address), 1);
+			address = (core_read_word<bus>(opcodes[1])) + (uint16)ly;
+			//operand = core_asl(bus::read(address), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			bus::write(address, ptr);
+			//bus::write(address, operand);
 			lpc += 2;
 			break;
 		case 0x04:		//zeropage  (+2)
 			address = opcodes[1];
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(opcodes[1]), 1);
+			//operand = core_asl(bus::read(opcodes[1]), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(opcodes[1], operand);
+			bus::write(address, ptr);
+			//bus::write(opcodes[1], operand);
 			lpc += 2;
 			break;
 		case 0x0c:		//absolute (+3)
 			address = ((uint16)opcodes[2] * 256) + opcodes[1];
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
+			//operand = core_asl(bus::read(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			bus::write(address, ptr);
+			//bus::write(((uint16)opcodes[2] * 256) + opcodes[1], operand);
 			lpc += 3;
 			break;
 		case 0x14:		//zeropage, X  (+2)
 			address = (opcodes[1] + lx) & 0xFF;
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(address), 1);
+			//operand = core_asl(bus::read(address), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			bus::write(address, ptr);
+			//bus::write(address, operand);
 			lpc += 2;
 			break;
 		case 0x1c:		//absolute, X (+3)
 			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			operand = core_get_mem(address);
-			//operand = core_rol(core_get_mem(address), 1);
+			//operand = core_asl(bus::read(address), 1);
+			operand = bus::read(address);
 			ptr = (uint16)operand << 1;
-			ptr |= (psr & SR_FLAG_C);
 			if (ptr & 0x100) psr |= SR_FLAG_C;
 			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			bus::write(address, ptr);
+			//bus::write(address, operand);
 			lpc += 3;
 			break;
 		}
-		lacc = core_and(lacc, operand);
-		CPU_DEBUG("RLA");
+		lacc = core_orl(lacc, operand);
+		CPU_DEBUG("SLO");
 		break;
-	case 0x7B:				//RRA  absolute, Y (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		//operand = core_ror(core_get_mem(address), 1);
-		ptr = core_get_mem(address);
+	}
+	//check accumulator
+	if (lacc == 0) psr |= SR_FLAG_Z;
+	else psr &= ~SR_FLAG_Z;
+	if (lacc & 0x80) psr |= SR_FLAG_N;
+	else psr &= ~SR_FLAG_N;
+skip_flag_test:
+	psr |= 0x20;							//ignore bit always one
+
+	_sr = psr;
+	_x = lx;
+	_y = ly;
+	_acc = lacc;
+	_pc = lpc;
+	_sp = lsp;
+}
+
+template<class variant, class bus, uchar op, uchar mode> __forceinline uchar core_op(uchar opcode, uchar* opcodes, uint16& lpc, uchar& lsp, uchar& lacc, uchar& lx, uchar& ly, uchar& psr) {
+	//one documented opcode, op and mode come from _opcode_table so each instance compiles to a single case
+	//returns 1 when the accumulator sets N and Z, 0 when the flags are done, 2 when the cold path already wrote the registers
+	register uchar operand = 0;
+	register uint32 ptr;
+	uchar* stack = bus::stack();
+	register uint16 address = core_address<bus, mode>(opcodes, lx, ly);
+	lpc += _mode_size[mode];
+	switch (op) {
+	case OP_COLD:
+		//registers not written back yet, the cold path starts from the same state
+		core_step_cold<variant, bus>(opcodes);
+		return 2;
+	case OP_ORA:
+		lacc = core_orl(lacc, core_load<bus, mode>(opcodes, address));
+		CPU_DEBUG("ORA");
+		return 1;
+	case OP_AND:
+		lacc = core_and(lacc, core_load<bus, mode>(opcodes, address));
+		CPU_DEBUG("AND");
+		return 1;
+	case OP_EOR:
+		lacc = core_xor(lacc, core_load<bus, mode>(opcodes, address));
+		CPU_DEBUG("EOR");
+		return 1;
+	case OP_ADC:
+		lacc = core_add<variant>(lacc, core_load<bus, mode>(opcodes, address), &psr);
+		CPU_DEBUG("ADC");
+		return 1;
+	case OP_SBC:
+		lacc = core_sub<variant>(lacc, core_load<bus, mode>(opcodes, address), &psr);
+		CPU_DEBUG("SBC");
+		return 1;
+	case OP_LDA:
+		lacc = core_lda(lacc, core_load<bus, mode>(opcodes, address));
+		CPU_DEBUG("LDA");
+		return 1;
+	case OP_STA:
+		bus::write(address, lacc);
+		CPU_DEBUG("STA");
+		return 0;			//skip checking for accumulator value (zero flag, negative flag)
+	case OP_STX:
+		bus::write(address, lx);
+		CPU_DEBUG("STX");
+		return 0;
+	case OP_STY:
+		bus::write(address, ly);
+		CPU_DEBUG("STY");
+		return 0;
+	case OP_CMP:
+		operand = core_load<bus, mode>(opcodes, address);
+		core_cmp(lacc, operand, psr);
+		CPU_DEBUG("CMP");
+		return 0;
+	case OP_CPX:
+		operand = core_load<bus, mode>(opcodes, address);
+		core_cmp(lx, operand, psr);
+		CPU_DEBUG("CPX");
+		return 0;
+	case OP_CPY:
+		operand = core_load<bus, mode>(opcodes, address);
+		core_cmp(ly, operand, psr);
+		CPU_DEBUG("CPY");
+		return 0;
+	case OP_LDX:
+		lx = core_load<bus, mode>(opcodes, address);
+		core_flag_nz(lx, psr);
+		CPU_DEBUG("LDX");
+		return 0;
+	case OP_LDY:
+		ly = core_load<bus, mode>(opcodes, address);
+		core_flag_nz(ly, psr);
+		CPU_DEBUG("LDY");
+		return 0;
+	case OP_BIT:
+		operand = bus::read(address);
+		if (operand & 0x80) psr |= SR_FLAG_N;
+		else psr &= ~SR_FLAG_N;
+		if (operand & 0x40) psr |= SR_FLAG_V;
+		else psr &= ~SR_FLAG_V;
+		if (core_and(lacc, operand) == 0) psr |= SR_FLAG_Z;
+		else psr &= ~SR_FLAG_Z;
+		CPU_DEBUG("BIT");
+		return 0;
+
+	//shifts, memory forms still test the accumulator afterwards
+	case OP_ASL:
+		operand = (mode == MODE_IMP) ? lacc : bus::read(address);
+		ptr = (uint16)operand << 1;
+		if (ptr & 0x100) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		if (mode == MODE_IMP) lacc = ptr;
+		else bus::write(address, ptr);
+		CPU_DEBUG("ASL");
+		return 1;
+	case OP_ROL:
+		operand = (mode == MODE_IMP) ? lacc : bus::read(address);
+		ptr = (uint16)operand << 1;
+		ptr |= (psr & SR_FLAG_C);
+		if (ptr & 0x100) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		if (mode == MODE_IMP) lacc = ptr;
+		else bus::write(address, ptr);
+		CPU_DEBUG("ROL");
+		return 1;
+	case OP_LSR:
+		operand = (mode == MODE_IMP) ? lacc : bus::read(address);
+		if (operand & 0x01) psr |= SR_FLAG_C;
+		else psr &= ~SR_FLAG_C;
+		operand = (uint16)operand >> 1;
+		if (mode == MODE_IMP) lacc = operand;
+		else bus::write(address, operand);
+		CPU_DEBUG("LSR");
+		return 1;
+	case OP_ROR:
+		ptr = (mode == MODE_IMP) ? lacc : bus::read(address);
 		if ((psr & SR_FLAG_C)) ptr |= 0x100;
 		if (ptr & 0x01) psr |= SR_FLAG_C;
 		else psr &= ~SR_FLAG_C;
-		operand = (uint16)ptr >> 1;
+		ptr = (uint16)ptr >> 1;
+		if (mode == MODE_IMP) lacc = ptr;
+		else bus::write(address, ptr);
+		CPU_DEBUG("ROR");
+		return 1;
+	case OP_INC:
+		operand = bus::read(address);
+		operand++;
+		bus::write(address, operand);
+		core_flag_nz(operand, psr);
+		CPU_DEBUG("INC");
+		return 0;
+	case OP_DEC:
+		operand = bus::read(address);
+		operand--;
+		bus::write(address, operand);
+		core_flag_nz(operand, psr);
+		CPU_DEBUG("DEC");
+		return 0;
 
-		core_set_mem(address, operand);
-		lpc += 3;
-		lacc = core_add(lacc, operand, &psr);
-		CPU_DEBUG("RRA");
-		break;
-	case 0x67:				//RRA
-	case 0x77:
-	case 0x6F:
-	case 0x7F:
-	case 0x63:
-	case 0x73:
-		switch (opcode & 0x1c) {
-		case 0x00:		//(indirect, X)  (+2)
-			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			address = core_get_word(address);
-			//operand = core_ror(core_get_mem(core_get_word(address)), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
+	//control flow, lpc already points past the instruction
+	case OP_JMP:
+		lpc = address;
+		CPU_DEBUG("JMP");
+		return 0;
+	case OP_JMI:
+		lpc = core_read_word<bus>(address);		//no page carry for the pointer's high byte
+		CPU_DEBUG("JMP");
+		return 0;
+	case OP_JSR:
+#if USE_ASM
+		__asm {
+			//calculate address = pc+2
+			mov address, lpc
+			sub address, address, 1
+			//store calculated address to stack
+			sub lsp, lsp, 1
+			add ptr, _stack, lsp
+			strh address, [ptr]
+			sub lsp, lsp, 1
+			//load new address = [opcodes + 1]
+			add ptr, opcodes, 1
+			ldrh lpc, [ptr]
+		}
+#else
+		stack[lsp--] = (lpc - 1) >> 8;			//PCH
+		stack[lsp--] = (lpc - 1);				//PCL
+		bus::pushed(lsp, 2);
+		lpc = address;
+#endif
+		CPU_DEBUG("JSR");
+		return 0;
+	case OP_RTS:			//return from subroutine
+#if USE_ASM
+		__asm {
+			//load address from stack	
+			add lsp, lsp, 1
+			add ptr, _stack, lsp
+			ldrh address, [ptr]
+			add lsp, lsp, 1
+			//set pc to loaded address
+			add lpc, address, 1
+		}
+#else
+		opcode = stack[++lsp];
+		address = stack[++lsp];
+		lpc = (((uint16)address << 8) | opcode) + 1;
+#endif
+		CPU_DEBUG("RTS");
+		return 0;
+	case OP_RTI:			//return from interrupt pull sr pull pc
+#if USE_ASM
+		__asm {
+			//load sr from stack, clear break flag
+			add lsp, lsp, 1
+			ldrb psr, [_stack, lsp]
+			and psr, psr, ~SR_FLAG_B
+			//load address from stack	
+			add lsp, lsp, 1
+			add ptr, _stack, lsp
+			ldrh address, [ptr]
+			add lsp, lsp, 1
+			//set pc to loaded address
+			mov lpc, address
 
-			core_set_mem(core_get_word(address), operand);
-			lpc += 2;
-			break;
-		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			//operand = core_ror(core_get_mem(address), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x04:		//zeropage  (+2)
-			address = opcodes[1];
-			//operand = core_ror(core_get_mem(opcodes[1]), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x0c:		//absolute (+3)
-			address = ((uint16)opcodes[2] * 256) + opcodes[1];
-			//operand = core_ror(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
-			core_set_mem(address, operand);
-			lpc += 3;
-			break;
-		case 0x14:		//zeropage, X  (+2)
-			address = (opcodes[1] + lx) & 0xFF;
-			//operand = core_ror(core_get_mem(address), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x1c:		//absolute, X (+3)
-			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			//operand = core_ror(core_get_mem(address), 1);
-			ptr = core_get_mem(address);
-			if ((psr & SR_FLAG_C)) ptr |= 0x100;
-			if (ptr & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)ptr >> 1;
-			core_set_mem(address, operand);
-			lpc += 3;
-			break;
 		}
-		lacc = core_add(lacc, operand, &psr);
-		CPU_DEBUG("RRA");
-		break;
-	case 0x5B:				//SRE  absolute, Y (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		operand = core_get_mem(address);
-		//operand = core_lsr(core_get_mem(address), 1);
-		if (operand & 0x01) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		operand = (uint16)operand >> 1;
-		//core_set_mem(address, operand);
-		lpc += 3;
-		lacc = core_xor(lacc, operand);
+#else
+		psr = stack[++lsp];
+		psr &= ~SR_FLAG_B;			//clear break flag
+		opcode = stack[++lsp];
+		address = stack[++lsp];
+		lpc = (((uint16)address << 8) | opcode);
+#endif
+		CPU_DEBUG("RTI");
+		return 0;
+	case OP_BRK:
+#if USE_ASM
+		__asm {
+			orr psr, psr, SR_FLAG_B
+			sub operand, lsp, 1
+			//sub lsp, lsp, 1
+			add ptr, _stack, operand
+			strh address, [ptr]
+			//sub lsp, lsp, 1
+			sub operand, operand, 1
+			ldrb psr, [_stack, operand]
+			sub operand, operand, 1
+			mov lsp, operand
+		}
+#else
+		stack[lsp--] = lpc >> 8;			//PCH
+		stack[lsp--] = lpc;				//PCL
+		stack[lsp--] = psr | SR_FLAG_B | SR_FLAG_U;			//SR, break and unused bits only on the pushed copy
+		bus::pushed(lsp, 3);
+		psr |= SR_FLAG_I;
+		if (variant::cmos) psr &= ~SR_FLAG_D;
+		lpc = core_read_word<bus>(0xFFFE);		//irq/brk vector
+#endif
+		CPU_DEBUG("BRK");
+		return 0;
+	case OP_BRANCH:
+		//bits 7-6 select N V C Z, bit 5 the value to branch on
+		switch (opcode >> 6) {
+		case 0: operand = psr & SR_FLAG_N; break;
+		case 1: operand = psr & SR_FLAG_V; break;
+		case 2: operand = psr & SR_FLAG_C; break;
+		default: operand = psr & SR_FLAG_Z; break;
+		}
+		if ((operand != 0) == ((opcode & 0x20) != 0)) lpc += (int8)opcodes[1];
+		CPU_DEBUG("BRANCH");
+		return 0;
+	case OP_FLAG:
+		switch (opcode) {
+		case 0x18: psr &= ~SR_FLAG_C; break;			//CLC
+		case 0x38: psr |= SR_FLAG_C; break;				//SEC
+		case 0x58: psr &= ~SR_FLAG_I; break;			//CLI
+		case 0x78: psr |= SR_FLAG_I; break;				//SEI
+		case 0xB8: psr &= ~SR_FLAG_V; break;			//CLV
+		case 0xD8: psr &= ~SR_FLAG_D; break;			//CLD
+		case 0xF8: psr |= SR_FLAG_D; break;				//SED
+		}
+		return 0;
+
+	//stack and register transfers
+	case OP_PHP:
+		stack[lsp--] = psr | SR_FLAG_B | SR_FLAG_U;
+		bus::pushed(lsp, 1);
+		CPU_DEBUG("PHP");
+		return 0;
+	case OP_PLP:
+		psr = stack[++lsp];
+		psr &= ~SR_FLAG_B;
+		CPU_DEBUG("PLP");
+		return 0;
+	case OP_PHA:
+		stack[lsp--] = lacc;
+		bus::pushed(lsp, 1);
+		CPU_DEBUG("PHA");
+		return 0;
+	case OP_PLA:
+		lacc = stack[++lsp];
+		CPU_DEBUG("PLA");
+		return 1;
+	case OP_TXA:
+		lacc = lx;
+		return 1;
+	case OP_TYA:
+		lacc = ly;
+		return 1;
+	case OP_TXS:
+		lsp = lx;
+		return 0;
+	case OP_TAX:
+		lx = lacc;
+		core_flag_nz(lx, psr);
+		return 0;
+	case OP_TSX:
+		lx = lsp;
+		core_flag_nz(lx, psr);
+		return 0;
+	case OP_INX:
+		lx++;
+		core_flag_nz(lx, psr);
+		return 0;
+	case OP_DEX:
+		lx--;
+		core_flag_nz(lx, psr);
+		return 0;
+	case OP_TAY:
+		ly = lacc;
+		core_flag_nz(ly, psr);
+		return 0;
+	case OP_INY:
+		ly++;
+		core_flag_nz(ly, psr);
+		return 0;
+	case OP_DEY:
+		ly--;
+		core_flag_nz(ly, psr);
+		return 0;
+	case OP_NOP:
+		return 0;
+	}
+	return 1;
+}
 
-		CPU_DEBUG("SRE");
-		break;
-	case 0x47:				//SRE
-	case 0x57:
-	case 0x4F:
-	case 0x5F:
-	case 0x43:
-	case 0x53:
-		switch (opcode & 0x1c) {
-		case 0x00:		//(indirect, X)  (+2)
-			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			address = core_get_word(address);
-			operand = core_get_mem(address);
-			//operand = core_lsr(core_get_mem(core_get_word(address)), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			operand = core_get_mem(address);
-			//operand = core_lsr(core_get_mem(address), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x04:		//zeropage  (+2)
-			address = opcodes[1];
-			operand = core_get_mem(address);
-			//operand = core_lsr(core_get_mem(opcodes[1]), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x0c:		//absolute (+3)
-			address = ((uint16)opcodes[2] * 256) + opcodes[1];
-			operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-			//operand = core_lsr(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
-			lpc += 3;
-			break;
-		case 0x14:		//zeropage, X  (+2)
-			address = (opcodes[1] + lx) & 0xFF;
-			operand = core_get_mem(address);
-			//operand = core_lsr(core_get_mem(address), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
+#define CORE_OP(code)		case code: test = core_op<variant, bus, _opcode_table[code].op, _opcode_table[code].mode>(code, opcodes, lpc, lsp, lacc, lx, ly, psr); break;
+#define CORE_ROW(row)		CORE_OP(row##0) CORE_OP(row##1) CORE_OP(row##2) CORE_OP(row##3) CORE_OP(row##4) CORE_OP(row##5) CORE_OP(row##6) CORE_OP(row##7) \
+							CORE_OP(row##8) CORE_OP(row##9) CORE_OP(row##A) CORE_OP(row##B) CORE_OP(row##C) CORE_OP(row##D) CORE_OP(row##E) CORE_OP(row##F)
+
+template<class variant, class bus> void core_step(uchar* opcodes) {
+	uchar opcode = opcodes[0];
+	register uchar operand = 0;
+	register uint16 address = 0;
+	register uint16 lpc = _pc;
+	register uchar lsp = _sp;
+	register uchar lacc = _acc;
+	register uchar lx = _x;
+	register uchar ly = _y;
+	register uchar psr = _sr;
+	uchar* stack = bus::stack();
+	uchar test;
+	if (variant::cmos) {
+		//65c02 opcodes, replace the nmos undocumented set
+		switch (opcode) {
+		case 0x80:			//BRA
+			lpc += (int8)opcodes[1];
 			lpc += 2;
-			break;
-		case 0x1c:		//absolute, X (+3)
-			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			operand = core_get_mem(address);
-			//operand = core_lsr(core_get_mem(address), 1);
-			if (operand & 0x01) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			operand = (uint16)operand >> 1;
-			core_set_mem(address, operand);
-			lpc += 3;
-			break;
-		}
-		lacc = core_xor(lacc, operand);
-		CPU_DEBUG("SRE");
-		break;
-	case 0x9B:			//TAS
-		address = ((uint16)opcodes[2] * 256) + opcodes[1];
-		lsp = lacc & lx;
-		operand = core_get_word(address) >> 8;
-		core_set_mem(address, operand & lacc & lx);
-		lpc += 3;
-		CPU_DEBUG("TAS");
-		break;
-	case 0xEB:				//USBC  (SBC+NOP)
-		lacc = core_sub(lacc, opcodes[1], &psr);
-		lpc += 2;
-		CPU_DEBUG("USBC");
-		break;
-	case 0xFB:			//ISB
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		operand = core_get_mem(address);
-		core_set_mem(address, operand + 1);
-		lpc += 3;
-		lacc = core_sub(lacc, operand + 1, &psr);
-		CPU_DEBUG("ISB");
-		goto skip_flag_test;
-		//break;
-	case 0xE7:			//ISB
-	case 0xF7:
-	case 0xEF:
-	case 0xFF:
-	case 0xE3:
-	case 0xF3:
-		switch (opcode & 0x1C) {
-		case 0x00:		//(indirect, X)  (+2)
-			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			operand = core_get_mem(core_get_word(address));
-			core_set_mem(core_get_word(address), operand + 1);
+			CPU_DEBUG("BRA");
+			goto skip_flag_test;
+		case 0x12:			//(zeropage)  (+2)
+		case 0x32:
+		case 0x52:
+		case 0x72:
+		case 0x92:
+		case 0xB2:
+		case 0xD2:
+		case 0xF2:
+			address = core_read_word<bus>(opcodes[1]);
 			lpc += 2;
-			break;
-		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand + 1);
+			switch (opcode) {
+			case 0x12: lacc = core_orl(lacc, bus::read(address)); break;
+			case 0x32: lacc = core_and(lacc, bus::read(address)); break;
+			case 0x52: lacc = core_xor(lacc, bus::read(address)); break;
+			case 0x72: lacc = core_add<variant>(lacc, bus::read(address), &psr); break;
+			case 0x92: bus::write(address, lacc); goto skip_flag_test;
+			case 0xB2: lacc = core_lda(lacc, bus::read(address)); break;
+			case 0xD2:
+				operand = bus::read(address);
+				core_cmp(lacc, operand, psr);
+				goto skip_flag_test;
+			case 0xF2: lacc = core_sub<variant>(lacc, bus::read(address), &psr); break;
+			}
+			goto flag_test;
+		case 0x04:			//TSB zeropage
+		case 0x0C:			//TSB absolute
+		case 0x14:			//TRB zeropage
+		case 0x1C:			//TRB absolute
+			address = (opcode & 0x08) ? (((uint16)opcodes[2] * 256) + opcodes[1]) : opcodes[1];
+			operand = bus::read(address);
+			if ((operand & lacc) == 0) psr |= SR_FLAG_Z;
+			else psr &= ~SR_FLAG_Z;
+			bus::write(address, (opcode & 0x10) ? (operand & ~lacc) : (operand | lacc));
+			lpc += (opcode & 0x08) ? 3 : 2;
+			CPU_DEBUG("TSB");
+			goto skip_flag_test;
+		case 0x1A:			//INC accumulator
+			lacc++;
+			lpc += 1;
+			CPU_DEBUG("INC");
+			goto flag_test;
+		case 0x3A:			//DEC accumulator
+			lacc--;
+			lpc += 1;
+			CPU_DEBUG("DEC");
+			goto flag_test;
+		case 0x5A:			//PHY
+			stack[lsp--] = ly;
+			bus::pushed(lsp, 1);
+			lpc += 1;
+			CPU_DEBUG("PHY");
+			goto skip_flag_test;
+		case 0xDA:			//PHX
+			stack[lsp--] = lx;
+			bus::pushed(lsp, 1);
+			lpc += 1;
+			CPU_DEBUG("PHX");
+			goto skip_flag_test;
+		case 0x7A:			//PLY
+		case 0xFA:			//PLX
+			operand = stack[++lsp];
+			if (opcode == 0x7A) ly = operand;
+			else lx = operand;
+			if (operand == 0) psr |= SR_FLAG_Z;
+			else psr &= ~SR_FLAG_Z;
+			if (operand & 0x80) psr |= SR_FLAG_N;
+			else psr &= ~SR_FLAG_N;
+			lpc += 1;
+			CPU_DEBUG("PLX");
+			goto skip_flag_test;
+		case 0x64:			//STZ zeropage  (+2)
+			bus::write(opcodes[1], 0);
 			lpc += 2;
-			break;
-		case 0x04:		//zeropage  (+2)
-			operand = core_get_mem(opcodes[1]);
-			core_set_mem(opcodes[1], operand + 1);
+			goto skip_flag_test;
+		case 0x74:			//STZ zeropage, X  (+2)
+			bus::write((opcodes[1] + lx) & 0xFF, 0);
 			lpc += 2;
-			break;
-		case 0x0c:		//absolute (+3)
-			operand = core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]);
-			core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand + 1);
+			goto skip_flag_test;
+		case 0x9C:			//STZ absolute (+3)
+			bus::write(((uint16)opcodes[2] * 256) + opcodes[1], 0);
 			lpc += 3;
-			break;
-		case 0x14:		//zeropage, X  (+2)
-			address = (opcodes[1] + lx) & 0xFF;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand + 1);
-			lpc += 2;
-			break;
-		case 0x1c:		//absolute, X (+3)
-			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			operand = core_get_mem(address);
-			core_set_mem(address, operand + 1);
+			goto skip_flag_test;
+		case 0x9E:			//STZ absolute, X (+3)
+			bus::write((((uint16)opcodes[2] * 256) + opcodes[1]) + lx, 0);
 			lpc += 3;
-			break;
-		}
-		lacc = core_sub(lacc, operand + 1, &psr);
-		CPU_DEBUG("ISB");
-		goto skip_flag_test;
-		//break;
-	case 0x1B:				//SLO  absolute, Y (+3)
-		address = (((uint16)opcodes[2] * 256) + opcodes[1]) + ly;
-		operand = core_get_mem(address);
-		//operand = core_asl(core_get_mem(address), 1);
-		ptr = (uint16)operand << 1;
-		if (ptr & 0x100) psr |= SR_FLAG_C;
-		else psr &= ~SR_FLAG_C;
-		core_set_mem(address, ptr);
-		lpc += 3;
-		lacc = core_orl(lacc, operand);
-		CPU_DEBUG("SLO");
-		break;
-	case 0x07:				//SLO
-	case 0x17:
-	case 0x0F:
-	case 0x1F:
-	case 0x03:
-	case 0x13:
-		switch (opcode & 0x1c) {
-		case 0x00:		//(indirect, X)  (+2)
-			address = (opcodes[1] + (uint16)lx) & 0xFF;
-			address = core_get_word(address);
-			//operand = core_asl(core_get_mem(core_get_word(address)), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(core_get_word(address), operand);
-			lpc += 2;
-			break;
-		case 0x10:		//(indirect), Y  (+2)
-			address = (core_get_word(opcodes[1])) + (uint16)ly;
-			//operand = core_asl(core_get_mem(address), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
-			lpc += 2;
-			break;
-		case 0x04:		//zeropage  (+2)
-			address = opcodes[1];
-			//operand = core_asl(core_get_mem(opcodes[1]), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(opcodes[1], operand);
+			goto skip_flag_test;
+		case 0x89:			//BIT immediate, only Z affected
+			if (core_and(lacc, opcodes[1]) == 0) psr |= SR_FLAG_Z;
+			else psr &= ~SR_FLAG_Z;
 			lpc += 2;
-			break;
-		case 0x0c:		//absolute (+3)
+			goto skip_flag_test;
+		case 0x34:			//BIT zeropage, X  (+2)
+		case 0x3C:			//BIT absolute, X (+3)
+			if (opcode == 0x34) operand = bus::read((opcodes[1] + lx) & 0xFF);
+			else operand = bus::read((((uint16)opcodes[2] * 256) + opcodes[1]) + lx);
+			if (operand & 0x80) psr |= SR_FLAG_N;
+			else psr &= ~SR_FLAG_N;
+			if (operand & 0x40) psr |= SR_FLAG_V;
+			else psr &= ~SR_FLAG_V;
+			if (core_and(lacc, operand) == 0) psr |= SR_FLAG_Z;
+			else psr &= ~SR_FLAG_Z;
+			lpc += (opcode == 0x34) ? 2 : 3;
+			CPU_DEBUG("BIT");
+			goto skip_flag_test;
+		case 0x6C:			//JMP indirect, page wrap fixed
+		case 0x7C:			//JMP (absolute, X)
 			address = ((uint16)opcodes[2] * 256) + opcodes[1];
-			//operand = core_asl(core_get_mem(((uint16)opcodes[2] * 256) + opcodes[1]), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(((uint16)opcodes[2] * 256) + opcodes[1], operand);
-			lpc += 3;
-			break;
-		case 0x14:		//zeropage, X  (+2)
-			address = (opcodes[1] + lx) & 0xFF;
-			//operand = core_asl(core_get_mem(address), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			if (opcode == 0x7C) address += lx;
+			lpc = bus::read(address) | ((uint16)bus::read(address + 1) << 8);
+			CPU_DEBUG("JMP");
+			goto skip_flag_test;
+		case 0x02:			//reserved, 2 byte nop
+		case 0x22:
+		case 0x42:
+		case 0x62:
+		case 0x82:
+		case 0xC2:
+		case 0xE2:
+		case 0x44:
+		case 0x54:
+		case 0xD4:
+		case 0xF4:
 			lpc += 2;
-			break;
-		case 0x1c:		//absolute, X (+3)
-			address = (((uint16)opcodes[2] * 256) + opcodes[1]) + lx;
-			//operand = core_asl(core_get_mem(address), 1);
-			operand = core_get_mem(address);
-			ptr = (uint16)operand << 1;
-			if (ptr & 0x100) psr |= SR_FLAG_C;
-			else psr &= ~SR_FLAG_C;
-			core_set_mem(address, ptr);
-			//core_set_mem(address, operand);
+			goto skip_flag_test;
+		case 0x5C:			//reserved, 3 byte nop
+		case 0xDC:
+		case 0xFC:
 			lpc += 3;
+			goto skip_flag_test;
+		default:
+			if ((opcode & 0x03) == 0x03) {
+				//reserved, 1 byte nop
+				lpc += 1;
+				goto skip_flag_test;
+			}
 			break;
 		}
-		lacc = core_orl(lacc, operand);
-		CPU_DEBUG("SLO");
-		break;
 	}
+	switch (opcode) {
+		CORE_ROW(0x0)
+		CORE_ROW(0x1)
+		CORE_ROW(0x2)
+		CORE_ROW(0x3)
+		CORE_ROW(0x4)
+		CORE_ROW(0x5)
+		CORE_ROW(0x6)
+		CORE_ROW(0x7)
+		CORE_ROW(0x8)
+		CORE_ROW(0x9)
+		CORE_ROW(0xA)
+		CORE_ROW(0xB)
+		CORE_ROW(0xC)
+		CORE_ROW(0xD)
+		CORE_ROW(0xE)
+		CORE_ROW(0xF)
+	}
+	if (test == 2) return;
+	if (test == 0) goto skip_flag_test;
+flag_test:
 	//check accumulator
 	if (lacc == 0) psr |= SR_FLAG_Z;
 	else psr &= ~SR_FLAG_Z;
@@ -2147,6 +1795,44 @@ skip_flag_test:
 	return;
 }
 
+void core_decode(uchar* opcodes) {
+	core_step<cpu_2a03, bus_nes>(opcodes);
+}
+
+template<class variant> uint16 core_run(uint16 start, uint32 limit, uint32* count) {
+	//run until the program traps in a jump or branch to itself
+	uchar fetch[3];
+	uint16 last;
+	uint32 n = 0;
+	_pc = start;
+	do {
+		last = _pc;
+		if (_pc > 0xFFFD) {
+			//instruction wraps around the address space
+			fetch[0] = _flat[_pc];
+			fetch[1] = _flat[(uint16)(_pc + 1)];
+			fetch[2] = _flat[(uint16)(_pc + 2)];
+			core_step<variant, bus_flat>(fetch);
+		}
+		else {
+			core_step<variant, bus_flat>(_flat + _pc);
+		}
+		n++;
+	} while (_pc != last && n != limit);
+	if (count != NULL) count[0] = n;
+	return _pc;
+}
+
+uint16 core_run_flat(uchar* memory, uint16 start, uchar cmos, uint32 limit, uint32* count) {
+	//bare 6502 on 64KB of ram (functional test images), returns the trap address, limit 0 runs until trapped
+	_flat = memory;
+	_acc = _x = _y = 0;
+	_sp = 0xFF;
+	_sr = 0x24;
+	if (cmos) return core_run<cpu_65c02>(start, limit, count);
+	return core_run<cpu_6502>(start, limit, count);
+}
+
 int ins_counter = 0;
 
 uint8 _mmc_cr = 0;
@@ -2155,6 +1841,250 @@ nes_mmc1 _mmc1_ctx;
 #define SHIFT_REGISTER(x, y, z)		{ if(data & 0x80) { x=0x10; y=0; } else { y++; x = ((x >> 1) | ((data & 0x01) << 4)) & 0x1f; } if (y == 5) { z; y=0; } }
 
 
+void core_map_prg(uint16 address, uchar* rom, int size) {
+#if USE_LOWMEM
+	//a 4KB bank points its whole window, the other half has to follow it in the same buffer
+	for (; size > 0; size -= 0x2000, address += 0x2000, rom += 0x2000) {
+		_prg[(address >> 13) & 0x03] = rom - (address & 0x1FFF);
+	}
+#else
+	memcpy(_sram + address, rom, size);
+	core_dirty_range(_dirty_ram, address, size);
+#endif
+}
+
+void core_dirty_config(uint8 shift) {
+	//page size of all dirty bitmaps, every page starts dirty
+	if (shift < DIRTY_MIN_SHIFT) shift = DIRTY_MIN_SHIFT;
+	if (shift > DIRTY_MAX_SHIFT) shift = DIRTY_MAX_SHIFT;
+	_dirty_shift = shift;
+	core_dirty_range(_dirty_ram, 0, sizeof(_sram));
+#if USE_LOWMEM
+	core_dirty_range(_dirty_wram, 0, sizeof(_wram));
+#endif
+	ppu_dirty_config(shift);
+}
+
+uchar* core_dirty_memory(uint8 region, uint32* size) {
+	//backing memory of a dirty bitmap region, NULL when the region does not exist in this build
+	switch (region) {
+	case DIRTY_RAM:
+		*size = sizeof(_sram);
+		return _sram;
+#if USE_LOWMEM
+	case DIRTY_SRAM:
+		*size = sizeof(_wram);
+		return _wram;
+#endif
+	case DIRTY_VRAM:
+		return ppu_dirty_memory(0, size);
+	case DIRTY_OAM:
+		return ppu_dirty_memory(1, size);
+	}
+	*size = 0;
+	return NULL;
+}
+
+size_t core_get_regs(uchar* buffer) {
+	//cpu, mapper and ppu registers packed for hashing, everything of a state outside the dirty regions
+	uchar* ptr = buffer;
+	memcpy(ptr, &_pc, sizeof(_pc)); ptr += sizeof(_pc);
+	*ptr++ = _acc;
+	*ptr++ = _x;
+	*ptr++ = _y;
+	*ptr++ = _sr;
+	*ptr++ = _sp;
+	*ptr++ = _mmc_cr;
+	memcpy(ptr, &_cycles, sizeof(_cycles)); ptr += sizeof(_cycles);
+	memcpy(ptr, &ins_counter, sizeof(ins_counter)); ptr += sizeof(ins_counter);
+	*ptr++ = _mmc1_ctx.cr;			//bank table is fixed per rom
+	*ptr++ = _mmc1_ctx.ch0;
+	*ptr++ = _mmc1_ctx.ch1;
+	*ptr++ = _mmc1_ctx.prg;
+	*ptr++ = _mmc1_ctx.cr_shift;
+	*ptr++ = _pad_buttons[0];
+	*ptr++ = _pad_buttons[1];
+	*ptr++ = _pad_shift[0];
+	*ptr++ = _pad_shift[1];
+	*ptr++ = _pad_strobe;
+	memcpy(ptr, &_frame, sizeof(_frame)); ptr += sizeof(_frame);
+	core_apu_sync();
+	ptr += apu_get_regs(ptr);
+#if USE_LOWMEM
+	for (int i = 0; i < 4; i++) {
+		uint32 offset = (_prg[i] != NULL) ? (uint32)(_prg[i] - _mmc.rom) : 0xFFFFFFFF;
+		memcpy(ptr, &offset, sizeof(offset)); ptr += sizeof(offset);
+	}
+#endif
+	ptr += ppu_get_regs(ptr);
+	return ptr - buffer;
+}
+
+uint32 core_dirty_get(uint8 region, uint64* bitmap, uchar clear) {
+	//pages of region modified since the last clear, bitmap holds up to 16 words, returns page count
+	uint64* map = NULL;
+	uint32 size = 0;
+	uint32 words;
+	switch (region) {
+	case DIRTY_RAM:
+		map = _dirty_ram;
+		size = sizeof(_sram);
+		break;
+#if USE_LOWMEM
+	case DIRTY_SRAM:
+		map = _dirty_wram;
+		size = sizeof(_wram);
+		break;
+#endif
+	case DIRTY_VRAM:
+		return ppu_dirty_get(0, bitmap, clear);
+	case DIRTY_OAM:
+		return ppu_dirty_get(1, bitmap, clear);
+	}
+	if (map == NULL) return 0;
+	size = (size + (1 << _dirty_shift) - 1) >> _dirty_shift;
+	words = (size + 63) / 64;
+	if (bitmap != NULL) memcpy(bitmap, map, words * sizeof(uint64));
+	if (clear) memset(map, 0, words * sizeof(uint64));
+	return size;
+}
+
+size_t core_get_footprint() {
+	size_t size = sizeof(_sram) + sizeof(_mmc) + sizeof(_mmc1_ctx);
+#if USE_LOWMEM
+	size += sizeof(_wram) + sizeof(_prg) + sizeof(_fetch);
+#endif
+	return size;
+}
+
+#define STATE_MAGIC			0x53454E56		//"VNES"
+#define STATE_VERSION		3
+#if USE_LOWMEM
+#define STATE_BUILD			0x0001		//windowed program rom, separate wram
+#else
+#define STATE_BUILD			0x0000
+#endif
+
+typedef struct core_state {		//save state header and cpu section, ppu and apu sections follow
+	uint32 magic;
+	uint16 version;
+	uint16 build;				//layout flags, states only load into the same build
+	uint32 size;				//total bytes
+	uint32 ppu_offset;
+	uint32 ppu_size;
+	uint32 apu_offset;
+	uint32 apu_size;
+	uint32 cycles;
+	int32 ins_counter;
+	uint16 pc;
+	uint8 acc;
+	uint8 x;
+	uint8 y;
+	uint8 sr;
+	uint8 sp;
+	uint8 mmc_cr;
+	nes_mmc1 mmc1;
+	uint32 frame;
+	uint32 frame_start;
+	uint8 pad_buttons[2];
+	uint8 pad_shift[2];
+	uint8 pad_strobe;
+#if USE_LOWMEM
+	uint32 prg[4];				//rom offset of each program window
+	uint8 wram[sizeof(_wram)];
+#endif
+	uint8 sram[sizeof(_sram)];
+} core_state;
+
+#define STATE_PPU_OFFSET	((sizeof(core_state) + 7) & ~7)
+#define STATE_APU_OFFSET	((STATE_PPU_OFFSET + ppu_state_size() + 7) & ~7)
+
+size_t core_state_size() {
+	return STATE_APU_OFFSET + apu_state_size();
+}
+
+size_t core_save_state(uchar* buffer, size_t size) {
+	//flat image of the running machine, buffer may be written straight to a file
+	core_state* s = (core_state*)buffer;
+	size_t total = core_state_size();
+	if (size < total) return 0;
+	s->magic = STATE_MAGIC;
+	s->version = STATE_VERSION;
+	s->build = STATE_BUILD;
+	s->size = total;
+	s->ppu_offset = STATE_PPU_OFFSET;
+	s->ppu_size = ppu_state_size();
+	s->apu_offset = STATE_APU_OFFSET;
+	s->apu_size = apu_state_size();
+	s->cycles = _cycles;
+	s->ins_counter = ins_counter;
+	s->pc = _pc;
+	s->acc = _acc;
+	s->x = _x;
+	s->y = _y;
+	s->sr = _sr;
+	s->sp = _sp;
+	s->mmc_cr = _mmc_cr;
+	s->mmc1 = _mmc1_ctx;
+	s->frame = _frame;
+	s->frame_start = _frame_start;
+	memcpy(s->pad_buttons, _pad_buttons, sizeof(_pad_buttons));
+	memcpy(s->pad_shift, _pad_shift, sizeof(_pad_shift));
+	s->pad_strobe = _pad_strobe;
+#if USE_LOWMEM
+	for (int i = 0; i < 4; i++) s->prg[i] = (_prg[i] != NULL) ? (uint32)(_prg[i] - _mmc.rom) : 0xFFFFFFFF;
+	memcpy(s->wram, _wram, sizeof(_wram));
+#endif
+	memcpy(s->sram, _sram, sizeof(_sram));
+	ppu_save_state(buffer + STATE_PPU_OFFSET);
+	core_apu_sync();
+	apu_save_state(buffer + STATE_APU_OFFSET);
+	return total;
+}
+
+uchar core_load_state(const uchar* buffer, size_t size) {
+	//restore a state saved by the same build on the currently loaded rom, buffer may be a mapped file
+	const core_state* s = (const core_state*)buffer;
+	if (size < sizeof(core_state)) return 0;
+	if (s->magic != STATE_MAGIC || s->version != STATE_VERSION) return 0;
+	if (s->build != STATE_BUILD) return 0;
+	if (s->size != core_state_size() || size < s->size) return 0;
+	if (s->ppu_offset != STATE_PPU_OFFSET || s->ppu_size != ppu_state_size()) return 0;
+	if (s->apu_offset != STATE_APU_OFFSET || s->apu_size != apu_state_size()) return 0;
+	core_apu_sync();			//sound so far is synthesized before the apu moves to the loaded cycle
+#if USE_LOWMEM
+	for (int i = 0; i < 4; i++) {
+		if (s->prg[i] != 0xFFFFFFFF && s->prg[i] >= (uint32)_mmc.size) return 0;
+	}
+	for (int i = 0; i < 4; i++) _prg[i] = (s->prg[i] != 0xFFFFFFFF) ? _mmc.rom + s->prg[i] : NULL;
+	memcpy(_wram, s->wram, sizeof(_wram));
+#endif
+	memcpy(_sram, s->sram, sizeof(_sram));
+	_cycles = s->cycles;
+	ins_counter = s->ins_counter;
+	_pc = s->pc;
+	_acc = s->acc;
+	_x = s->x;
+	_y = s->y;
+	_sr = s->sr;
+	_sp = s->sp;
+	_mmc_cr = s->mmc_cr;
+	_mmc1_ctx = s->mmc1;			//mapper callbacks stay those of the loaded rom
+	_frame = s->frame;
+	_frame_start = s->frame_start;
+	memcpy(_pad_buttons, s->pad_buttons, sizeof(_pad_buttons));
+	memcpy(_pad_shift, s->pad_shift, sizeof(_pad_shift));
+	_pad_strobe = s->pad_strobe;
+	core_dirty_range(_dirty_ram, 0, sizeof(_sram));
+#if USE_LOWMEM
+	core_dirty_range(_dirty_wram, 0, sizeof(_wram));
+#endif
+	ppu_load_state(buffer + STATE_PPU_OFFSET);
+	apu_load_state(buffer + STATE_APU_OFFSET);
+	core_apu_poll();
+	return 1;
+}
+
 void prg_switch(nes_mmc1* ctx) {
 	int index;
 	uchar* ptr_buf;
@@ -2163,14 +2093,14 @@ void prg_switch(nes_mmc1* ctx) {
 	switch ((ctx->cr >> 2) & 0x03) {
 	case 0:
 	case 1:			//32 bit bank
-		memcpy(_sram + 0x8000, _mmc.rom + index, 0x8000);
+		core_map_prg(0x8000, _mmc.rom + index, 0x8000);
 		break;
 	case 2:
-		memcpy(_sram + 0xC000, _mmc.rom + index, 0x4000);
+		core_map_prg(0xC000, _mmc.rom + index, 0x4000);
 		break;
 	case 3:
 		ptr_buf = _mmc.rom + index;
-		memcpy(_sram + 0x8000, ptr_buf, 0x4000);
+		core_map_prg(0x8000, ptr_buf, 0x4000);
 		break;
 	}
 }
@@ -2215,30 +2145,44 @@ void mmc1_write(void * payload, uint16 address, uint8 data) {
 }
 
 void core_config(uint8 num_banks, uint8 mapper, uchar* rom, int len, uint8 ch_bank, uchar * chrom, int chlen) {
+#if !USE_LOWMEM
 	uint start = 0x8000;
+#endif
 	uint8 i;
 	_mmc.rom = rom;
 	_mmc.size = len;
 	_mmc.chrom = chrom;
 	_mmc.chsize = chlen;
+	_mmc.payload = NULL;
+	_mmc.base = 0x8000;
+	_mmc.write = NULL;
 	switch (mapper) {
 	case 0:						//no mapper
 		switch (num_banks) {			//number of banks for vrom
 		case 1:
+#if !USE_LOWMEM
 			start = 0xc000;
+#endif
 			len = 0x4000;			//16KB
 			break;
 		case 2:
+#if !USE_LOWMEM
 			start = 0x8000;
+#endif
 			len = 0x8000;			//32KB
 			break;
 		}
+#if USE_LOWMEM
+		core_map_prg(0x8000, rom, len);
+		if (len < 0x8000) core_map_prg(0xC000, rom, len);		//mirror 16KB rom
+#else
 		memcpy(_sram + start, rom, len);
+#endif
 		ppu_set_ram(0, chrom, 0x2000);
 		break;
 	case 1:						//MMC1
 		memset(&_mmc1_ctx, 0, sizeof(_mmc1_ctx));
-		memcpy(_sram + 0x8000, rom + (num_banks * 0x4000) - 0x8000, 0x8000);
+		core_map_prg(0x8000, rom + (num_banks * 0x4000) - 0x8000, 0x8000);
 		_mmc1_ctx.bank_table[0] = (num_banks * 0x4000) - 0x8000;
 		_mmc1_ctx.bank_table[1] = (num_banks * 0x4000) - 0x4000;		
 		for (i = 2; i < num_banks; i++) {
@@ -2251,9 +2195,70 @@ void core_config(uint8 num_banks, uint8 mapper, uchar* rom, int len, uint8 ch_ba
 	}
 }
 
+void core_start(uint8 num_banks, uint8 mapper, uchar* rom, int len, uint8 ch_bank, uchar* chrom, int chlen, uint8 config) {
+	//power on with a parsed cartridge, rom and chrom are only read
+	uint16 start;
+	ins_counter = 0;
+	_cycles = 0;
+	_frame = 0;
+	_frame_start = 0;
+	_pad_buttons[0] = _pad_buttons[1] = 0;
+	_pad_shift[0] = _pad_shift[1] = 0;
+	_pad_strobe = 0;
+	apu_reset();
+	_apu_due = 0;
+	_apu_irq = 0;
+	_sr |= SR_FLAG_I;			//reset masks irqs, the frame counter irq is armed at power on
+	core_config(num_banks, mapper, rom, len, ch_bank, chrom, chlen);
+	ppu_init(config);
+	core_dirty_config(_dirty_shift);
+	start = core_get_word(0xFFFC);
+	_pc = start;			//set pc to start of cartridge ROM
+}
+
+void core_set_mapper(uint16 base, void* payload, void (*write)(void* payload, uint16 address, uint8 data)) {
+	//mapper that is not a cartridge board (nsf), call after core_start
+	_mmc.payload = payload;
+	_mmc.base = base;
+	_mmc.write = write;
+}
+
+#define CORE_CALL_RETURN		0x5000			//return address of core_call, never executed
+
+uint32 core_call(uint16 address, uchar a, uchar x, uint32 limit) {
+	//jsr to address and run it to its rts without the ppu (nsf init and play)
+	//returns the instructions it took, 0 when it did not return within limit
+	uchar* opcodes;
+	uint32 n = 0;
+	_acc = a;
+	_x = x;
+	_sr |= SR_FLAG_I;
+	_stack[_sp--] = (CORE_CALL_RETURN - 1) >> 8;
+	_stack[_sp--] = (CORE_CALL_RETURN - 1) & 0xFF;
+	bus_nes::pushed(_sp, 2);
+	_pc = address;
+	while (_pc != CORE_CALL_RETURN) {
+		if (n++ == limit) return 0;
+#if USE_LOWMEM
+		opcodes = core_fetch(_pc);
+#else
+		opcodes = _sram + (unsigned)_pc;
+#endif
+		_cycles += _cycle_table[opcodes[0]];
+		core_decode(opcodes);
+		if ((int32)(_cycles - _apu_due) >= 0) core_apu_sync();
+	}
+	return n;
+}
+
+void core_wait(uint32 cycle) {
+	//cpu idles up to cycle, the apu catches up
+	if ((int32)(cycle - _cycles) > 0) _cycles = cycle;
+	core_apu_sync();
+}
+
 void core_init(uchar* buffer, int len) {
 	uint8 num_banks = buffer[4];
-	uint16 start;
 	uint8 mapper;
 	if (buffer[9] & 0x01) {
 		//system PAL
@@ -2261,38 +2266,73 @@ void core_init(uchar* buffer, int len) {
 	else {
 		//system NTSC
 	}
-	ins_counter = 0;
 	mapper = (buffer[7] & 0xF0) | ((buffer[6] >> 4) & 0x0F);
-	core_config(num_banks, mapper, buffer + 0x10, len - 0x10, buffer[5], buffer + 0x10 + (num_banks * 0x4000), buffer[5]* 0x2000);
-	ppu_init(buffer[6]);
-	start = core_get_word(0xFFFC);
-	_pc = start;			//set pc to start of cartridge ROM
+	core_start(num_banks, mapper, buffer + 0x10, len - 0x10, buffer[5], buffer + 0x10 + (num_banks * 0x4000), buffer[5]* 0x2000, buffer[6]);
+}
+
+uint32 core_get_cycles() {
+	return _cycles;
+}
+
+uint32 core_get_frame() {
+	//frames since power on, the frame input events are stamped with
+	return _frame;
+}
+
+static uchar _interactive = 1;			//debug traps in core_exec wait for a key
+
+void core_set_interactive(uchar enable) {
+	//0 for drivers without a console, traps only print
+	_interactive = enable;
 }
 
 uchar core_exec(uchar* vbuffer) {
 	//printf("A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X [00h]:%02X [10h]:%02X [11h]:%02X\r\n", _acc, _x, _y, _sr, _sp, _pc, _sram[0], _sram[0x10], _sram[0x11]);
 	int ret = 0;
+	uchar* opcodes;
+	ppu_render_begin();
 	if (ppu_get_vblank())  {
 		//start nmi
 		if ((_sr & SR_FLAG_I)) {
 			_stack[_sp--] = _pc >> 8;			//PCH
 			_stack[_sp--] = _pc;				//PCL
-			_stack[_sp--] = _sr;					//SR
+			_stack[_sp--] = (_sr & ~SR_FLAG_B) | SR_FLAG_U;	//SR
+			bus_nes::pushed(_sp, 3);
 			_pc = core_get_word(0xFFFA);
+			_cycles += 7;
 			ins_counter = 0;
 		}
 		ppu_set_vblank(0);
 	}
-	core_decode(_sram + (unsigned)_pc);
+#if USE_LOWMEM
+	opcodes = core_fetch(_pc);
+#else
+	opcodes = _sram + (unsigned)_pc;
+#endif
+	_cycles += _cycle_table[opcodes[0]];
+	core_decode(opcodes);
 	
+	if ((int32)(_cycles - _apu_due) >= 0) core_apu_sync();
+	if (_apu_irq && !(_sr & SR_FLAG_I)) {
+		//frame counter or dmc irq
+		_stack[_sp--] = _pc >> 8;			//PCH
+		_stack[_sp--] = _pc;				//PCL
+		_stack[_sp--] = (_sr & ~SR_FLAG_B) | SR_FLAG_U;	//SR
+		bus_nes::pushed(_sp, 3);
+		_sr |= SR_FLAG_I;
+		_pc = core_get_word(0xFFFE);
+		_cycles += 7;
+	}
 	ins_counter++;
 	if ((ins_counter % 7501) == 0) {
 		ppu_set_vblank(1);
 	}
 	if ((ins_counter % 4057) == 0) {
-		ppu_render(vbuffer);
 		//ppu_set_vblank(1);
-		ret = 1;
+		if (ppu_render(vbuffer)) ret = 1;
+		else ret = 2;			//frame unchanged, vbuffer still holds previous frame
+		_frame++;
+		_frame_start = _cycles;
 	}
 	if (_pc == 0xb4ac) {
 		_pc = _pc;
@@ -2300,12 +2340,12 @@ uchar core_exec(uchar* vbuffer) {
 	if (_pc == 0xe45b) {
 		_pc = _pc;
 	}
-	if (_pc < 4) {
+	if (_pc < 4 && _interactive) {
 		getchar();
 	}
 	if (_pc == 0x0004) {
 		printf("executed : %ld\r\n", ins_counter);
-		getchar();
+		if (_interactive) getchar();
 	}
 	return ret;
 	//getchar();
@@ -0,0 +1,110 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+adaptive frame skip for fast forward and catch up
+
+every frame runs the cpu and the logical ppu (vblank, sprite 0 hit, status),
+only one frame in n is drawn. the others run with ppu_set_video off, ppu_render
+then does the hit test and nothing else. the driver calls skip_frame at every
+frame boundary, it times the host frame since the call before (a drawn frame
+includes the driver's present) and keeps a running mean for drawn and skipped
+frames. n is the smallest interval at which n frames, one of them drawn, reach
+the target rate:
+
+	n / ((n - 1) * skipped + drawn) >= target
+
+a target of 0 is uncapped, n stays at its maximum and only the cpu core limits
+the speed. the speed multiplier is emulated frames per host second over the
+nes frame rate.
+*/
+
+extern void ppu_set_video(uchar enable);
+
+#include <math.h>
+#include <chrono>
+
+#define SKIP_NES_FPS		60.0988
+#define SKIP_SMOOTH			0.125			//weight of a new frame time in the means
+
+static uint8 _skip_max = 0;					//0 = every frame drawn
+static double _skip_target = 0;				//emulated fps, 0 = uncapped
+static uint8 _skip_interval = 1;
+static uint8 _skip_phase = 0;				//frames since the last drawn one
+static uchar _skip_drawn = 1;				//the frame running now is drawn
+static double _skip_mean[2];				//host seconds per frame, skipped and drawn
+static std::chrono::steady_clock::time_point _skip_last;
+static uchar _skip_started = 0;
+static uint32 _skip_frames = 0;				//report window
+static uint32 _skip_shown = 0;
+static double _skip_seconds = 0;
+
+void skip_enable(double target, uint8 max) {
+	//target emulated fps (0 uncapped), draw at least one frame in max, max 0 draws every frame
+	_skip_target = target;
+	_skip_max = max;
+	_skip_interval = 1;
+	_skip_phase = 0;
+	_skip_drawn = 1;
+	_skip_mean[0] = _skip_mean[1] = 0;
+	_skip_started = 0;
+	_skip_frames = _skip_shown = 0;
+	_skip_seconds = 0;
+	ppu_set_video(1);
+}
+
+static uint8 skip_solve() {
+	//interval for the measured frame times
+	double n, skipped = _skip_mean[0], drawn = _skip_mean[1];
+	if (skipped == 0 || drawn == 0) return 2;			//one of each is measured first
+	if (_skip_target == 0 || _skip_target * skipped >= 1) return _skip_max;
+	n = ceil(_skip_target * (drawn - skipped) / (1 - _skip_target * skipped));
+	if (n < 1) return 1;
+	if (n > _skip_max) return _skip_max;
+	return (uint8)n;
+}
+
+uchar skip_frame() {
+	//frame boundary, returns 1 when the next frame is drawn
+	auto now = std::chrono::steady_clock::now();
+	double t;
+	if (_skip_max == 0) return 1;
+	if (_skip_started) {
+		t = std::chrono::duration<double>(now - _skip_last).count();
+		_skip_mean[_skip_drawn] = (_skip_mean[_skip_drawn] == 0) ? t : _skip_mean[_skip_drawn] + (t - _skip_mean[_skip_drawn]) * SKIP_SMOOTH;
+		_skip_seconds += t;
+		_skip_frames++;
+		_skip_shown += _skip_drawn;
+		_skip_interval = skip_solve();
+	}
+	_skip_started = 1;
+	_skip_last = now;
+	_skip_phase = _skip_drawn ? 1 : _skip_phase + 1;
+	_skip_drawn = (_skip_phase >= _skip_interval) ? 1 : 0;
+	ppu_set_video(_skip_drawn);
+	return _skip_drawn;
+}
+
+uint8 skip_get_interval() {
+	return _skip_interval;
+}
+
+double skip_get_speed() {
+	//emulated over real time since the last report
+	if (_skip_seconds == 0) return 0;
+	return _skip_frames / _skip_seconds / SKIP_NES_FPS;
+}
+
+void skip_report() {
+	//speed since the last report, the window starts over
+	if (_skip_frames == 0) return;
+	printf("skip     1 in %u drawn, %u of %u frames shown, %.1f fps, %.2fx speed, drawn %.2f ms, skipped %.2f ms\n",
+		_skip_interval, _skip_shown, _skip_frames, _skip_frames / _skip_seconds, skip_get_speed(),
+		_skip_mean[1] * 1000, _skip_mean[0] * 1000);
+	_skip_frames = _skip_shown = 0;
+	_skip_seconds = 0;
+}
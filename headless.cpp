@@ -0,0 +1,668 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+headless driver, no window and no frame pacing
+
+	headless rom.nes [-frames n | -seconds s] [-dump prefix [every]] [-novideo]
+	                 [-hash file] [-clone count frames] [-index catalog] [-boot dir frame]
+	                 [-input file] [-latency frame buttons] [-wav file] [-skip fps [max]]
+	                 [-logic [instances]] [-pipeline] [-snap capacity [spill]] [-profiles]
+	                 [-rewind [KB]] [-runahead frames]
+	headless -catalog dir catalog [csv]
+	headless -hashcmp run1.hash run2.hash
+	headless -nsf file.nsf prefix [-tracks first last] [-seconds s] [-silence s] [-wav] [-rate hz] [-jobs n]
+	headless -6502 | -65c02 image.bin [entry [success]]
+
+runs uncapped and reports emulated fps, the frames not redrawn because their
+render input did not change, host ns per frame and cpu instructions per second
+(core_exec executes one instruction per call). -dump writes every
+n-th frame as prefix00000.ppm at 256x240. -catalog indexes every rom under dir,
+-index takes header fields of catalogued roms from the index. -boot starts from a
+cached snapshot of frame, made by the first run, timed frames follow it.
+-input feeds lines of "frame port buttons" (buttons in hex, bit 0 = A) from a
+producer thread through the input queue, frames count from power on.
+-latency presses buttons (hex) on pad 1 at frame and reports how long the press
+takes to reach the game, the screen and the host, then exits. the frames after
+it are run twice from the same snapshot, with and without the press, so the
+photon frame is the first whose pixels differ because of the press.
+-wav records the apu output from an audio thread pulling the sample ring, the
+emulation waits for it instead of dropping blocks.
+-skip draws one frame in n, n adapts so the run reaches fps emulated frames per
+second (0 uncapped, n at max, default 16), cpu and ppu logic run every frame.
+-logic runs the ppu in logic only mode, the game sees the same registers but
+nothing is drawn or kept for drawing. with instances it then runs that many
+clones at once in the mode (0 one per core) and reports fps per core.
+-pipeline then runs as many frames again from power on, drawn on the calling
+thread and drawn on the ppu worker thread one frame behind, and reports both.
+-runahead shows each frame from frames ahead of the real one: the real frame
+runs without video, the machine is saved, frames more run (muted, the last one
+drawn) and the save is loaded back. the times of the four stages are reported.
+-profiles then runs as many frames again from power on with each ppu accuracy
+profile (frame, scanline, dot) and reports fps for each, every frame drawn.
+-rewind then runs as many frames again pushing each into a rewind ring of KB
+(default 4096) and reports the history it keeps per second of play, then steps
+back one frame at a time and reports the time per step.
+-snap then saves every frame of as many frames again into a snapshot store of
+capacity pages (backed by the spill file when given), keeping the last 600,
+reports save and load speed, then forks clones that save their own frames into
+the same pool and reports the pool again.
+-hashcmp reads two -hash recordings and prints the first frame and the pages
+where they diverge, the exit code is 0 when they never do.
+-nsf renders songs of an nsf file without the ppu to prefix-01.vgm (apu register
+log), with -wav also prefix-01.wav. a song ends after -seconds (default 150) or
+-silence seconds without sound (default 3, 0 never), songs render in -jobs
+processes (default one per core).
+-6502 and -65c02 run a 64KB functional test image (Klaus Dormann's tests) on a
+flat bus from entry (hex, default 400) until the cpu traps on a jump to itself
+and print the trap address, with success (hex) the exit code is 0 only when the
+trap is there.
+
+the low memory build also prints the static ram of the core and the ppu and the
+peak resident size of the process.
+
+linux, port.h stands in for stdafx.h and defs.h of the windows project:
+g++ -O2 -pthread core6502.cpp ppu.cpp rewind.cpp clone.cpp statehash.cpp snapstore.cpp romfile.cpp bootcache.cpp input.cpp latency.cpp apu.cpp nsf.cpp frameskip.cpp headless.cpp
+*/
+
+typedef struct nes_rom nes_rom;
+extern nes_rom* rom_open(const char* path, uchar* error);
+extern const char* rom_error(uchar code);
+extern void rom_start(const nes_rom* rom);
+extern void rom_print(const nes_rom* rom);
+extern void rom_close(nes_rom* rom);
+extern int32 rom_catalog_build(const char* dir, const char* index, const char* csv);
+extern uchar rom_catalog_open(const char* index);
+extern uchar boot_start(const nes_rom* rom, const char* dir, uint32 frame, uchar* vbuffer);
+extern double boot_get_time();
+extern uchar input_push(uint8 port, uint32 frame, uint32 cycle, uint8 buttons);
+extern uchar core_exec(uchar* vbuffer);
+extern uint32 core_get_frame();
+extern size_t core_state_size();
+extern size_t core_save_state(uchar* buffer, size_t size);
+extern uchar core_load_state(const uchar* buffer, size_t size);
+extern void core_set_interactive(uchar enable);
+extern void ppu_set_video(uchar enable);
+extern void ppu_set_line_callback(void (*callback)(uint16 line, uint16* pixels));
+extern uchar hash_init(uint8 shift, const char* path);
+extern uint64 hash_frame();
+extern void hash_close();
+extern int32 hash_compare(const char* path_a, const char* path_b);
+extern uint64 hash_bytes(const uchar* data, size_t size, uint64 seed);
+extern void lat_enable(uchar enable);
+extern void lat_photon(uint32 frame);
+extern void lat_present(uint32 frame);
+extern void lat_report();
+extern uint32 apu_pull(int16* samples, uint32 count);
+extern uint32 apu_get_rate();
+extern void apu_set_wait(uchar wait);
+extern void apu_set_mute(uchar mute);
+extern double apu_get_time();
+extern void clone_bench(uchar* vbuffer, uint32 count, uint32 frames);
+extern void logic_bench(uchar* vbuffer, uint32 instances, uint32 frames);
+extern void ppu_set_logic(uchar enable);
+extern uchar ppu_set_pipeline(uchar enable);
+extern uint32 ppu_get_skip_count();
+extern void ppu_set_profile(uchar profile);
+extern uchar ppu_get_profile();
+extern void skip_enable(double target, uint8 max);
+extern uchar skip_frame();
+extern double skip_get_speed();
+extern void skip_report();
+extern size_t core_get_footprint();
+extern size_t ppu_get_footprint();
+extern uint16 core_run_flat(uchar* memory, uint16 start, uchar cmos, uint32 limit, uint32* count);
+extern uchar rewind_init(size_t arena);
+extern void rewind_release();
+extern void rewind_push();
+extern uchar rewind_step(uint32 frames);
+extern uint32 rewind_get_frames();
+extern size_t rewind_get_usage();
+extern int core_clone();
+extern uchar snap_init(uint32 capacity, const char* spill);
+extern void snap_release();
+extern uint32 snap_get_pages();
+extern uchar snap_save(uint32* ids);
+extern uchar snap_load(const uint32* ids);
+extern void snap_free(const uint32* ids);
+extern void snap_report();
+extern int32 nsf_render(const char* path, const char* prefix, uint32 first, uint32 last, double seconds, double silence, uchar wav, uint32 rate, uint32 jobs);
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <sys/wait.h>
+#if USE_LOWMEM
+#include <sys/resource.h>
+#endif
+
+#define HL_WIDTH			256
+#define HL_HEIGHT			240
+#define HL_HASH_SHIFT		8
+#define HL_LATENCY_WINDOW	120				//frames searched for the photon
+#define HL_SKIP_MAX			16
+#define HL_REWIND_ARENA		4096			//KB of rewind ring
+#define HL_REWIND_STEPS		100
+#define HL_SNAP_HISTORY		600				//snapshots kept by -snap
+#define HL_SNAP_CLONES		4
+#define HL_NSF_SECONDS		150
+#define HL_NSF_SILENCE		3
+#define HL_NSF_RATE			44100
+
+#if USE_LOWMEM
+static uchar _hl_frame[HL_HEIGHT][HL_WIDTH][3];		//assembled from scanlines, no frame buffer in this build
+static uint32* _hl_vbuffer = NULL;
+
+static void hl_line(uint16 line, uint16* pixels) {
+	for (uint16 x = 0; x < HL_WIDTH; x++) {
+		_hl_frame[line][x][0] = (pixels[x] >> 8) & 0xF8;
+		_hl_frame[line][x][1] = (pixels[x] >> 3) & 0xFC;
+		_hl_frame[line][x][2] = pixels[x] << 3;
+	}
+}
+#else
+static uint32 _hl_vbuffer[HL_WIDTH * 2 * HL_HEIGHT * 2];	//2x upscaled a8r8g8b8, as ppu_render writes it
+#endif
+
+static void hl_dump(const char* prefix, uint32 frame) {
+	//binary ppm, top left pixel of every 2x2 block
+	char path[512];
+	uchar row[HL_WIDTH * 3];
+	FILE* ff;
+	snprintf(path, sizeof(path), "%s%05u.ppm", prefix, frame);
+	ff = fopen(path, "wb");
+	if (ff == NULL) return;
+	fprintf(ff, "P6\n%d %d\n255\n", HL_WIDTH, HL_HEIGHT);
+	for (uint32 y = 0; y < HL_HEIGHT; y++) {
+#if USE_LOWMEM
+		memcpy(row, _hl_frame[y], sizeof(row));
+#else
+		for (uint32 x = 0; x < HL_WIDTH; x++) {
+			uint32 color = _hl_vbuffer[(y * 2) * (HL_WIDTH * 2) + (x * 2)];
+			row[x * 3] = color >> 16;
+			row[x * 3 + 1] = color >> 8;
+			row[x * 3 + 2] = color;
+		}
+#endif
+		fwrite(row, 1, sizeof(row), ff);
+	}
+	fclose(ff);
+}
+
+static uint64 hl_output() {
+	//hash of the pixels last drawn
+#if USE_LOWMEM
+	return hash_bytes((const uchar*)_hl_frame, sizeof(_hl_frame), 0);
+#else
+	return hash_bytes((const uchar*)_hl_vbuffer, sizeof(_hl_vbuffer), 0);
+#endif
+}
+
+static uint32 hl_step() {
+	//run to the next frame boundary, index of the frame drawn
+	while (core_exec((uchar*)_hl_vbuffer) == 0);
+	return core_get_frame() - 1;
+}
+
+static uchar* _hl_ahead_state = NULL;
+static double _hl_ahead_time[4];			//real frame, save, frames ahead, load
+
+static uint64 hl_ahead(uint32 ahead, uchar video) {
+	//one real frame, then the frame ahead frames past it drawn and rolled back, instructions of the real frame
+	size_t size = core_state_size();
+	uint64 instructions = 0;
+	std::chrono::steady_clock::time_point t[5];
+	if (_hl_ahead_state == NULL) _hl_ahead_state = (uchar*)malloc(size);
+	if (_hl_ahead_state == NULL) return 0;
+	t[0] = std::chrono::steady_clock::now();
+	ppu_set_video(0);
+	do instructions++; while (core_exec((uchar*)_hl_vbuffer) == 0);
+	t[1] = std::chrono::steady_clock::now();
+	core_save_state(_hl_ahead_state, size);
+	t[2] = std::chrono::steady_clock::now();
+	apu_set_mute(1);				//only the real timeline is heard
+	for (uint32 i = 1; i < ahead; i++) hl_step();
+	ppu_set_video(video);
+	hl_step();
+	t[3] = std::chrono::steady_clock::now();
+	core_load_state(_hl_ahead_state, size);
+	apu_set_mute(0);
+	t[4] = std::chrono::steady_clock::now();
+	for (uint32 i = 0; i < 4; i++) _hl_ahead_time[i] += std::chrono::duration<double>(t[i + 1] - t[i]).count();
+	return instructions;
+}
+
+static double hl_run(uint32 frames) {
+	//seconds to run frames frames
+	auto start = std::chrono::steady_clock::now();
+	for (uint32 n = 0; n < frames; n++) hl_step();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void hl_pipeline(const nes_rom* rom, uint32 frames) {
+	//every frame drawn, on this thread and then on the worker while the cpu runs the next one
+	double fps[2];
+	ppu_set_logic(0);
+	ppu_set_video(1);
+	for (uchar enable = 0; enable < 2; enable++) {
+		rom_start(rom);
+		if (ppu_set_pipeline(enable) != enable) {
+			printf("pipeline not in this build\n");
+			return;
+		}
+		fps[enable] = frames / hl_run(frames);
+	}
+	ppu_set_pipeline(0);
+	printf("pipeline %u frames, %.1f fps drawn inline, %.1f fps on the worker, %.2fx\n", frames, fps[0], fps[1], fps[1] / fps[0]);
+}
+
+static void hl_profiles(const nes_rom* rom, uint32 frames) {
+	//cost of each accuracy level on the same frames
+	static const char* names[] = { "frame", "scanline", "dot" };
+	uchar profile = ppu_get_profile();
+	ppu_set_logic(0);
+	ppu_set_video(1);
+	for (uchar p = 0; p < 3; p++) {
+		rom_start(rom);
+		ppu_set_profile(p);
+		if (ppu_get_profile() != p) {
+			printf("profile  %s not in this build\n", names[p]);
+			continue;
+		}
+		printf("profile  %-8s %u frames, %.1f fps\n", names[p], frames, frames / hl_run(frames));
+	}
+	ppu_set_profile(profile);
+}
+
+static void hl_rewind(const nes_rom* rom, uint32 frames, uint32 arena) {
+	//history cost of one push per frame, then single frame steps back through it
+	uint32 n;
+	double elapsed;
+	rom_start(rom);
+	if (!rewind_init((size_t)arena << 10)) {
+		printf("rewind   cannot allocate %u KB\n", arena);
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (n = 0; n < frames; n++) {
+		hl_step();
+		rewind_push();
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("rewind   %u frames kept in %.1f KB, %.1f KB per second of history, %.1f fps with a push per frame\n",
+		rewind_get_frames(), rewind_get_usage() / 1024.0, rewind_get_usage() / 1024.0 / (rewind_get_frames() / 60.0), frames / elapsed);
+	start = std::chrono::steady_clock::now();
+	for (n = 0; n < HL_REWIND_STEPS && rewind_get_frames() > 1; n++) rewind_step(1);
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (n != 0) printf("rewind   %u steps, %.3f ms per step\n", n, elapsed * 1000 / n);
+	rewind_release();
+}
+
+static uint32 hl_snap_run(uint32* ids, uint32 pages, uint32 frames, double* seconds) {
+	//one snapshot per frame, the last HL_SNAP_HISTORY kept, frames saved before the pool filled
+	uint32 count;
+	seconds[0] = 0;
+	for (count = 0; count < frames; count++) {
+		hl_step();
+		if (count >= HL_SNAP_HISTORY) snap_free(ids + (count % HL_SNAP_HISTORY) * pages);
+		auto start = std::chrono::steady_clock::now();
+		if (!snap_save(ids + (count % HL_SNAP_HISTORY) * pages)) break;
+		seconds[0] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	return count;
+}
+
+static void hl_snap(const nes_rom* rom, uint32 frames, uint32 capacity, const char* spill) {
+	//pool shared with forked clones, their pages dedup against the parent's
+	uint32 pages, count, kept, i;
+	uint32* ids;
+	double save, load;
+	int pid;
+	rom_start(rom);
+	if (!snap_init(capacity, spill)) {
+		printf("snap     cannot map %u pages%s%s\n", capacity, spill ? " on " : "", spill ? spill : "");
+		return;
+	}
+	pages = snap_get_pages();
+	ids = (uint32*)calloc(HL_SNAP_HISTORY, pages * sizeof(uint32));
+	if (ids == NULL) {
+		snap_release();
+		return;
+	}
+	count = hl_snap_run(ids, pages, frames, &save);
+	snap_report();
+	if (count != frames) printf("snap     pool full after %u frames\n", count);
+	kept = (count > HL_SNAP_HISTORY) ? HL_SNAP_HISTORY : count;
+	auto start = std::chrono::steady_clock::now();
+	for (i = 0; i < kept; i++) snap_load(ids + i * pages);
+	load = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (count != 0) printf("snap     save %.1f MB/s, load %.1f MB/s\n", (double)count * core_state_size() / save / (1 << 20),
+		(double)kept * core_state_size() / load / (1 << 20));
+	for (i = 0; i < HL_SNAP_CLONES; i++) {
+		//clones keep their snapshots in the pool when they exit
+		pid = core_clone();
+		if (pid < 0) break;
+		if (pid == 0) _exit(hl_snap_run(ids, pages, frames, &save) == frames ? 0 : 1);
+	}
+	while (wait(NULL) > 0);
+	printf("snap     parent and %u clones:\n", i);
+	snap_report();
+	free(ids);
+	snap_release();
+}
+
+static void hl_latency(uint32 at, uint8 buttons) {
+	//press at frame at, photon is the first frame that differs from the run without the press
+	static uint64 base[HL_LATENCY_WINDOW];
+	size_t size = core_state_size();
+	uchar* state = (uchar*)malloc(size);
+	uint32 i, frame;
+	if (state == NULL) return;
+#if USE_LOWMEM
+	ppu_set_line_callback(hl_line);
+#endif
+	while (core_get_frame() < at) hl_step();
+	core_save_state(state, size);
+	for (i = 0; i < HL_LATENCY_WINDOW; i++) {
+		hl_step();
+		base[i] = hl_output();
+	}
+	core_load_state(state, size);
+	lat_enable(1);
+	input_push(0, core_get_frame(), 0, buttons);
+	for (i = 0; i < HL_LATENCY_WINDOW; i++) {
+		frame = hl_step();
+		if (hl_output() == base[i]) continue;
+		lat_photon(frame);
+		lat_present(frame);
+		break;
+	}
+	if (i == HL_LATENCY_WINDOW) printf("latency  press at frame %u not visible within %u frames\n", at, HL_LATENCY_WINDOW);
+	else lat_report();
+	lat_enable(0);
+	free(state);
+}
+
+static std::atomic<uchar> _hl_running(1);
+
+static void hl_input(FILE* ff) {
+	//producer thread, waits for room when the emulation falls behind the script
+	unsigned frame, port, buttons;
+	while (_hl_running && fscanf(ff, "%u %u %x", &frame, &port, &buttons) == 3) {
+		while (_hl_running && !input_push(port, frame, 0, buttons)) std::this_thread::yield();
+	}
+	fclose(ff);
+}
+
+static void hl_audio(FILE* ff) {
+	//consumer thread, 16 bit mono wav, sizes patched when the run is over
+	int16 samples[1024];
+	uint32 header[11] = { 0x46464952, 0, 0x45564157, 0x20746D66, 16, 0x00010001, apu_get_rate(), apu_get_rate() * 2, 0x00100002, 0x61746164, 0 };
+	uint32 n, bytes = 0;
+	uchar running;
+	fwrite(header, 1, sizeof(header), ff);
+	for (;;) {
+		running = _hl_running;			//before the pull, blocks pushed before the stop are drained
+		n = apu_pull(samples, 1024);
+		if (n == 0) {
+			if (!running) break;
+			std::this_thread::yield();
+			continue;
+		}
+		fwrite(samples, sizeof(int16), n, ff);
+		bytes += n * sizeof(int16);
+	}
+	header[1] = 36 + bytes;
+	header[10] = bytes;
+	fseek(ff, 0, SEEK_SET);
+	fwrite(header, 1, sizeof(header), ff);
+	fclose(ff);
+}
+
+static int hl_nsf(int argc, char* argv[]) {
+	//headless -nsf file.nsf prefix [options]
+	uint32 first = 0, last = 0, rate = HL_NSF_RATE, jobs = 0;
+	double seconds = HL_NSF_SECONDS, silence = HL_NSF_SILENCE;
+	uchar wav = 0;
+	int i;
+	for (i = 4; i < argc; i++) {
+		if (strcmp(argv[i], "-tracks") == 0 && i + 2 < argc) {
+			first = atoi(argv[++i]);
+			last = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-silence") == 0 && i + 1 < argc) silence = atof(argv[++i]);
+		else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) rate = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-wav") == 0) wav = 1;
+		else {
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	core_set_interactive(0);
+	return (nsf_render(argv[2], argv[3], first, last, seconds, silence, wav, rate, jobs) < 0) ? 1 : 0;
+}
+
+static int hl_cpu_test(int argc, char* argv[]) {
+	//headless -6502 image.bin [entry [success]], the image is loaded at 0000
+	static uchar memory[0x10000];
+	uchar cmos = strcmp(argv[1], "-65c02") == 0;
+	uint16 entry = (argc > 3) ? (uint16)strtol(argv[3], NULL, 16) : 0x400;
+	FILE* ff = fopen(argv[2], "rb");
+	uint32 count = 0;
+	size_t size;
+	uint16 pc;
+	double elapsed;
+	if (ff == NULL) {
+		printf("cannot open %s\n", argv[2]);
+		return 1;
+	}
+	size = fread(memory, 1, sizeof(memory), ff);
+	fclose(ff);
+	if (size != sizeof(memory)) {
+		//a cut image would run into zeroed memory (brk) instead of its own code
+		printf("%s: %u bytes, a test image is 65536\n", argv[2], (uint32)size);
+		return 1;
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	pc = core_run_flat(memory, entry, cmos, 0, &count);
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	printf("%s trap at %04X after %u instructions, %.2fs %.1f MIPS\n", cmos ? "65c02" : "6502", pc, count, elapsed, count / elapsed / 1000000);
+	if (argc > 4) return (pc == (uint16)strtol(argv[4], NULL, 16)) ? 0 : 1;
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	const char* dump = NULL;
+	const char* hash = NULL;
+	uint32 dump_every = 1;
+	uint32 frames = 0;
+	double seconds = 0;
+	uint32 clones = 0, clone_frames = 0;
+	const char* boot = NULL;
+	FILE* input = NULL;
+	FILE* wav = NULL;
+	std::thread producer, audio;
+	uint32 boot_frame = 0;
+	int32 latency = -1;
+	uint8 latency_buttons = 0;
+	double skip = -1;
+	uint8 skip_max = HL_SKIP_MAX;
+	uchar logic = 0;
+	int32 logic_instances = -1;
+	uchar pipeline = 0;
+	uchar profiles = 0;
+	uint32 rewind = 0;
+	uint32 runahead = 0;
+	uint32 snap = 0;
+	const char* spill = NULL;
+	uchar video = 1;
+	nes_rom* rom;
+	uchar error;
+	uint32 frame = 0;
+	uint64 instructions = 0;
+	double elapsed;
+	int i;
+	if (argc < 2) {
+		printf("usage: %s rom.nes [-frames n | -seconds s] [-dump prefix [every]] [-novideo] [-hash file] [-clone count frames] [-index catalog] [-boot dir frame] [-input file] [-latency frame buttons] [-wav file] [-skip fps [max]] [-logic [instances]] [-pipeline] [-snap capacity [spill]] [-profiles] [-rewind [KB]] [-runahead frames]\n", argv[0]);
+		printf("       %s -catalog dir catalog [csv]\n", argv[0]);
+		printf("       %s -hashcmp run1.hash run2.hash\n", argv[0]);
+		printf("       %s -nsf file.nsf prefix [-tracks first last] [-seconds s] [-silence s] [-wav] [-rate hz] [-jobs n]\n", argv[0]);
+		printf("       %s -6502 | -65c02 image.bin [entry [success]]\n", argv[0]);
+		return 1;
+	}
+	if (strcmp(argv[1], "-catalog") == 0 && argc > 3) {
+		return (rom_catalog_build(argv[2], argv[3], (argc > 4) ? argv[4] : NULL) < 0) ? 1 : 0;
+	}
+	if (strcmp(argv[1], "-hashcmp") == 0 && argc > 3) return (hash_compare(argv[2], argv[3]) < 0) ? 0 : 1;
+	if (strcmp(argv[1], "-nsf") == 0 && argc > 3) return hl_nsf(argc, argv);
+	if ((strcmp(argv[1], "-6502") == 0 || strcmp(argv[1], "-65c02") == 0) && argc > 2) return hl_cpu_test(argc, argv);
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-novideo") == 0) video = 0;
+		else if (strcmp(argv[i], "-hash") == 0 && i + 1 < argc) hash = argv[++i];
+		else if (strcmp(argv[i], "-index") == 0 && i + 1 < argc) {
+			if (!rom_catalog_open(argv[++i])) printf("%s: not a catalog\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "-dump") == 0 && i + 1 < argc) {
+			dump = argv[++i];
+			if (i + 1 < argc && argv[i + 1][0] != '-') dump_every = atoi(argv[++i]);
+			if (dump_every == 0) dump_every = 1;
+		}
+		else if (strcmp(argv[i], "-input") == 0 && i + 1 < argc) {
+			input = fopen(argv[++i], "r");
+			if (input == NULL) printf("cannot open %s\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "-wav") == 0 && i + 1 < argc) {
+			wav = fopen(argv[++i], "wb");
+			if (wav == NULL) printf("cannot write %s\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "-latency") == 0 && i + 2 < argc) {
+			latency = atoi(argv[++i]);
+			latency_buttons = (uint8)strtoul(argv[++i], NULL, 16);
+		}
+		else if (strcmp(argv[i], "-skip") == 0 && i + 1 < argc) {
+			skip = atof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') skip_max = atoi(argv[++i]);
+			if (skip_max == 0) skip_max = 1;
+		}
+		else if (strcmp(argv[i], "-logic") == 0) {
+			logic = 1;
+			if (i + 1 < argc && argv[i + 1][0] != '-') logic_instances = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-pipeline") == 0) pipeline = 1;
+		else if (strcmp(argv[i], "-profiles") == 0) profiles = 1;
+		else if (strcmp(argv[i], "-runahead") == 0 && i + 1 < argc) runahead = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-rewind") == 0) {
+			rewind = HL_REWIND_ARENA;
+			if (i + 1 < argc && argv[i + 1][0] != '-') rewind = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-snap") == 0 && i + 1 < argc) {
+			snap = atoi(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') spill = argv[++i];
+		}
+		else if (strcmp(argv[i], "-boot") == 0 && i + 2 < argc) {
+			boot = argv[++i];
+			boot_frame = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-clone") == 0 && i + 2 < argc) {
+			clones = atoi(argv[++i]);
+			clone_frames = atoi(argv[++i]);
+		}
+		else {
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (frames == 0 && seconds == 0) frames = 600;
+	rom = rom_open(argv[1], &error);
+	if (rom == NULL) {
+		printf("%s: %s\n", argv[1], rom_error(error));
+		return 1;
+	}
+	rom_print(rom);
+	core_set_interactive(0);
+	if (boot != NULL) {
+		uchar hit = boot_start(rom, boot, boot_frame, (uchar*)_hl_vbuffer);
+		printf("boot     frame %u reached in %.3f ms, cache %s\n", boot_frame, boot_get_time() * 1000, hit ? "hit" : "miss");
+	}
+	else rom_start(rom);
+	if (latency >= 0) {
+		hl_latency(latency, latency_buttons);
+		rom_close(rom);
+		return 0;
+	}
+#if USE_LOWMEM
+	if (dump != NULL) ppu_set_line_callback(hl_line);
+#endif
+	if (logic && dump == NULL) ppu_set_logic(1);
+	else if (!video && dump == NULL) ppu_set_video(0);
+	else if (skip >= 0) skip_enable(skip, skip_max);
+	if (hash != NULL && !hash_init(HL_HASH_SHIFT, hash)) printf("cannot write %s\n", hash);
+	if (input != NULL) producer = std::thread(hl_input, input);
+	if (wav != NULL) {
+		apu_set_wait(1);
+		audio = std::thread(hl_audio, wav);
+	}
+	uint32 skipped = ppu_get_skip_count();
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+	while (frames == 0 || frame < frames) {
+		uchar ret;
+		if (runahead != 0) instructions += hl_ahead(runahead, video || dump != NULL);
+		else do {
+			ret = core_exec((uchar*)_hl_vbuffer);
+			instructions++;
+		} while (ret == 0);
+		if (hash != NULL) hash_frame();
+		if (dump != NULL && (frame % dump_every) == 0) hl_dump(dump, frame);
+		if (skip >= 0) skip_frame();
+		frame++;
+		if (seconds != 0 && (frame & 15) == 0 && std::chrono::steady_clock::now() >= deadline) break;
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	_hl_running = 0;
+	if (producer.joinable()) producer.join();
+	if (audio.joinable()) audio.join();
+	hash_close();
+	skipped = ppu_get_skip_count() - skipped;
+	printf("%u frames in %.3fs, %.1f fps, %u unchanged and not redrawn, %.0f ns per frame, %.2f M instructions per second\n",
+		frame, elapsed, frame / elapsed, skipped, elapsed * 1e9 / frame, instructions / elapsed / 1e6);
+	printf("apu      %.1f%% of frame time, %.0f ns per frame, %.3f%% of a 60Hz frame\n", apu_get_time() * 100 / elapsed,
+		apu_get_time() * 1e9 / frame, apu_get_time() * 100 * 60 / frame);
+	if (runahead != 0 && frame != 0) {
+		//a host frame has 16.7ms for the real frame, the frames ahead and the save and load
+		printf("runahead %u: real frame %.3f ms, save %.1f us, %.3f ms per frame ahead, load %.1f us\n", runahead,
+			_hl_ahead_time[0] * 1000 / frame, _hl_ahead_time[1] * 1e6 / frame, _hl_ahead_time[2] * 1000 / frame / runahead,
+			_hl_ahead_time[3] * 1e6 / frame);
+	}
+#if USE_LOWMEM
+	{
+		//static ram of the emulator against what the process peaked at, the host frame and libc included
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		printf("memory   core %u bytes, ppu %u bytes static, peak rss %ld KB\n", (uint32)core_get_footprint(),
+			(uint32)ppu_get_footprint(), usage.ru_maxrss);
+	}
+#endif
+	if (skip >= 0 && video) {
+		printf("speed    %.2fx the nes frame rate\n", skip_get_speed());
+		skip_report();
+	}
+	if (logic_instances == 0) logic_instances = std::thread::hardware_concurrency();
+	if (logic_instances > 0) logic_bench((uchar*)_hl_vbuffer, logic_instances, frame);
+	if (profiles) hl_profiles(rom, frame);
+	if (pipeline) hl_pipeline(rom, frame);
+	if (rewind != 0) hl_rewind(rom, frame, rewind);
+	if (snap != 0) hl_snap(rom, frame, snap, spill);
+	if (clones != 0) clone_bench((uchar*)_hl_vbuffer, clones, clone_frames);
+	rom_close(rom);
+	return 0;
+}
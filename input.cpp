@@ -0,0 +1,85 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+controller input queue
+
+one producer thread (window, network, bot) pushes events, the emulation thread
+drains them when the game strobes $4016. an event carries the pad state from a
+point of emulated time on, frame and cpu cycle within the frame, events at or
+before the strobe are applied in order, later ones wait. stamping frame 0 means
+the next strobe.
+
+single producer, single consumer: head is only written by the producer, tail
+only by the consumer, no locks.
+
+the pad state drained so far is host state, not machine state: a rewind or a
+run-ahead rollback restores the machine but keeps the input already received.
+
+with latency probes enabled an event carries its probe, stamped at push and
+again when the strobe latches it.
+*/
+
+extern uint32 lat_entry(uint8 port, uint8 buttons, uint32 frame, uint32 cycle);
+extern void lat_read(uint32 id, uint32 frame, uint32 cycle);
+
+#include <atomic>
+
+#define INPUT_QUEUE			256				//power of two
+
+typedef struct input_event {
+	uint32 frame;
+	uint32 cycle;					//cpu cycles into frame
+	uint32 probe;					//latency probe, 0 for none
+	uint8 port;
+	uint8 buttons;
+} input_event;
+
+static input_event _input_queue[INPUT_QUEUE];
+static std::atomic<uint32> _input_head(0);		//next slot written by the producer
+static std::atomic<uint32> _input_tail(0);		//next slot read by the consumer
+static uint32 _input_dropped = 0;				//producer side, events refused on a full queue
+static uint8 _input_state[2] = { 0, 0 };		//consumer side, pads after the events drained so far
+
+uchar input_push(uint8 port, uint32 frame, uint32 cycle, uint8 buttons) {
+	//producer, 0 when the queue is full
+	uint32 head = _input_head.load(std::memory_order_relaxed);
+	input_event* e;
+	if (head - _input_tail.load(std::memory_order_acquire) == INPUT_QUEUE) {
+		_input_dropped++;
+		return 0;
+	}
+	e = &_input_queue[head & (INPUT_QUEUE - 1)];
+	e->frame = frame;
+	e->cycle = cycle;
+	e->port = port & 1;
+	e->buttons = buttons;
+	e->probe = lat_entry(e->port, buttons, frame, cycle);
+	_input_head.store(head + 1, std::memory_order_release);
+	return 1;
+}
+
+void input_drain(uint8* buttons, uint32 frame, uint32 cycle) {
+	//consumer, apply every event stamped at or before frame/cycle to the pad states
+	uint32 tail = _input_tail.load(std::memory_order_relaxed);
+	uint32 head = _input_head.load(std::memory_order_acquire);
+	input_event* e;
+	while (tail != head) {
+		e = &_input_queue[tail & (INPUT_QUEUE - 1)];
+		if (e->frame > frame || (e->frame == frame && e->cycle > cycle)) break;
+		_input_state[e->port] = e->buttons;
+		if (e->probe != 0) lat_read(e->probe, frame, cycle);
+		tail++;
+	}
+	_input_tail.store(tail, std::memory_order_release);
+	buttons[0] = _input_state[0];
+	buttons[1] = _input_state[1];
+}
+
+uint32 input_get_dropped() {
+	return _input_dropped;
+}
@@ -0,0 +1,180 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+input to photon latency probes
+
+a probe follows one controller change through four stages:
+
+	entry    input_push takes the new pad state
+	read     the game strobes $4016 and the change reaches the pad latch
+	photon   first frame whose output pixels differ because of it
+	present  the host takes that frame (blit, encode, dump)
+
+entry is taken on the producer thread, the other stages on the emulation thread.
+each stage records host time and, up to photon, the emulated point (frame, cpu
+cycle into the frame). emulated time assumes the nominal ntsc frame and cpu
+rates. a probe lives in a slot of a small ring, its stage is the handoff: the
+producer only fills free slots, the emulation thread frees them at present.
+
+the driver decides what photon means. lat_frame takes the first frame after the
+read whose output differs from the frame before, cheap but an animation that
+changes anyway counts too. an exact answer needs the frames the game would have
+drawn without the change, drivers that can replay a frame call lat_photon.
+*/
+
+extern uint32 core_get_frame();
+
+#include <atomic>
+#include <chrono>
+
+#define LAT_PROBES			64				//power of two
+#define LAT_FRAME_US		(1e6 / 60.0988)
+#define LAT_CYCLE_US		(1e6 / 1789773.0)
+#define LAT_STAGES			3				//entry-read, read-photon, photon-present
+
+enum { LAT_FREE = 0, LAT_ENTRY, LAT_READ, LAT_PHOTON };
+
+typedef struct lat_probe {
+	std::atomic<uint8> stage;
+	uint8 port;
+	uint8 buttons;
+	uint32 frame[3];				//entry, read, photon
+	uint32 cycle[2];				//entry, read
+	uint64 time[4];					//host ns, entry read photon present
+} lat_probe;
+
+static lat_probe _lat_probe[LAT_PROBES];
+static uchar _lat_enable = 0;
+static uint32 _lat_seq = 0;						//producer side, next probe
+static uint32 _lat_busy = 0;					//producer side, changes not probed because the ring was full
+static uint64 _lat_last_output = 0;			//lat_frame, output of the frame before
+static uint32 _lat_count = 0;					//completed probes
+static double _lat_sum[LAT_STAGES][3];			//frames, emulated us, host us
+static double _lat_max[LAT_STAGES][3];
+
+static __forceinline uint64 lat_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void lat_enable(uchar enable) {
+	//clears every probe and the totals, call while no producer is pushing
+	for (uint32 i = 0; i < LAT_PROBES; i++) _lat_probe[i].stage.store(LAT_FREE, std::memory_order_relaxed);
+	memset(_lat_sum, 0, sizeof(_lat_sum));
+	memset(_lat_max, 0, sizeof(_lat_max));
+	_lat_count = 0;
+	_lat_busy = 0;
+	_lat_last_output = 0;
+	_lat_enable = enable;
+}
+
+uint32 lat_entry(uint8 port, uint8 buttons, uint32 frame, uint32 cycle) {
+	//producer, probe id carried by the input event, 0 for none
+	//unstamped events take the current frame, exact only on the emulation thread
+	lat_probe* p;
+	uint32 id;
+	if (!_lat_enable) return 0;
+	id = ++_lat_seq;
+	if (id == 0) id = ++_lat_seq;
+	p = &_lat_probe[id & (LAT_PROBES - 1)];
+	if (p->stage.load(std::memory_order_acquire) != LAT_FREE) {
+		_lat_busy++;
+		return 0;
+	}
+	p->time[0] = lat_now();
+	p->port = port;
+	p->buttons = buttons;
+	p->frame[0] = (frame != 0) ? frame : core_get_frame();
+	p->cycle[0] = (frame != 0) ? cycle : 0;
+	p->stage.store(LAT_ENTRY, std::memory_order_relaxed);		//published by the queue head
+	return id;
+}
+
+void lat_read(uint32 id, uint32 frame, uint32 cycle) {
+	//consumer, the event of probe id was latched at frame/cycle
+	lat_probe* p = &_lat_probe[id & (LAT_PROBES - 1)];
+	if (p->stage.load(std::memory_order_relaxed) != LAT_ENTRY) return;
+	p->time[1] = lat_now();
+	p->frame[1] = frame;
+	p->cycle[1] = cycle;
+	p->stage.store(LAT_READ, std::memory_order_relaxed);
+}
+
+void lat_photon(uint32 frame) {
+	//the output of frame is the first to show every change latched at or before it
+	uint64 now = lat_now();
+	lat_probe* p;
+	for (uint32 i = 0; i < LAT_PROBES; i++) {
+		p = &_lat_probe[i];
+		if (p->stage.load(std::memory_order_relaxed) != LAT_READ || p->frame[1] > frame) continue;
+		p->time[2] = now;
+		p->frame[2] = frame;
+		p->stage.store(LAT_PHOTON, std::memory_order_relaxed);
+	}
+}
+
+void lat_frame(uint32 frame, uint64 output) {
+	//output hash of every frame drawn, a change of output is taken as the photon
+	if (!_lat_enable) return;
+	if (output != _lat_last_output) lat_photon(frame);
+	_lat_last_output = output;
+}
+
+static void lat_add(uint8 stage, double frames, double emulated, double host) {
+	double v[3] = { frames, emulated, host };
+	for (uint8 i = 0; i < 3; i++) {
+		_lat_sum[stage][i] += v[i];
+		if (v[i] > _lat_max[stage][i]) _lat_max[stage][i] = v[i];
+	}
+}
+
+void lat_present(uint32 frame) {
+	//the host took the output of frame, completes the probes shown in it
+	uint64 now;
+	double entry, read, photon;
+	lat_probe* p;
+	if (!_lat_enable) return;
+	now = lat_now();
+	for (uint32 i = 0; i < LAT_PROBES; i++) {
+		p = &_lat_probe[i];
+		if (p->stage.load(std::memory_order_relaxed) != LAT_PHOTON || p->frame[2] > frame) continue;
+		p->time[3] = now;
+		//emulated us since power on, a frame is shown at its end
+		entry = p->frame[0] * LAT_FRAME_US + p->cycle[0] * LAT_CYCLE_US;
+		read = p->frame[1] * LAT_FRAME_US + p->cycle[1] * LAT_CYCLE_US;
+		photon = (p->frame[2] + 1) * LAT_FRAME_US;
+		lat_add(0, (double)p->frame[1] - p->frame[0], read - entry, (double)(p->time[1] - p->time[0]) / 1e3);
+		lat_add(1, (double)p->frame[2] + 1 - p->frame[1], photon - read, (double)(p->time[2] - p->time[1]) / 1e3);
+		lat_add(2, (double)frame - p->frame[2], (frame - p->frame[2]) * LAT_FRAME_US, (double)(p->time[3] - p->time[2]) / 1e3);
+		_lat_count++;
+		p->stage.store(LAT_FREE, std::memory_order_release);
+	}
+}
+
+uint32 lat_get_count() {
+	return _lat_count;
+}
+
+void lat_report() {
+	//mean and worst of every stage over the completed probes
+	static const char* names[LAT_STAGES] = { "entry   -> read", "read    -> photon", "photon  -> present" };
+	double total[3] = { 0, 0, 0 };
+	uint8 i, j;
+	if (_lat_count == 0) {
+		printf("latency  no probe reached the screen\n");
+		return;
+	}
+	printf("latency  %u probes%s, mean / max\n", _lat_count, (_lat_busy != 0) ? ", some changes not probed" : "");
+	printf("  %-18s %-12s %-21s %s\n", "", "frames", "emulated us", "host us");
+	for (i = 0; i < LAT_STAGES; i++) {
+		printf("  %-18s %5.2f / %-4.0f %9.0f / %-9.0f %9.1f / %.1f\n", names[i],
+			_lat_sum[i][0] / _lat_count, _lat_max[i][0], _lat_sum[i][1] / _lat_count, _lat_max[i][1],
+			_lat_sum[i][2] / _lat_count, _lat_max[i][2]);
+		for (j = 0; j < 3; j++) total[j] += _lat_sum[i][j] / _lat_count;
+	}
+	printf("  %-18s %5.2f        %9.0f             %9.1f\n", "entry   -> present", total[0], total[1], total[2]);
+}
@@ -0,0 +1,399 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+nsf player, offline rendering of game music
+
+an nsf image is the sound driver and music data of a game with three entry
+points: load address, init (a = song, x = ntsc/pal) and play, called at the
+rate of the header. the image is cut into 4KB banks, $5FF8-$5FFF select the
+bank seen at $8000-$FFFF, the player installs that as the mapper so bank writes
+of the tune and the initial banks take the same path. init and play run through
+core_call on the cpu alone, the ppu is never clocked, between two play calls the
+cpu idles and the apu catches up in one go.
+
+every write to the apu registers is logged with its cycle as a vgm file (nes
+apu commands, waits at 44100Hz). vgm players read dmc samples from a copy of
+$C000-$FFFF, it is written at the start and again after every bank switch there.
+the apu output can be written to a wav at the same time. a track ends after the
+given length or after a run of silence.
+
+the machine lives in globals, tracks run in parallel as forked workers, each
+worker takes every jobs-th track.
+
+	headless -nsf file.nsf prefix [-tracks first last] [-seconds s] [-silence s]
+	                              [-wav] [-rate hz] [-jobs n]
+*/
+
+extern void core_start(uint8 num_banks, uint8 mapper, uchar* rom, int len, uint8 ch_bank, uchar* chrom, int chlen, uint8 config);
+extern void core_set_mapper(uint16 base, void* payload, void (*write)(void* payload, uint16 address, uint8 data));
+extern void core_map_prg(uint16 address, uchar* rom, int size);
+extern uint32 core_call(uint16 address, uchar a, uchar x, uint32 limit);
+extern void core_wait(uint32 cycle);
+extern uint32 core_get_cycles();
+extern uchar core_get_mem(uint16 address);
+extern uchar core_set_mem(uint16 address, uchar val);
+extern uchar apu_init(uint32 rate);
+extern uint32 apu_get_rate();
+extern void apu_set_sink(void (*sink)(const int16* samples, uint32 count));
+extern void apu_set_log(void (*log)(uint16 address, uchar val, uint32 now));
+
+#include <chrono>
+#include <thread>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#define NSF_HEADER			0x80
+#define NSF_MAPPER			0xFF			//no cartridge board, core_config maps nothing
+#define NSF_BANK_REG		0x5FF8
+#define NSF_CLOCK			1789773
+#define NSF_CALL_LIMIT		1000000			//instructions init or play may take before the track is given up
+#define NSF_QUIET			16				//peak of a silent sample
+#define NSF_MAX_SECONDS		2000			//cpu cycles of a track fit 32 bits
+#define NSF_VGM_RATE		44100
+#define NSF_VGM_HEADER		0x100
+#define NSF_VGM_VERSION		0x171
+
+typedef struct nsf_file {
+	uchar* image;				//data from the load address, padded to whole 4KB banks
+	uint32 banks;
+	uint8 bank[8];				//initial banks of $8000-$FFFF
+	uint16 load;
+	uint16 init;
+	uint16 play;
+	uint32 speed;				//us between play calls
+	uint8 songs;
+	uint8 start;				//1 based
+	uint8 pal;
+	uint8 expansion;
+	uchar bankswitched;
+	char title[33];
+	char artist[33];
+} nsf_file;
+
+#if USE_LOWMEM
+static uchar _nsf_window[0x8000];		//4KB banks are copied, prg windows are 8KB
+#endif
+static FILE* _nsf_vgm = NULL;
+static FILE* _nsf_wav = NULL;
+static uint64 _nsf_clock;				//cpu cycles since the track started
+static uint32 _nsf_last;				//_cycles at _nsf_clock
+static uint64 _nsf_waited;				//vgm samples written as waits
+static uint32 _nsf_writes;
+static uint32 _nsf_quiet;				//silent samples in a row
+static uint32 _nsf_samples;				//wav samples
+
+static __forceinline uint16 nsf_word(const uchar* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static void nsf_put(uint32 val, uint8 bytes) {
+	for (uint8 i = 0; i < bytes; i++, val >>= 8) fputc(val & 0xFF, _nsf_vgm);
+}
+
+static void nsf_vgm_wait(uint32 now) {
+	//waits up to cpu cycle now, in the shortest commands
+	uint64 target;
+	uint32 n;
+	_nsf_clock += (uint32)(now - _nsf_last);
+	_nsf_last = now;
+	target = _nsf_clock * NSF_VGM_RATE / NSF_CLOCK;
+	while (_nsf_waited < target) {
+		n = (target - _nsf_waited > 0xFFFF) ? 0xFFFF : (uint32)(target - _nsf_waited);
+		if (n == 735) fputc(0x62, _nsf_vgm);
+		else if (n == 882) fputc(0x63, _nsf_vgm);
+		else if (n <= 16) fputc(0x70 + n - 1, _nsf_vgm);
+		else {
+			fputc(0x61, _nsf_vgm);
+			nsf_put(n, 2);
+		}
+		_nsf_waited += n;
+	}
+}
+
+static void nsf_vgm_write(uint16 address, uchar val, uint32 now) {
+	//apu log hook, register 0x00-0x17 is $4000-$4017
+	nsf_vgm_wait(now);
+	fputc(0xB4, _nsf_vgm);
+	fputc(address - 0x4000, _nsf_vgm);
+	fputc(val, _nsf_vgm);
+	_nsf_writes++;
+}
+
+static void nsf_vgm_dmc(uint16 address) {
+	//4KB of what the cpu sees at address as an apu ram write block
+	if (_nsf_vgm == NULL) return;
+	nsf_vgm_wait(core_get_cycles());
+	fputc(0x67, _nsf_vgm);
+	fputc(0x66, _nsf_vgm);
+	fputc(0xC2, _nsf_vgm);
+	nsf_put(2 + 0x1000, 4);
+	nsf_put(address, 2);
+	for (uint32 i = 0; i < 0x1000; i++) fputc(core_get_mem(address + i), _nsf_vgm);
+}
+
+static void nsf_bank(void* payload, uint16 address, uint8 data) {
+	//mapper write, $5FF8-$5FFF select the 4KB bank of $8000-$FFFF
+	nsf_file* nsf = (nsf_file*)payload;
+	uint16 slot = address & 7;
+	uchar* src;
+	if (address < NSF_BANK_REG || address > NSF_BANK_REG + 7) return;		//rom writes reach the mapper too
+	src = nsf->image + ((data % nsf->banks) << 12);
+#if USE_LOWMEM
+	memcpy(_nsf_window + (slot << 12), src, 0x1000);
+	core_map_prg(0x8000 + (slot << 12), _nsf_window + (slot << 12), 0x1000);
+#else
+	core_map_prg(0x8000 + (slot << 12), src, 0x1000);
+#endif
+	if (slot >= 4) nsf_vgm_dmc(0x8000 + (slot << 12));		//dmc samples are fetched from $C000-$FFFF
+}
+
+static void nsf_sink(const int16* samples, uint32 count) {
+	//apu blocks, silence detection and the wav
+	for (uint32 i = 0; i < count; i++) {
+		if (samples[i] > NSF_QUIET || samples[i] < -NSF_QUIET) _nsf_quiet = 0;
+		else _nsf_quiet++;
+	}
+	if (_nsf_wav != NULL) fwrite(samples, sizeof(int16), count, _nsf_wav);
+	_nsf_samples += count;
+}
+
+static nsf_file* nsf_open(const char* path) {
+	nsf_file* nsf;
+	uchar header[NSF_HEADER];
+	uint32 size, pad, i;
+	FILE* ff = fopen(path, "rb");
+	if (ff == NULL) {
+		printf("%s: cannot open\n", path);
+		return NULL;
+	}
+	fseek(ff, 0, SEEK_END);
+	size = ftell(ff);
+	fseek(ff, 0, SEEK_SET);
+	if (size <= NSF_HEADER || fread(header, 1, NSF_HEADER, ff) != NSF_HEADER || memcmp(header, "NESM\x1A", 5) != 0 || header[6] == 0) {
+		printf("%s: not an nsf file\n", path);
+		fclose(ff);
+		return NULL;
+	}
+	nsf = (nsf_file*)calloc(1, sizeof(nsf_file));
+	nsf->songs = header[6];
+	nsf->start = (header[7] != 0) ? header[7] : 1;
+	nsf->load = nsf_word(header + 0x08);
+	nsf->init = nsf_word(header + 0x0A);
+	nsf->play = nsf_word(header + 0x0C);
+	memcpy(nsf->title, header + 0x0E, 32);
+	memcpy(nsf->artist, header + 0x2E, 32);
+	nsf->pal = ((header[0x7A] & 3) == 1) ? 1 : 0;			//dual standard tunes play ntsc
+	nsf->speed = nsf_word(header + (nsf->pal ? 0x78 : 0x6E));
+	if (nsf->speed == 0) nsf->speed = nsf->pal ? 20000 : 16639;
+	nsf->expansion = header[0x7B];
+	for (i = 0; i < 8; i++) {
+		nsf->bank[i] = header[0x70 + i];
+		if (nsf->bank[i] != 0) nsf->bankswitched = 1;
+	}
+	if (!nsf->bankswitched && nsf->load < 0x8000) {
+		printf("%s: load address $%04X below $8000\n", path, nsf->load);
+		fclose(ff);
+		free(nsf);
+		return NULL;
+	}
+	//bankswitched data starts at the offset of the load address into its bank, plain data is placed at $8000
+	pad = nsf->bankswitched ? (nsf->load & 0xFFF) : (nsf->load - 0x8000);
+	size -= NSF_HEADER;
+	nsf->banks = (pad + size + 0xFFF) >> 12;
+	if (!nsf->bankswitched) {
+		if (nsf->banks < 8) nsf->banks = 8;
+		for (i = 0; i < 8; i++) nsf->bank[i] = i;
+	}
+	nsf->image = (uchar*)calloc(nsf->banks, 0x1000);
+	if (fread(nsf->image + pad, 1, size, ff) != size) {
+		printf("%s: truncated\n", path);
+		fclose(ff);
+		free(nsf->image);
+		free(nsf);
+		return NULL;
+	}
+	fclose(ff);
+	return nsf;
+}
+
+static void nsf_close(nsf_file* nsf) {
+	free(nsf->image);
+	free(nsf);
+}
+
+static double nsf_track(nsf_file* nsf, uint8 song, const char* prefix, double seconds, double silence, uchar wav) {
+	//renders song (0 based), returns the seconds of audio
+	uint32 header[11] = { 0x46464952, 0, 0x45564157, 0x20746D66, 16, 0x00010001, apu_get_rate(), apu_get_rate() * 2, 0x00100002, 0x61746164, 0 };
+	char path[512];
+	uint64 total = (uint64)(seconds * NSF_CLOCK);
+	uint64 next = 0;
+	uint32 rate = apu_get_rate();
+	uint32 n, a;
+	uchar ok;
+	double elapsed;
+	const char* end = "length";
+	auto start = std::chrono::steady_clock::now();
+	snprintf(path, sizeof(path), "%s-%02u.vgm", prefix, song + 1);
+	_nsf_vgm = fopen(path, "wb");
+	if (_nsf_vgm == NULL) {
+		printf("cannot write %s\n", path);
+		return 0;
+	}
+	for (a = 0; a < NSF_VGM_HEADER; a++) fputc(0, _nsf_vgm);
+	if (wav) {
+		snprintf(path, sizeof(path), "%s-%02u.wav", prefix, song + 1);
+		_nsf_wav = fopen(path, "wb");
+		if (_nsf_wav == NULL) printf("cannot write %s\n", path);
+		else fwrite(header, 1, sizeof(header), _nsf_wav);
+	}
+	_nsf_clock = 0;
+	_nsf_last = 0;
+	_nsf_waited = 0;
+	_nsf_writes = 0;
+	_nsf_quiet = 0;
+	_nsf_samples = 0;
+	apu_set_sink(nsf_sink);
+#if USE_LOWMEM
+	core_map_prg(0x8000, _nsf_window, 0x8000);			//windows are read for the reset vector
+#endif
+	core_start(0, NSF_MAPPER, nsf->image, nsf->banks << 12, 0, NULL, 0, 0);
+	core_set_mapper(NSF_BANK_REG, nsf, nsf_bank);
+	apu_set_log(nsf_vgm_write);
+	//power on sequence of the nsf spec, banks through the mapper
+	for (a = 0; a < 0x800; a++) core_set_mem(a, 0);
+	for (a = 0x6000; a < 0x8000; a++) core_set_mem(a, 0);
+	for (a = 0x4000; a < 0x4014; a++) core_set_mem(a, 0);
+	core_set_mem(0x4015, 0x00);
+	core_set_mem(0x4015, 0x0F);
+	core_set_mem(0x4017, 0x40);
+	for (a = 0; a < 8; a++) core_set_mem(NSF_BANK_REG + a, nsf->bank[a]);
+	ok = core_call(nsf->init, song, nsf->pal, NSF_CALL_LIMIT) != 0;
+	if (!ok) end = "init did not return";
+	for (n = 1; ok; n++) {
+		next = (uint64)n * nsf->speed * NSF_CLOCK / 1000000;
+		if (next >= total) {
+			next = total;
+			break;
+		}
+		if (silence != 0 && _nsf_quiet >= silence * rate) {
+			end = "silence";
+			break;
+		}
+		core_wait((uint32)next);
+		if (core_call(nsf->play, 0, 0, NSF_CALL_LIMIT) == 0) {
+			end = "play did not return";
+			break;
+		}
+	}
+	core_wait((uint32)next);
+	nsf_vgm_wait((uint32)next);
+	apu_set_log(NULL);
+	apu_set_sink(NULL);
+	//vgm header, offsets are relative to their own field
+	fputc(0x66, _nsf_vgm);
+	a = ftell(_nsf_vgm);
+	fseek(_nsf_vgm, 0, SEEK_SET);
+	fwrite("Vgm ", 1, 4, _nsf_vgm);
+	nsf_put(a - 0x04, 4);
+	nsf_put(NSF_VGM_VERSION, 4);
+	fseek(_nsf_vgm, 0x18, SEEK_SET);
+	nsf_put((uint32)_nsf_waited, 4);
+	fseek(_nsf_vgm, 0x34, SEEK_SET);
+	nsf_put(NSF_VGM_HEADER - 0x34, 4);
+	fseek(_nsf_vgm, 0x84, SEEK_SET);
+	nsf_put(NSF_CLOCK, 4);
+	fclose(_nsf_vgm);
+	_nsf_vgm = NULL;
+	if (_nsf_wav != NULL) {
+		header[1] = 36 + _nsf_samples * sizeof(int16);
+		header[10] = _nsf_samples * sizeof(int16);
+		fseek(_nsf_wav, 0, SEEK_SET);
+		fwrite(header, 1, sizeof(header), _nsf_wav);
+		fclose(_nsf_wav);
+		_nsf_wav = NULL;
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	seconds = (double)_nsf_waited / NSF_VGM_RATE;
+	printf("track %3u  %6.1fs of audio in %.3fs, %.0fx real time, %u writes, %s\n", song + 1, seconds, elapsed,
+		seconds / elapsed, _nsf_writes, end);
+	fflush(stdout);
+	return seconds;
+}
+
+int32 nsf_render(const char* path, const char* prefix, uint32 first, uint32 last, double seconds, double silence, uchar wav, uint32 rate, uint32 jobs) {
+	//tracks first to last (1 based, 0 for all), returns the tracks rendered or -1
+	nsf_file* nsf = nsf_open(path);
+	double audio = 0, elapsed;
+	uint32 t;
+	if (nsf == NULL) return -1;
+	if (first == 0) {
+		first = 1;
+		last = nsf->songs;
+	}
+	if (last > nsf->songs) last = nsf->songs;
+	if (last < first) last = first;
+	if (first > nsf->songs) {
+		printf("%s: %u songs\n", path, nsf->songs);
+		nsf_close(nsf);
+		return -1;
+	}
+	if (seconds <= 0 || seconds > NSF_MAX_SECONDS) seconds = NSF_MAX_SECONDS;
+	if (!apu_init(rate)) {
+		printf("sample rate %u not supported\n", rate);
+		nsf_close(nsf);
+		return -1;
+	}
+	if (jobs == 0) jobs = std::thread::hardware_concurrency();
+	if (jobs == 0) jobs = 1;
+	if (jobs > last - first + 1) jobs = last - first + 1;
+	printf("nsf      %.32s / %.32s, %u songs from %u, load $%04X init $%04X play $%04X, %s, %.2fHz%s\n", nsf->title, nsf->artist,
+		nsf->songs, nsf->start, nsf->load, nsf->init, nsf->play, nsf->bankswitched ? "bankswitched" : "flat", 1e6 / nsf->speed,
+		(nsf->expansion != 0) ? ", expansion audio not emulated" : "");
+	fflush(stdout);
+	auto start = std::chrono::steady_clock::now();
+#if !defined(_WIN32)
+	if (jobs > 1) {
+		//one process per job, rendered seconds come back through a pipe
+		int fd[2];
+		uint32 j;
+		double s;
+		if (pipe(fd) != 0) jobs = 1;
+		for (j = 0; j < jobs && jobs > 1; j++) {
+			int pid = fork();
+			if (pid < 0) {
+				//the share of a worker that did not start is rendered here
+				for (t = first + j; t <= last; t += jobs) audio += nsf_track(nsf, t - 1, prefix, seconds, silence, wav);
+				continue;
+			}
+			if (pid == 0) {
+				close(fd[0]);
+				for (t = first + j; t <= last; t += jobs) {
+					s = nsf_track(nsf, t - 1, prefix, seconds, silence, wav);
+					if (write(fd[1], &s, sizeof(s)) != sizeof(s)) break;
+				}
+				_exit(0);
+			}
+		}
+		if (jobs > 1) {
+			close(fd[1]);
+			while (read(fd[0], &s, sizeof(s)) == sizeof(s)) audio += s;
+			close(fd[0]);
+			while (wait(NULL) > 0);
+		}
+	}
+#endif
+	if (jobs <= 1) {
+		for (t = first; t <= last; t++) audio += nsf_track(nsf, t - 1, prefix, seconds, silence, wav);
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%u tracks, %u jobs, %.1fs of audio in %.3fs, %.0fx real time\n", last - first + 1, jobs, audio, elapsed, audio / elapsed);
+	nsf_close(nsf);
+	return last - first + 1;
+}
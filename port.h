@@ -0,0 +1,30 @@
+#ifndef _PORT_H
+#define _PORT_H
+
+/*
+what stdafx.h and defs.h give the emulator modules on the windows project,
+for hosts built without it (the headless linux driver)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t uint8;
+typedef uint8_t uchar;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef int64_t int64;
+typedef unsigned int uint;
+
+#ifndef __forceinline
+#define __forceinline		inline __attribute__((always_inline))
+#endif
+
+#endif
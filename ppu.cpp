@@ -85,11 +85,18 @@ $2007 | RW | PPU Memory Data
 
 */
 
+#ifdef _WIN32
 #include "stdafx.h"
 #include "defs.h"
+#else
+#include "port.h"
+#endif
 
 #define DISP_WIDTH          512
 #define DISP_HEIGHT         480
+#define SCREEN_WIDTH        256
+#define SCREEN_HEIGHT       240
+#define HIT_HEIGHT          16          //sprite hit test only accumulates within sprite bounds (8x16 max), a row is 8 bits
 
 static uint8 _pram[0x4000];
 static uint8 _sprmem[0x100];
@@ -104,11 +111,167 @@ uint16 _vscroll = 0;
 uint16 _hscroll = 0;
 uint8 _ppu_config = 0;
 uint8 _vblank = 0;
+uint32 _ppu_gen = 1;                //bumped on every change of render input
+uint32 _render_gen = 0;             //generation of last rendered frame
+uchar* _render_buffer = NULL;
+uint32 _skip_count = 0;
+uchar _video = 1;                   //0 = frames emulated for their side effects only, nothing drawn
+uchar _logic = 0;                   //1 = no render input kept either, only what the cpu can read
+static uint8 _dirty_shift = 8;                  //page size of dirty bitmaps, set by core_dirty_config
+static uint64 _dirty_vram[(0x4000 >> 6) / 64];
+static uint64 _dirty_oam[1];
+#define DIRTY_MARK(map, offset)     { uint32 _p = (uint32)(offset) >> _dirty_shift; map[_p >> 6] |= (uint64)1 << (_p & 63); }
+
+void ppu_dirty_range(uint64* map, uint32 offset, uint32 size) {
+    uint32 last = (offset + size - 1) >> _dirty_shift;
+    for (uint32 p = offset >> _dirty_shift; p <= last; p++) map[p >> 6] |= (uint64)1 << (p & 63);
+}
+
+#define JOURNAL_CR1         0x00
+#define JOURNAL_CR2         0x01
+#define JOURNAL_OAM         0x04
+#define JOURNAL_HSCROLL     0x05
+#define JOURNAL_VSCROLL     0x15
+#define JOURNAL_VRAM        0x07
+#define JOURNAL_DMA         0x14
+#define JOURNAL_CHR         0xFF            //chr bank switch, not replayable
+
+#define PPU_PROFILE_FRAME       0           //whole frame from final register state
+#define PPU_PROFILE_SCANLINE    1           //journal replayed at scanline boundaries
+#define PPU_PROFILE_DOT         2           //scanline renderer, a line with writes is split at their dots
+
+typedef struct ppu_event {
+    uint16 cycle;               //cpu cycles since vblank
+    uint8 type;
+    uint8 data;
+    uint16 address;             //vram/oam address, dma block index
+    uint16 old;                 //previous value
+} ppu_event;
+
+typedef struct ppu_frame {
+    uint8* pram;                //chr, nametable and pallete regions
+    uint8* sprmem;
+    uint8 cr1;
+    uint8 cr2;
+    uint16 hscroll;
+    uint16 vscroll;
+    uint64* bkg_dirty;
+    ppu_event* events;          //writes since vblank, replayed per scanline
+    uint16 count;
+    uint8 (*oam)[0x100];        //oam swapped out by dma events
+} ppu_frame;
+
+#if !USE_LOWMEM
+#define USE_JOURNAL         1
+#endif
+
+#if USE_JOURNAL
+#define JOURNAL_SIZE        1024
+#define JOURNAL_DMA_SIZE    2
+static ppu_event _journal[JOURNAL_SIZE];
+static uint8 _journal_oam[JOURNAL_DMA_SIZE][0x100];
+static uint16 _journal_count = 0;
+static uint8 _journal_dma = 0;
+static uchar _journal_overflow = 0;
+static uint32 _journal_base = 0;            //cycle of last vblank
+#endif
+static uchar _profile = PPU_PROFILE_FRAME;
+extern uint32 core_get_cycles();
+
+#if !USE_LOWMEM && !defined(USE_RENDER_THREAD)
+#define USE_RENDER_THREAD   1
+#endif
+
+#if !USE_LOWMEM
+#define USE_BKG_CACHE       1
+#endif
+
+#if USE_BKG_CACHE
+#define PLANE_WIDTH         512         //4 nametables, 2x2
+#define PLANE_HEIGHT        480
+#define PLANE_TILES_X       (PLANE_WIDTH / 8)
+#define PLANE_TILES_Y       (PLANE_HEIGHT / 8)
+static uint8 _bkg_plane[PLANE_HEIGHT][PLANE_WIDTH];        //prerendered pallete index (attr << 2 | pattern)
+static uint64 _bkg_dirty[PLANE_TILES_Y];                    //1 bit per 8x8 tile
+static uint16 _bkg_pattern_base = 0xFFFF;
+void ppu_bkg_mark(uint64* dirty, uint16 address);
+void ppu_bkg_mark_all();
+#endif
+
+#if USE_RENDER_THREAD
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+//snapshots of render input, one being drawn by the worker while the cpu fills the other
+static uint8 _slot_pram[2][0x4000];
+static uint8 _slot_sprmem[2][0x100];
+#if USE_BKG_CACHE
+static uint64 _slot_dirty[2][PLANE_TILES_Y];
+#else
+static uint64 _slot_dirty[2][1];
+#endif
+#if USE_JOURNAL
+static ppu_event _slot_journal[2][JOURNAL_SIZE];
+static uint8 _slot_oam[2][JOURNAL_DMA_SIZE][0x100];
+#endif
+static ppu_frame _slot_frame[2];
+static uchar _slot = 0;
+static std::thread _worker;
+static std::mutex _worker_lock;
+static std::condition_variable _worker_cond;
+static uchar _worker_enable = 0;
+static uchar _worker_quit = 0;
+static uchar _worker_drawn = 0;
+static ppu_frame* _worker_frame = NULL;         //snapshot being drawn
+static ppu_frame* _pending_frame = NULL;        //snapshot waiting for ppu_render_begin
+static uchar* _worker_buffer = NULL;
+void ppu_worker_wait();
+#endif
 
 void ppu_set_vblank(uchar flag) {
     _vblank = flag;
+#if USE_JOURNAL
+    if (flag) {
+        //start journal of a new frame
+        _journal_count = 0;
+        _journal_dma = 0;
+        _journal_overflow = 0;
+        _journal_base = core_get_cycles();
+    }
+#endif
+}
+
+void ppu_journal(uint8 type, uint16 address, uint16 old, uint8 data) {
+    //record a change of render input, timestamped relative to vblank
+    _ppu_gen++;
+#if USE_JOURNAL
+    uint32 cycle;
+    ppu_event* e;
+    if (_journal_overflow || _logic) return;
+    if (_journal_count == JOURNAL_SIZE || type == JOURNAL_CHR) {
+        _journal_overflow = 1;          //frame rendered from final state
+        return;
+    }
+    if (type == JOURNAL_DMA) {
+        if (address != 0 || _journal_dma == JOURNAL_DMA_SIZE) {
+            _journal_overflow = 1;
+            return;
+        }
+        memcpy(_journal_oam[_journal_dma], _sprmem, 0x100);
+        address = _journal_dma++;
+    }
+    cycle = core_get_cycles() - _journal_base;
+    e = &_journal[_journal_count++];
+    e->cycle = (cycle > 0xFFFF) ? 0xFFFF : cycle;
+    e->type = type;
+    e->data = data;
+    e->address = address;
+    e->old = old;
+#endif
 }
 
+
 uchar ppu_get_vblank() {
     uchar ret = 0;
     if (_cr1 & 0x80) {
@@ -119,20 +282,54 @@ uchar ppu_get_vblank() {
 }
 
 void ppu_dma_write(uint8* data, size_t size) {
+    if (memcmp(_sprmem + _spr_index, data, size) != 0) {
+        ppu_journal(JOURNAL_DMA, _spr_index, 0, 0);
+        ppu_dirty_range(_dirty_oam, _spr_index, size);
+    }
     memcpy(_sprmem + _spr_index, data, size);
     _spr_index += size;
 }
 
 void ppu_set_ram(uint16 address, uint8* data, size_t size) {
+    if (memcmp(_pram + address, data, size) == 0) return;      //same bank already mapped
+    ppu_journal(JOURNAL_CHR, address, 0, 0);
     memcpy(_pram + address, data, size);
+    ppu_dirty_range(_dirty_vram, address, size);
+#if USE_BKG_CACHE
+    if (_logic) return;
+    if (address < 0x2000) ppu_bkg_mark_all();           //chr bank switch
+    for (size_t i = 0; i < size; i++) {
+        if ((address + i) >= 0x2000 && (address + i) < 0x3000) ppu_bkg_mark(_bkg_dirty, address + i);
+    }
+#endif
 }
 
 
-void ppu_set_cr1(uint8 data) { _cr1 = data; }
+void ppu_set_cr1(uint8 data) { 
+    if (_cr1 != data) ppu_journal(JOURNAL_CR1, 0, _cr1, data);
+    _cr1 = data; 
+}
+
 uchar ppu_get_cr1() { return _cr1; }
-void ppu_set_cr2(uint8 data) { _cr2 = data; }
+void ppu_set_cr2(uint8 data) { 
+    if (_cr2 != data) ppu_journal(JOURNAL_CR2, 0, _cr2, data);
+    _cr2 = data; 
+}
+
 uchar ppu_get_cr2() { return _cr2; }
-uchar hit_buffer[256 * 240];
+static uchar _hit = 0;
+static uchar _line[SCREEN_WIDTH];           //pallete values of current scanline (0 = blank)
+#if USE_JOURNAL
+static uchar _dot_line[SCREEN_WIDTH];       //scanline redrawn after a mid-line write
+#endif
+#if USE_LOWMEM
+static uint16 _line565[SCREEN_WIDTH];       //rgb565 output of current scanline
+static void (*_line_callback)(uint16 line, uint16* pixels) = NULL;
+
+void ppu_set_line_callback(void (*callback)(uint16 line, uint16* pixels)) {
+    _line_callback = callback;
+}
+#endif
 
 void ppu_set_sr(uint8 data) { _psr = data; }
 
@@ -142,13 +339,8 @@ uchar ppu_get_sr() {
     psr = _psr;
     if (_psr & 0x40) {
         _psr &= ~0x40;              //clear hit status
-    } else {
-        //check hit test
-        for (uint16 i = 0; i < 256 * 240; i++) {
-            if (hit_buffer[i] > 1) {
-                _psr |= 0x40;       //set hit status
-            }
-        }
+    } else if (_hit) {
+        _psr |= 0x40;               //set hit status from last hit test
     }
     _scroll_index = 0;
     _cur_index = 0;
@@ -157,6 +349,7 @@ uchar ppu_get_sr() {
 
 void ppu_set_scroll(uint8 data) {
     if (_scroll_index == 0) {
+        if (_hscroll != data) ppu_journal(JOURNAL_HSCROLL, 0, _hscroll, data);
         _hscroll = data;
         if (data != 0) {
             data = data;
@@ -164,6 +357,7 @@ void ppu_set_scroll(uint8 data) {
     }
     else if (_scroll_index == 1) {
         if (data <= 239) {    //skip if data > 239
+            if (_vscroll != data) ppu_journal(JOURNAL_VSCROLL, 0, _vscroll, data);
             _vscroll = data;
         }
     }
@@ -195,6 +389,10 @@ void ppu_set_mem_addr(uint8 data) {
 uchar ppu_get_mem_addr() { return _cur_index; }
 
 void ppu_set_spr_data(uint8 data) { 
+    if (_sprmem[_spr_index] != data) {
+        ppu_journal(JOURNAL_OAM, _spr_index, _sprmem[_spr_index], data);
+        DIRTY_MARK(_dirty_oam, _spr_index);
+    }
     _sprmem[_spr_index++] = data; 
 }
 
@@ -207,6 +405,16 @@ uchar ppu_get_spr_data() {
 
 void ppu_set_mem_data(uint8 data) {
     if (_cur_index >= 0x4000) return;       //skip operation
+    if (_pram[_cur_index] != data) {
+        ppu_journal(JOURNAL_VRAM, _cur_index, _pram[_cur_index], data);
+        DIRTY_MARK(_dirty_vram, _cur_index);
+#if USE_BKG_CACHE
+        if (!_logic) {
+            if (_cur_index < 0x2000) ppu_bkg_mark_all();           //chr ram
+            else if (_cur_index < 0x3000) ppu_bkg_mark(_bkg_dirty, _cur_index);
+        }
+#endif
+    }
     _pram[_cur_index] = data;
     if (_cr1 & 0x04) _cur_index += 32;      //vertical write
     else _cur_index++;
@@ -273,12 +481,12 @@ uint16 ppu_get_tablebase(uint8 table) {
     }
 }
 
-uchar ppu_get_tableattr(uint16 base, uint16 x, uint16 y) {
+uchar ppu_get_tableattr(const uint8* pram, uint16 base, uint16 x, uint16 y) {
     uchar x_index = x / 32;
     uchar y_index = y / 32;
     uchar x_offset = (x % 32) >> 3;
     uchar y_offset = (y % 32) >> 3;
-    uchar* attr_base = _pram + base + 0x3c0;
+    const uint8* attr_base = pram + base + 0x3c0;
     //attr_base[8][8]
     uchar b_attr = attr_base[((y_index * 8) + x_index) ];
     switch ((x_offset << 4) | y_offset) {
@@ -313,215 +521,736 @@ uint32 pal2col(uchar pal) {
     return _pal2col[pal & 0x3f];
 }
 
+#if USE_LOWMEM
+uint16 pal2rgb565(uchar pal) {
+    uint32 col = _pal2col[pal & 0x3f];
+    return ((col >> 8) & 0xF800) | ((col >> 5) & 0x07E0) | ((col >> 3) & 0x001F);
+}
+#endif
+
 void ppu_init(uint8 config) {
     _ppu_config = config;
+    _ppu_gen++;
+#if USE_BKG_CACHE
+    ppu_bkg_mark_all();
+#endif
+}
+
+size_t ppu_get_footprint() {
+    size_t size = sizeof(_pram) + sizeof(_sprmem) + sizeof(_line);
+#if USE_BKG_CACHE
+    size += sizeof(_bkg_plane) + sizeof(_bkg_dirty);
+#endif
+#if USE_JOURNAL
+    size += sizeof(_journal) + sizeof(_journal_oam) + sizeof(_dot_line);
+#endif
+#if USE_RENDER_THREAD
+    size += sizeof(_slot_pram) + sizeof(_slot_sprmem) + sizeof(_slot_dirty);
+#if USE_JOURNAL
+    size += sizeof(_slot_journal) + sizeof(_slot_oam);
+#endif
+#endif
+#if USE_LOWMEM
+    size += sizeof(_line565);
+#endif
+    return size;
 }
 
+typedef struct ppu_state {          //save state section, flat and fixed per build
+    uint8 pram[0x4000];
+    uint8 sprmem[0x100];
+    uint16 cur_index;
+    uint16 rd_index;
+    uint16 vscroll;
+    uint16 hscroll;
+    uint8 spr_index;
+    uint8 cr1;
+    uint8 cr2;
+    uint8 psr;
+    uint8 scroll_index;
+    uint8 ppu_config;
+    uint8 vblank;
+    uint8 hit;
+#if USE_JOURNAL
+    uint32 journal_base;            //frame in flight, kept so mid-frame states render the same
+    uint16 journal_count;
+    uint8 journal_dma;
+    uint8 journal_overflow;
+    uint8 journal_oam[JOURNAL_DMA_SIZE][0x100];
+    ppu_event journal[JOURNAL_SIZE];
+#endif
+} ppu_state;
+
+void ppu_dirty_config(uint8 shift) {
+    _dirty_shift = shift;
+    ppu_dirty_range(_dirty_vram, 0, sizeof(_pram));
+    ppu_dirty_range(_dirty_oam, 0, sizeof(_sprmem));
+}
+
+uint32 ppu_dirty_get(uint8 oam, uint64* bitmap, uchar clear) {
+    //vram or oam pages modified since the last clear, returns page count
+    uint64* map = oam ? _dirty_oam : _dirty_vram;
+    uint32 size = oam ? sizeof(_sprmem) : sizeof(_pram);
+    uint32 words;
+    size = (size + (1 << _dirty_shift) - 1) >> _dirty_shift;
+    words = (size + 63) / 64;
+    if (bitmap != NULL) memcpy(bitmap, map, words * sizeof(uint64));
+    if (clear) memset(map, 0, words * sizeof(uint64));
+    return size;
+}
 
-void ppu_render(uchar* vbuffer) {
-    uint32* output = (uint32*)vbuffer;
-    uint16 y_index, y_offset;
-    uint16 x_index, x_offset;
-    uint8 spr_width = 8;
-    uint8 spr_size = (_cr1 & 0x20) ?32 : 16;
-    uint8 spr_height = (_cr1 & 0x20) ? 16 : 8;
-    uint32 bkg_color = default_bkgcolor[_cr2 >> 5];
-    uint8 spr_en = (_cr2 & 0x10) ? 1 : 0;
-    uint8 nm_table = 0;
-    uint16 table_base;
-    uint16 spr_index;
-    uchar attr;
+uint8* ppu_dirty_memory(uint8 oam, uint32* size) {
+    *size = oam ? sizeof(_sprmem) : sizeof(_pram);
+    return oam ? _sprmem : _pram;
+}
+
+size_t ppu_get_regs(uchar* buffer) {
+    //registers in a fixed order, 16 bytes
+    uchar* ptr = buffer;
+    memcpy(ptr, &_cur_index, 2); ptr += 2;
+    memcpy(ptr, &_rd_index, 2); ptr += 2;
+    memcpy(ptr, &_vscroll, 2); ptr += 2;
+    memcpy(ptr, &_hscroll, 2); ptr += 2;
+    *ptr++ = _spr_index;
+    *ptr++ = _cr1;
+    *ptr++ = _cr2;
+    *ptr++ = _psr;
+    *ptr++ = _scroll_index;
+    *ptr++ = _ppu_config;
+    *ptr++ = _vblank;
+    *ptr++ = _hit;
+    return ptr - buffer;
+}
+
+size_t ppu_state_size() {
+    return sizeof(ppu_state);
+}
+
+void ppu_save_state(void* buffer) {
+    ppu_state* s = (ppu_state*)buffer;
+    memcpy(s->pram, _pram, sizeof(_pram));
+    memcpy(s->sprmem, _sprmem, sizeof(_sprmem));
+    s->cur_index = _cur_index;
+    s->rd_index = _rd_index;
+    s->vscroll = _vscroll;
+    s->hscroll = _hscroll;
+    s->spr_index = _spr_index;
+    s->cr1 = _cr1;
+    s->cr2 = _cr2;
+    s->psr = _psr;
+    s->scroll_index = _scroll_index;
+    s->ppu_config = _ppu_config;
+    s->vblank = _vblank;
+    s->hit = _hit;
+#if USE_JOURNAL
+    s->journal_base = _journal_base;
+    s->journal_count = _journal_count;
+    s->journal_dma = _journal_dma;
+    s->journal_overflow = _journal_overflow;
+    memcpy(s->journal_oam, _journal_oam, _journal_dma * 0x100);
+    if (_journal_count) memcpy(s->journal, _journal, _journal_count * sizeof(ppu_event));
+    //unused tail zeroed, equal machines give equal bytes for deltas and page dedup
+    memset(s->journal_oam[_journal_dma], 0, (JOURNAL_DMA_SIZE - _journal_dma) * 0x100);
+    memset(s->journal + _journal_count, 0, (JOURNAL_SIZE - _journal_count) * sizeof(ppu_event));
+#endif
+}
+
+void ppu_load_state(const void* buffer) {
+    const ppu_state* s = (const ppu_state*)buffer;
+#if USE_RENDER_THREAD
+    if (_worker_enable) ppu_worker_wait();
+#endif
+    memcpy(_pram, s->pram, sizeof(_pram));
+    memcpy(_sprmem, s->sprmem, sizeof(_sprmem));
+    _cur_index = s->cur_index;
+    _rd_index = s->rd_index;
+    _vscroll = s->vscroll;
+    _hscroll = s->hscroll;
+    _spr_index = s->spr_index;
+    _cr1 = s->cr1;
+    _cr2 = s->cr2;
+    _psr = s->psr;
+    _scroll_index = s->scroll_index;
+    _ppu_config = s->ppu_config;
+    _vblank = s->vblank;
+    _hit = s->hit;
+#if USE_JOURNAL
+    _journal_base = s->journal_base;
+    _journal_count = (s->journal_count > JOURNAL_SIZE) ? JOURNAL_SIZE : s->journal_count;
+    _journal_dma = (s->journal_dma > JOURNAL_DMA_SIZE) ? JOURNAL_DMA_SIZE : s->journal_dma;
+    _journal_overflow = s->journal_overflow;
+    memcpy(_journal_oam, s->journal_oam, _journal_dma * 0x100);
+    if (_journal_count) memcpy(_journal, s->journal, _journal_count * sizeof(ppu_event));
+#endif
+    _ppu_gen++;
+    _render_gen = 0;                //output no longer matches render input
+    ppu_dirty_range(_dirty_vram, 0, sizeof(_pram));
+    ppu_dirty_range(_dirty_oam, 0, sizeof(_sprmem));
+#if USE_BKG_CACHE
+    ppu_bkg_mark_all();
+#endif
+}
+
+__forceinline uchar ppu_sprite_pixel(const ppu_frame* f, uint8 k, uint16 j, uint16 i, uint8 spr_height) {
+    //pallete value of sprite k at row j, column i (0 = transparent)
+    uchar attr = f->sprmem[k + 2];
+    uint16 p_index = f->sprmem[k + 1];     //tile index
+    uint16 sprite_pattern_base = (f->cr1 & 0x08) ? 0x1000 : 0x0000;
+    uint16 y_offset;
     uchar spr_offset;
-    uchar pattern0;
-    uchar pattern1;
     uchar pallete_index = 0;
-    uchar pallete;
-    uint16 p_index;
-    int v_index;
-    uchar x, y;
-    uint16 screen_pattern_base = 0x0000;
-    uint16 sprite_pattern_base = 0x0000;
-    if (_cr1 & 0x10)screen_pattern_base = 0x1000;
-    if (_cr1 & 0x08)sprite_pattern_base = 0x1000;           //default sprite pattern table
-    if (_cr1 & 0x01) _hscroll |= 0x100;
-    else _hscroll &= ~0x100;
-    if (_cr1 & 0x02) _vscroll |= 0x100;
-    else _vscroll &= ~0x100;
-    //render background first
-    uint32 bkgcolor = pal2col(_pram[0x3f00]);
-    //_psr &= ~0x40;              //clear hit status
-    memset(hit_buffer, 0, sizeof(hit_buffer));
-    memset(output, 0, DISP_WIDTH * DISP_HEIGHT * sizeof(uint32));
-    
-    _pram[0x3f10] = _pram[0x3f00];
-    _pram[0x3f0c] = _pram[0x3f08] = _pram[0x3f04] = _pram[0x3f00];
-    _pram[0x3f1c] = _pram[0x3f18] = _pram[0x3f14] = _pram[0x3f10];
+    if (f->cr1 & 0x20) {          //8x16 pixel
+        sprite_pattern_base = (p_index & 0x01) ? 0x1000 : 0x0000;
+    }
+    if (attr & 0x80) y_offset = (spr_height - (j + 1));      //flip vertical
+    else y_offset = j;              //normal vertical
+    if (attr & 0x40) spr_offset = i;            //flip horizontal
+    else spr_offset = 7 - i;                    //normal horizontal
+    uchar pattern0 = f->pram[sprite_pattern_base + (p_index * 16) + y_offset];
+    uchar pattern1 = f->pram[sprite_pattern_base + (p_index * 16) + y_offset + 8];      //[p0:8][p1:8]
+    if (pattern0 & (1 << spr_offset)) pallete_index |= 0x01;        //bit 0
+    if (pattern1 & (1 << spr_offset)) pallete_index |= 0x02;        //bit 1
+    if (pallete_index == 0) return 0;
+    return f->pram[0x3f10 + ((attr & 0x03) << 2) + pallete_index];           //locate color pallete on image pallete (0x3f10)
+}
 
-    //render oam background
-    for (uint16 k = 0; k < 256; k += 4) {
-        y = _sprmem[k];                 //y location
-        p_index = _sprmem[k + 1];     //tile index
-        x = _sprmem[k + 3];               //x location
-        attr = _sprmem[k + 2];     //tile index
-        if ((attr & 0x20) == 0) continue;                //render only foreground
-        if (spr_size == 32) {       //8x16 pixel
-            sprite_pattern_base = (_sprmem[k + 1] & 0x01) ? 0x1000 : 0x0000;
+__forceinline uchar ppu_bkg_index(const ppu_frame* f, uint16 i, uint16 j, uint16 screen_pattern_base) {
+    //pallete index (attr << 2 | pattern) of nametable pixel (i, j) in scrolled coordinates
+    uint16 table_base = ppu_get_tablebase(ppu_get_nametable(i % 512, j % 480));
+    uchar spr_index = f->pram[table_base + (((j / 8) % 30) * 32) + ((i / 8) % 32)];
+    uchar spr_offset = 7 - (i % 8);
+    uchar attr = ppu_get_tableattr(f->pram, table_base, i % 256, j % 240);
+    uint16 p_index = (spr_index * 16) + (j % 8);          //pattern index
+    uchar pattern0 = f->pram[screen_pattern_base + p_index];
+    uchar pattern1 = f->pram[screen_pattern_base + p_index + 8];      //[p0:8][p1:8]
+    uchar pallete_index = 0;
+    if (pattern0 & (1 << spr_offset)) pallete_index |= 0x01;        //bit 0
+    if (pattern1 & (1 << spr_offset)) pallete_index |= 0x02;        //bit 1
+    return (attr << 2) + pallete_index;
+}
+
+__forceinline uchar ppu_bkg_pixel(const ppu_frame* f, uint16 i, uint16 j, uint16 screen_pattern_base) {
+    //pallete value of nametable pixel (i, j) in scrolled coordinates
+    return f->pram[0x3f00 + ppu_bkg_index(f, i, j, screen_pattern_base)];
+}
+
+#if USE_BKG_CACHE
+void ppu_bkg_mark_all() {
+    memset(_bkg_dirty, 0xFF, sizeof(_bkg_dirty));
+}
+
+void ppu_bkg_mark(uint64* dirty, uint16 address) {
+    //resolve mirroring once per write, mark every plane tile showing this byte
+    uint16 base = address & 0x2C00;
+    uint16 offset = address & 0x3FF;
+    uint16 tx, ty, attr_x, attr_y;
+    for (uchar table = 0; table < 4; table++) {
+        if (ppu_get_tablebase(table) != base) continue;
+        tx = (table & 0x01) ? 32 : 0;
+        ty = (table & 0x02) ? 30 : 0;
+        if (offset < 0x3c0) {
+            dirty[ty + (offset / 32)] |= (uint64)1 << (tx + (offset % 32));
+            //first scanline of the lower tables is fetched from the upper ones
+            if (ty == 0 && offset < 32) dirty[30] |= (uint64)1 << (tx + offset);
+            continue;
         }
-        //p_index >>= 1;
-
-        for (uint16 j = 0; j < spr_height; j++) {     //height 1 tile (8) or 2 tile (16)
-            if (attr & 0x80) y_offset = (spr_height - (j + 1));      //flip vertical
-            else y_offset = j;              //normal vertical
-            y_index = (j / spr_height) % 30;
-            for (uint16 i = 0; i < 8; i++) {        //width always 8
-                if (attr & 0x40) spr_offset = (i % 8);      //flip horizontal
-                else spr_offset = 7 - (i % 8);              //normal horizontal
-                //p_index = (spr_index * spr_size) + y_offset;          //pattern index
-                pattern0 = _pram[sprite_pattern_base + (p_index * 16) + y_offset];
-                pattern1 = _pram[sprite_pattern_base + (p_index * 16) + y_offset + 8];      //[p0:8][p1:8]
-                pallete_index = 0;
-                if (pattern0 & (1 << spr_offset)) pallete_index |= 0x01;        //bit 0
-                if (pattern1 & (1 << spr_offset)) pallete_index |= 0x02;        //bit 1
-
-                if (pallete_index == 0) continue;
-                pallete = _pram[0x3f10 + ((attr & 0x03) << 2) + pallete_index];           //locate color pallete on image pallete (0x3f10)
-                if (pallete == 0) continue;
-                if (pallete != 0) {
-                    hit_buffer[(j * 256) + i] = hit_buffer[(j * 256) + i] + 1;
-                }
-                v_index = (((y + j) * DISP_WIDTH) + (i + x));
-                v_index *= 2;
-                //v_index += (i - _hscroll) * 2;
-                output[v_index] = pal2col(pallete);
-                output[v_index + 1] = pal2col(pallete);
-                output[v_index + DISP_WIDTH] = pal2col(pallete);
-                output[v_index + DISP_WIDTH + 1] = pal2col(pallete);
+        attr_x = ((offset - 0x3c0) % 8) * 4;
+        attr_y = ((offset - 0x3c0) / 8) * 4;
+        for (uint16 y = attr_y; y < (attr_y + 4) && y < 30; y++) {
+            dirty[ty + y] |= (uint64)0x0F << (tx + attr_x);
+            if (ty == 0 && y == 0) dirty[30] |= (uint64)0x0F << (tx + attr_x);
+        }
+    }
+}
 
+void ppu_bkg_draw_tile(const ppu_frame* f, uint16 tx, uint16 ty, uint16 screen_pattern_base) {
+    uint16 px = tx * 8;
+    uint16 py = ty * 8;
+    if (ty == 30) {
+        //tile row straddling the upper and lower tables, resolve per pixel
+        for (uint16 j = py; j < (py + 8); j++) {
+            for (uint16 i = px; i < (px + 8); i++) {
+                _bkg_plane[j][i] = ppu_bkg_index(f, i, j, screen_pattern_base);
             }
         }
+        return;
     }
-    uint8 prev_nmtable;
-    //start rendering nametables (background)
-    for (uint16 j = _vscroll; j < (_vscroll + 240); j++) {
-        y = ((j - _vscroll) % 240);
-        y_offset = (j % 8);
-        y_index = (j / 8) % 30;
-        if (_vscroll != 0) {
-            y = y;
+    uint16 table_base = ppu_get_tablebase(((tx >= 32) ? 1 : 0) | ((ty >= 30) ? 2 : 0));
+    uint16 col = tx % 32;
+    uint16 row = ty % 30;
+    uchar spr_index = f->pram[table_base + (row * 32) + col];
+    uchar attr = ppu_get_tableattr(f->pram, table_base, col * 8, row * 8) << 2;
+    uchar pattern0, pattern1;
+    uint8* plane;
+    for (uint16 j = 0; j < 8; j++) {
+        pattern0 = f->pram[screen_pattern_base + (spr_index * 16) + j];
+        pattern1 = f->pram[screen_pattern_base + (spr_index * 16) + j + 8];      //[p0:8][p1:8]
+        plane = &_bkg_plane[py + j][px];
+        for (uint16 i = 0; i < 8; i++) {
+            plane[i] = attr | ((pattern0 >> (7 - i)) & 0x01) | (((pattern1 >> (7 - i)) & 0x01) << 1);
         }
-        prev_nmtable = 0;
-        for (uint16 i = _hscroll; i < (_hscroll + 256); i++) {
-            x = ((i - _hscroll) % 256);
-            x_offset = i % spr_width;
-            x_index = (i / spr_width) % 32;
-            nm_table = ppu_get_nametable(i % 512, j % 480);
-            table_base = ppu_get_tablebase(nm_table);
-            if (nm_table == 1) {
-                y = y;
-                prev_nmtable = nm_table;
-            }
-            spr_index = _pram[ table_base + (y_index * 32) + x_index];
-            spr_offset = 7 - (i % 8);
-            //spr_index = 0;
-            ///attr = ppu_get_tableattr(table_base, x_index, y_index);     //index of nametable
-            attr = ppu_get_tableattr(table_base, i % 256, j %240);
-            //attr = 1;
-            
-            p_index = (spr_index * 16) + y_offset;          //pattern index
-            pattern0 = _pram[screen_pattern_base + p_index];
-            pattern1 = _pram[screen_pattern_base + p_index + 8] ;      //[p0:8][p1:8]
-            pallete_index = 0;
-            if (pattern0 & (1 << spr_offset)) pallete_index |= 0x01;        //bit 0
-            if (pattern1 & (1 << spr_offset)) pallete_index |= 0x02;        //bit 1
-            
-            pallete = _pram[0x3f00 + (attr << 2) + pallete_index ];           //locate color pallete on image pallete (0x3f10)
-            if (pallete == 0) continue;
-            //upscale 2x
-            if (pallete != 0) {
-                hit_buffer[(y * 256) + x] = hit_buffer[(y * 256) + x] + 1;
-            }
-            v_index = (y * DISP_WIDTH) + x;
-            v_index *= 2;
-            //v_index += (i - _hscroll) * 2;
-            output[v_index] = pal2col(pallete);
-            output[v_index + 1] = pal2col(pallete);
-            output[v_index + DISP_WIDTH] = pal2col(pallete);
-            output[v_index + DISP_WIDTH + 1] = pal2col(pallete);
-            
-            //printf("%02X ", spr_offset);
+    }
+}
+
+void ppu_bkg_update(ppu_frame* f) {
+    uint16 screen_pattern_base = (f->cr1 & 0x10) ? 0x1000 : 0x0000;
+    uint64 dirty;
+    if (screen_pattern_base != _bkg_pattern_base) {
+        _bkg_pattern_base = screen_pattern_base;
+        memset(f->bkg_dirty, 0xFF, sizeof(_bkg_dirty));
+    }
+    for (uint16 ty = 0; ty < PLANE_TILES_Y; ty++) {
+        dirty = f->bkg_dirty[ty];
+        if (dirty == 0) continue;
+        for (uint16 tx = 0; tx < PLANE_TILES_X; tx++) {
+            if (dirty & ((uint64)1 << tx)) ppu_bkg_draw_tile(f, tx, ty, screen_pattern_base);
         }
-        //printf("\r\n");
+        f->bkg_dirty[ty] = 0;
     }
-    
-    //render oam foreground
+}
+#endif
+
+void ppu_render_sprites(const ppu_frame* f, uint16 line, uchar* pixels, uchar priority) {
+    uint8 spr_height = (f->cr1 & 0x20) ? 16 : 8;
+    uint16 x, y, j;
+    uchar pallete;
     for (uint16 k = 0; k < 256; k += 4) {
-        y = _sprmem[k];                 //y location
-        p_index = _sprmem[k + 1];     //tile index
-        x = _sprmem[k + 3];               //x location
-        attr = _sprmem[k + 2];     //tile index
-        if ((attr & 0x20)) continue;                //render only foreground
-        if (spr_size == 32) {       //8x16 pixel
-            sprite_pattern_base = (_sprmem[k + 1] & 0x01) ? 0x1000 : 0x0000;
+        if ((f->sprmem[k + 2] & 0x20) != priority) continue;
+        y = f->sprmem[k];                 //y location
+        if (line < y) continue;
+        j = line - y;
+        if (j >= spr_height) continue;
+        x = f->sprmem[k + 3];             //x location
+        for (uint16 i = 0; i < 8 && (x + i) < SCREEN_WIDTH; i++) {        //width always 8
+            pallete = ppu_sprite_pixel(f, k, j, i, spr_height);
+            if (pallete == 0) continue;
+            pixels[x + i] = pallete;
         }
-        //p_index >>= 1;
-
-        for (uint16 j = 0; j < spr_height; j++) {     //height 1 tile (8) or 2 tile (16)
-            if (attr & 0x80) y_offset = (spr_height - (j + 1));      //flip vertical
-            else y_offset = j;              //normal vertical
-            y_index = (j  / spr_height) % 30;
-            for (uint16 i = 0; i < 8; i++) {        //width always 8
-                if(attr & 0x40) spr_offset = (i % 8);           //flip horizontal
-                else spr_offset = 7 - (i % 8);              //normal horizontal
-                //p_index = (spr_index * spr_size) + y_offset;          //pattern index
-                pattern0 = _pram[sprite_pattern_base + (p_index*16) + y_offset];
-                pattern1 = _pram[sprite_pattern_base + (p_index*16) + y_offset + 8];      //[p0:8][p1:8]
-                pallete_index = 0;
-                if (pattern0 & (1 << spr_offset)) pallete_index |= 0x01;        //bit 0
-                if (pattern1 & (1 << spr_offset)) pallete_index |= 0x02;        //bit 1
-
-                if (pallete_index == 0) continue;
-                pallete = _pram[0x3f10 + ((attr & 0x03) << 2) + pallete_index];           //locate color pallete on image pallete (0x3f10)
-                if (pallete == 0) continue;
-                if (pallete != 0) {
-                    hit_buffer[(j * 256) + i] = hit_buffer[(j * 256) + i] + 1;
-                }
-                if (pallete_index > 0) {
-                    y = y;
-                }
-                v_index = (((y + j)  * DISP_WIDTH) + (i + x));
-                v_index *= 2;
-                //v_index += (i - _hscroll) * 2;
-                output[v_index] = pal2col(pallete);
-                output[v_index + 1] = pal2col(pallete);
-                output[v_index + DISP_WIDTH] = pal2col(pallete);
-                output[v_index + DISP_WIDTH + 1] = pal2col(pallete);
+    }
+}
 
-            }
+void ppu_render_bkg(const ppu_frame* f, uint16 line, uchar* pixels) {
+    uchar pallete;
+#if USE_BKG_CACHE
+    //wrapped copy out of the prerendered plane
+    uint8* plane = _bkg_plane[(f->vscroll + line) % PLANE_HEIGHT];
+    uint16 i = f->hscroll % PLANE_WIDTH;
+    for (uint16 x = 0; x < SCREEN_WIDTH; x++, i = (i + 1) & (PLANE_WIDTH - 1)) {
+        pallete = f->pram[0x3f00 + plane[i]];
+        if (pallete == 0) continue;
+        pixels[x] = pallete;
+    }
+#else
+    uint16 screen_pattern_base = (f->cr1 & 0x10) ? 0x1000 : 0x0000;
+    uint16 j = f->vscroll + line;
+    for (uint16 x = 0; x < SCREEN_WIDTH; x++) {
+        pallete = ppu_bkg_pixel(f, f->hscroll + x, j, screen_pattern_base);
+        if (pallete == 0) continue;
+        pixels[x] = pallete;
+    }
+#endif
+}
+
+void ppu_render_line(const ppu_frame* f, uint16 line, uchar* pixels) {
+    memset(pixels, 0, SCREEN_WIDTH);
+    ppu_render_sprites(f, line, pixels, 0x20);         //oam background
+    ppu_render_bkg(f, line, pixels);                   //nametables
+    ppu_render_sprites(f, line, pixels, 0x00);         //oam foreground
+}
+
+__forceinline uchar ppu_sprite_row(const ppu_frame* f, uint8 k, uint16 j, uint8 spr_height) {
+    //opaque pixels of sprite k at row j as ppu_sprite_pixel sees them, column 0 in bit 7
+    uchar attr = f->sprmem[k + 2];
+    uint16 p_index = f->sprmem[k + 1];
+    uint16 sprite_pattern_base = (f->cr1 & 0x08) ? 0x1000 : 0x0000;
+    uint16 y_offset = (attr & 0x80) ? (spr_height - (j + 1)) : j;
+    const uint8* pal = f->pram + 0x3f10 + ((attr & 0x03) << 2);
+    uchar pattern0, pattern1, row = 0;
+    if (f->cr1 & 0x20) sprite_pattern_base = (p_index & 0x01) ? 0x1000 : 0x0000;
+    pattern0 = f->pram[sprite_pattern_base + (p_index * 16) + y_offset];
+    pattern1 = f->pram[sprite_pattern_base + (p_index * 16) + y_offset + 8];
+    if (pal[1]) row |= pattern0 & ~pattern1;
+    if (pal[2]) row |= ~pattern0 & pattern1;
+    if (pal[3]) row |= pattern0 & pattern1;
+    if (attr & 0x40) {
+        //flip horizontal
+        row = (row >> 4) | (row << 4);
+        row = ((row & 0xCC) >> 2) | ((row & 0x33) << 2);
+        row = ((row & 0xAA) >> 1) | ((row & 0x55) << 1);
+    }
+    return row;
+}
+
+void ppu_hit_test(const ppu_frame* f) {
+    //sprite pixels accumulate on sprite relative coordinates, nametable only overlaps the top-left corner
+    //a hit is a pixel opaque in two of them, rows of 8 pixels as bit masks
+    uint8 spr_height = (f->cr1 & 0x20) ? 16 : 8;
+    uint16 screen_pattern_base = (f->cr1 & 0x10) ? 0x1000 : 0x0000;
+    uchar seen[HIT_HEIGHT];
+    uchar twice = 0, row;
+    memset(seen, 0, sizeof(seen));
+    for (uint16 k = 0; k < 256 && !twice; k += 4) {
+        for (uint16 j = 0; j < spr_height; j++) {
+            row = ppu_sprite_row(f, k, j, spr_height);
+            twice |= seen[j] & row;
+            seen[j] |= row;
+        }
+    }
+    for (uint16 j = 0; j < HIT_HEIGHT && !twice; j++) {
+        for (uint16 i = 0; i < 8; i++) {
+            if ((seen[j] & (0x80 >> i)) && ppu_bkg_pixel(f, f->hscroll + i, f->vscroll + j, screen_pattern_base) != 0) twice = 1;
         }
     }
+    _hit = (twice != 0);
+}
 
-    //hit test
-    for (uint16 i = 0; i < 256 * 240; i++) {
-        if (hit_buffer[i] > 1) {
-            _psr |= 0x40;       //set hit status
+#if USE_JOURNAL
+__forceinline int16 ppu_event_line(const ppu_event* e) {
+    //scanline being drawn at the time of the write, vblank and pre-render line come first
+    return (((int32)e->cycle * 3) / 341) - 21;
+}
+
+__forceinline uint16 ppu_event_dot(const ppu_event* e) {
+    //dot within the scanline, pixels from here on see the write
+    return ((uint32)e->cycle * 3) % 341;
+}
+
+void ppu_journal_latch(ppu_frame* f) {
+    //derived state the renderer latches once per frame, redone whenever a replay step changes it
+    f->hscroll = (f->hscroll & 0xFF) | ((f->cr1 & 0x01) << 8);
+    f->vscroll = (f->vscroll & 0xFF) | ((f->cr1 & 0x02) << 7);
+    f->pram[0x3f10] = f->pram[0x3f00];
+    f->pram[0x3f0c] = f->pram[0x3f08] = f->pram[0x3f04] = f->pram[0x3f00];
+    f->pram[0x3f1c] = f->pram[0x3f18] = f->pram[0x3f14] = f->pram[0x3f10];
+}
+
+void ppu_journal_apply(ppu_frame* f, ppu_event* e, uchar redo) {
+    uint8 temp[0x100];
+    switch (e->type) {
+    case JOURNAL_CR1: f->cr1 = redo ? e->data : e->old; break;
+    case JOURNAL_CR2: f->cr2 = redo ? e->data : e->old; break;
+    case JOURNAL_HSCROLL: f->hscroll = redo ? e->data : e->old; break;
+    case JOURNAL_VSCROLL: f->vscroll = redo ? e->data : e->old; break;
+    case JOURNAL_OAM: f->sprmem[e->address] = redo ? e->data : e->old; break;
+    case JOURNAL_VRAM:
+        f->pram[e->address] = redo ? e->data : e->old;
+#if USE_BKG_CACHE
+        if (e->address < 0x2000) memset(f->bkg_dirty, 0xFF, sizeof(_bkg_dirty));
+        else if (e->address < 0x3000) ppu_bkg_mark(f->bkg_dirty, e->address);
+#endif
+        break;
+    case JOURNAL_DMA:
+        //swap is its own inverse
+        memcpy(temp, f->sprmem, 0x100);
+        memcpy(f->sprmem, f->oam[e->address], 0x100);
+        memcpy(f->oam[e->address], temp, 0x100);
+        break;
+    }
+}
+#endif
+
+#if USE_JOURNAL
+void ppu_render_dots(ppu_frame* f, uint16 line, uint16* e) {
+    //split the scanline at each write landing inside it
+    uint16 dot;
+    ppu_render_line(f, line, _line);
+    while (*e < f->count && ppu_event_line(&f->events[*e]) == (int16)line) {
+        dot = ppu_event_dot(&f->events[*e]);
+        if (dot >= SCREEN_WIDTH) break;         //hblank, applied before the next scanline
+        while (*e < f->count && ppu_event_line(&f->events[*e]) == (int16)line && ppu_event_dot(&f->events[*e]) == dot) {
+            ppu_journal_apply(f, &f->events[(*e)++], 1);
+        }
+        ppu_journal_latch(f);
+#if USE_BKG_CACHE
+        ppu_bkg_update(f);
+#endif
+        ppu_render_line(f, line, _dot_line);
+        memcpy(_line + dot, _dot_line + dot, SCREEN_WIDTH - dot);
+    }
+}
+#endif
+
+//the core ends a frame and draws it at ins_counter % 4057, about 85 lines into the visible
+//area and not at vblank. journaled writes up to that point are replayed on their lines, the
+//ones after it are never replayed: they are in the state the next frame starts from and show
+//from its top line instead of the line they were written on
+template<uchar profile> void ppu_draw(ppu_frame* f, uchar* vbuffer) {
+#if !USE_LOWMEM
+    uint32* output;
+    uint32 color;
+#endif
+#if USE_JOURNAL
+    uint16 e = f->count;
+    if (profile != PPU_PROFILE_FRAME) {
+        //rewind writes that landed inside the visible area, replayed as the scanlines pass
+        while (e > 0 && ppu_event_line(&f->events[e - 1]) >= 0) ppu_journal_apply(f, &f->events[--e], 0);
+        if (e < f->count) ppu_journal_latch(f);
+    }
+#endif
+#if USE_BKG_CACHE
+    ppu_bkg_update(f);
+#endif
+    for (uint16 y = 0; y < SCREEN_HEIGHT; y++) {
+#if USE_JOURNAL
+        if (profile != PPU_PROFILE_FRAME && e < f->count && ppu_event_line(&f->events[e]) < (int16)y) {
+            while (e < f->count && ppu_event_line(&f->events[e]) < (int16)y) ppu_journal_apply(f, &f->events[e++], 1);
+            ppu_journal_latch(f);
+#if USE_BKG_CACHE
+            ppu_bkg_update(f);
+#endif
+        }
+        if (profile == PPU_PROFILE_DOT && e < f->count && ppu_event_line(&f->events[e]) == (int16)y) ppu_render_dots(f, y, &e);
+        else
+#endif
+        ppu_render_line(f, y, _line);
+#if USE_LOWMEM
+        //stream scanline, no frame buffer
+        if (_line_callback == NULL) continue;
+        for (uint16 x = 0; x < SCREEN_WIDTH; x++) {
+            _line565[x] = (_line[x] == 0) ? 0 : pal2rgb565(_line[x]);
         }
+        _line_callback(y, _line565);
+#else
+        //upscale 2x
+        output = (uint32*)vbuffer + (y * 2 * DISP_WIDTH);
+        for (uint16 x = 0; x < SCREEN_WIDTH; x++) {
+            color = (_line[x] == 0) ? 0 : pal2col(_line[x]);
+            output[x * 2] = color;
+            output[(x * 2) + 1] = color;
+            output[DISP_WIDTH + (x * 2)] = color;
+            output[DISP_WIDTH + (x * 2) + 1] = color;
+        }
+#endif
     }
+#if USE_JOURNAL
+    if (profile == PPU_PROFILE_FRAME || f->count == 0) return;
+    while (e < f->count) ppu_journal_apply(f, &f->events[e++], 1);
+    ppu_journal_latch(f);
+#if USE_BKG_CACHE
+    ppu_bkg_update(f);          //plane back to final state
+#endif
+#endif
+}
 
+static void (*_ppu_draw)(ppu_frame* f, uchar* vbuffer) = ppu_draw<PPU_PROFILE_FRAME>;
 
-    /*
-    printf("attrs\r\n");
-    table_base = 0x2000;
-    for (uint16 i = table_base + 0x3c0; i < table_base + 0x400; i++) {
-        printf("%02X ", _pram[i]);
+void ppu_set_profile(uchar profile) {
+    //select the renderer specialized for an accuracy level, set up once before running.
+    //the dot profile is not a ppu clocked one dot per tick: lines are still drawn whole by
+    //the scanline renderer, a line with writes on it is redrawn from each write's dot onward
+#if !USE_JOURNAL
+    profile = PPU_PROFILE_FRAME;           //no journal to replay
+#endif
+#if USE_RENDER_THREAD
+    if (_worker_enable) ppu_worker_wait();  //the worker draws through _ppu_draw
+#endif
+    switch (profile) {
+    case PPU_PROFILE_SCANLINE: _ppu_draw = ppu_draw<PPU_PROFILE_SCANLINE>; break;
+    case PPU_PROFILE_DOT: _ppu_draw = ppu_draw<PPU_PROFILE_DOT>; break;
+    default: profile = PPU_PROFILE_FRAME; _ppu_draw = ppu_draw<PPU_PROFILE_FRAME>; break;
     }
-    printf("=====\r\n");
+    _profile = profile;
+    _ppu_gen++;
+}
+
+uchar ppu_get_profile() { return _profile; }
 
-    printf("palletes\r\n");
-    printf("%02X %02X %02X %02X\r\n", _pram[0x3f00], _pram[0x3f01], _pram[0x3f02], _pram[0x3f03]);
-    printf("%02X %02X %02X %02X\r\n", _pram[0x3f04], _pram[0x3f05], _pram[0x3f06], _pram[0x3f07]);
-    printf("%02X %02X %02X %02X\r\n", _pram[0x3f08], _pram[0x3f09], _pram[0x3f0A], _pram[0x3f0B]);
-    printf("%02X %02X %02X %02X\r\n", _pram[0x3f0C], _pram[0x3f0D], _pram[0x3f0E], _pram[0x3f0F]);
-    printf("=====\r\n");
-    */
-    //start rendering sprites
-}
\ No newline at end of file
+#if USE_RENDER_THREAD
+void ppu_worker() {
+    std::unique_lock<std::mutex> lock(_worker_lock);
+    while (!_worker_quit) {
+        if (_worker_frame == NULL) {
+            _worker_cond.wait(lock);
+            continue;
+        }
+        lock.unlock();
+        _ppu_draw(_worker_frame, _worker_buffer);
+        lock.lock();
+        _worker_frame = NULL;
+        _worker_drawn = 1;
+        _worker_cond.notify_all();
+    }
+}
+
+void ppu_worker_wait() {
+    std::unique_lock<std::mutex> lock(_worker_lock);
+    while (_worker_frame != NULL) _worker_cond.wait(lock);
+}
+
+uchar ppu_set_pipeline(uchar enable) {
+    //render on a worker thread, one frame behind the cpu, returns the mode now in effect.
+    //the host turns it off before exit, the worker is joined there
+    if (enable == _worker_enable) return enable;
+    if (enable) {
+        _worker_quit = 0;
+        _worker_drawn = 0;
+        _pending_frame = NULL;
+        _worker = std::thread(ppu_worker);
+    } else {
+        ppu_worker_wait();
+        _worker_lock.lock();
+        _worker_quit = 1;
+        _worker_lock.unlock();
+        _worker_cond.notify_all();
+        _worker.join();
+        _render_gen = 0;            //force redraw of pending snapshot
+#if USE_BKG_CACHE
+        ppu_bkg_mark_all();         //dirty tiles of an undrawn snapshot are lost
+#endif
+    }
+    _worker_enable = enable;
+    return enable;
+}
+#else
+uchar ppu_set_pipeline(uchar enable) {
+    return 0;                   //no render thread in this build
+}
+#endif
+
+void ppu_fork_prepare() {
+    //no snapshot in flight while the process is duplicated
+#if USE_RENDER_THREAD
+    if (_worker_enable) ppu_worker_wait();
+#endif
+}
+
+void ppu_fork_child() {
+    //only the forking thread exists in the child, drop the worker and render synchronously
+#if USE_RENDER_THREAD
+    if (!_worker_enable) return;
+    new (&_worker) std::thread();               //handle of a thread that is not ours, never joined
+    new (&_worker_lock) std::mutex();           //may have been held by the worker at fork
+    new (&_worker_cond) std::condition_variable();
+    _worker_enable = 0;
+    _worker_frame = NULL;
+    _pending_frame = NULL;
+    _render_gen = 0;
+#if USE_BKG_CACHE
+    ppu_bkg_mark_all();
+#endif
+#endif
+}
+
+void ppu_render_begin() {
+#if USE_RENDER_THREAD
+    //start drawing the snapshot taken at last frame end, host is done with the output by now
+    if (_pending_frame == NULL) return;
+    _worker_lock.lock();
+    _worker_frame = _pending_frame;
+    _pending_frame = NULL;
+    _worker_lock.unlock();
+    _worker_cond.notify_all();
+#endif
+}
+
+void ppu_set_video(uchar enable) {
+    _video = enable;
+}
+
+void ppu_set_logic(uchar enable) {
+    //frames keep only what the cpu can read: status flags, sprite 0 hit, oam and vram through $2004/$2007.
+    //nothing is drawn and no render input is tracked (journal, background cache), the first frame
+    //after the mode is left is drawn whole from the final state. per process, a clone sets its own
+    if (enable == _logic) return;
+#if USE_RENDER_THREAD
+    if (_worker_enable) ppu_worker_wait();
+#endif
+    _logic = enable;
+    if (enable) return;
+    _render_gen = 0;
+#if USE_JOURNAL
+    _journal_overflow = 1;
+#endif
+#if USE_BKG_CACHE
+    ppu_bkg_mark_all();
+#endif
+}
+
+uint32 ppu_get_skip_count() {
+    return _skip_count;
+}
+
+uchar ppu_render(uchar* vbuffer) {
+    uchar ret = 0;
+    ppu_frame frame = { _pram, _sprmem, _cr1, _cr2, _hscroll, _vscroll, NULL, NULL, 0, NULL };
+#if USE_BKG_CACHE
+    frame.bkg_dirty = _bkg_dirty;
+#endif
+#if USE_JOURNAL
+    if (_profile != PPU_PROFILE_FRAME && !_journal_overflow) {
+        frame.events = _journal;
+        frame.count = _journal_count;
+        frame.oam = _journal_oam;
+    }
+#endif
+#if USE_RENDER_THREAD
+    if (_worker_enable) {
+        //previous snapshot must be complete before the host takes the output
+        ppu_worker_wait();
+        ret = _worker_drawn;
+        _worker_drawn = 0;
+    }
+#endif
+    if (_ppu_gen == _render_gen && vbuffer == _render_buffer) {
+        //nothing changed since last frame, output still valid
+        _skip_count++;
+        if (_hit) _psr |= 0x40;
+        return ret;
+    }
+    if (_cr1 & 0x01) _hscroll |= 0x100;
+    else _hscroll &= ~0x100;
+    if (_cr1 & 0x02) _vscroll |= 0x100;
+    else _vscroll &= ~0x100;
+    frame.hscroll = _hscroll;
+    frame.vscroll = _vscroll;
+
+    if (_pram[0x3f10] != _pram[0x3f00] || _pram[0x3f04] != _pram[0x3f00] || _pram[0x3f08] != _pram[0x3f00] || _pram[0x3f0c] != _pram[0x3f00] ||
+        _pram[0x3f14] != _pram[0x3f00] || _pram[0x3f18] != _pram[0x3f00] || _pram[0x3f1c] != _pram[0x3f00]) DIRTY_MARK(_dirty_vram, 0x3f00);
+    _pram[0x3f10] = _pram[0x3f00];
+    _pram[0x3f0c] = _pram[0x3f08] = _pram[0x3f04] = _pram[0x3f00];
+    _pram[0x3f1c] = _pram[0x3f18] = _pram[0x3f14] = _pram[0x3f10];
+
+    ppu_hit_test(&frame);
+    if (!_video || _logic) {
+        //game still sees the hit flag, output keeps the last drawn frame
+        if (_hit) _psr |= 0x40;
+        return ret;
+    }
+    _render_gen = _ppu_gen;
+    _render_buffer = vbuffer;
+#if USE_RENDER_THREAD
+    if (_worker_enable) {
+        //snapshot render input, drawn by the worker while the cpu runs the next frame
+        memcpy(_slot_pram[_slot], _pram, 0x3000);
+        memcpy(_slot_pram[_slot] + 0x3f00, _pram + 0x3f00, 0x20);
+        memcpy(_slot_sprmem[_slot], _sprmem, sizeof(_sprmem));
+#if USE_BKG_CACHE
+        memcpy(_slot_dirty[_slot], _bkg_dirty, sizeof(_bkg_dirty));
+        memset(_bkg_dirty, 0, sizeof(_bkg_dirty));
+#endif
+        _slot_frame[_slot] = frame;
+        _slot_frame[_slot].pram = _slot_pram[_slot];
+        _slot_frame[_slot].sprmem = _slot_sprmem[_slot];
+        _slot_frame[_slot].bkg_dirty = _slot_dirty[_slot];
+#if USE_JOURNAL
+        if (frame.count) memcpy(_slot_journal[_slot], frame.events, frame.count * sizeof(ppu_event));
+        memcpy(_slot_oam[_slot], _journal_oam, sizeof(_journal_oam));
+        _slot_frame[_slot].events = _slot_journal[_slot];
+        _slot_frame[_slot].oam = _slot_oam[_slot];
+#endif
+        _worker_buffer = vbuffer;
+        _pending_frame = &_slot_frame[_slot];
+        _slot ^= 1;
+    } else
+#endif
+    {
+        _ppu_draw(&frame, vbuffer);
+        ret = 1;
+    }
+
+    //hit test
+    if (_hit) {
+        _psr |= 0x40;       //set hit status
+    }
+    return ret;
+}
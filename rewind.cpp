@@ -0,0 +1,269 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+rewind ring, one machine state per frame
+
+every REWIND_KEY_INTERVAL frames a keyframe is stored, the frames in between
+are stored as xor delta against their keyframe. both are packed with rle:
+
+	control byte	bit 7 = 1 : run of one value byte
+					bit 7 = 0 : literal bytes follow
+					bit 0-6   : length 1..127, 0 = 16 bit length follows (lsb first)
+
+a delta run of zero is an unchanged stretch of the state.
+packed records are allocated in a circular arena, oldest records are
+evicted first, a keyframe takes all of its deltas with it.
+*/
+
+extern size_t core_state_size();
+extern size_t core_save_state(uchar* buffer, size_t size);
+extern uchar core_load_state(const uchar* buffer, size_t size);
+
+#define REWIND_KEY_INTERVAL		60			//frames per keyframe
+#define REWIND_FRAMES			3600		//60 seconds at 60 fps
+#define REWIND_MIN_RUN			3
+#define REWIND_MAX_LENGTH		0xFFFF
+
+typedef struct rewind_entry {
+	uint32 offset;				//packed record in arena
+	uint32 size;
+	uint32 key;					//frame of keyframe, own frame for a keyframe
+} rewind_entry;
+
+static rewind_entry _rw_ring[REWIND_FRAMES];
+static uchar* _rw_arena = NULL;
+static size_t _rw_arena_size = 0;
+static size_t _rw_head = 0;					//next record offset
+static size_t _rw_used = 0;					//packed bytes of live records
+static uint32 _rw_first = 0;				//oldest frame in ring
+static uint32 _rw_next = 0;					//frame of next push
+static size_t _rw_size = 0;					//state size
+static uchar* _rw_state = NULL;				//state being pushed or restored
+static uchar* _rw_key = NULL;				//unpacked keyframe of _rw_key_frame
+static uchar* _rw_pack = NULL;				//record being packed, moved to arena at its final size
+static uint32 _rw_key_frame = 0xFFFFFFFF;
+
+#define REWIND_ENTRY(frame)		(&_rw_ring[(frame) % REWIND_FRAMES])
+#define REWIND_BOUND(size)		((size) + ((size) / 127) * 3 + 8)		//worst case packed size
+
+static uchar* rewind_put_token(uchar* dst, uchar run, uint32 length) {
+	if (length < 0x80) {
+		*dst++ = (run << 7) | length;
+	} else {
+		*dst++ = (run << 7);
+		*dst++ = length;
+		*dst++ = length >> 8;
+	}
+	return dst;
+}
+
+size_t rewind_pack(const uchar* src, const uchar* ref, size_t size, uchar* dst) {
+	//rle of src, or of src ^ ref when ref is given, returns packed size
+	uchar* start = dst;
+	size_t i = 0;
+	size_t j;
+	size_t lit = 0;					//start of pending literal
+	uchar b;
+	while (i < size) {
+		b = ref ? (src[i] ^ ref[i]) : src[i];
+		j = i + 1;
+		if (ref && b == 0) {
+			//unchanged stretch, compare 8 bytes at a time
+			while (j + 8 <= size && *(const uint64*)(src + j) == *(const uint64*)(ref + j)) j += 8;
+			while (j < size && src[j] == ref[j]) j++;
+		} else if (ref) {
+			while (j < size && (uchar)(src[j] ^ ref[j]) == b) j++;
+		} else {
+			while (j < size && src[j] == b) j++;
+		}
+		if (j - i < REWIND_MIN_RUN) {
+			i = j;
+			continue;
+		}
+		//flush literal before the run
+		while (lit < i) {
+			size_t n = i - lit;
+			if (n > REWIND_MAX_LENGTH) n = REWIND_MAX_LENGTH;
+			dst = rewind_put_token(dst, 0, n);
+			if (ref) {
+				for (size_t k = 0; k < n; k++) dst[k] = src[lit + k] ^ ref[lit + k];
+			} else memcpy(dst, src + lit, n);
+			dst += n;
+			lit += n;
+		}
+		while (i < j) {
+			size_t n = j - i;
+			if (n > REWIND_MAX_LENGTH) n = REWIND_MAX_LENGTH;
+			dst = rewind_put_token(dst, 1, n);
+			*dst++ = b;
+			i += n;
+		}
+		lit = i;
+	}
+	while (lit < size) {
+		size_t n = size - lit;
+		if (n > REWIND_MAX_LENGTH) n = REWIND_MAX_LENGTH;
+		dst = rewind_put_token(dst, 0, n);
+		if (ref) {
+			for (size_t k = 0; k < n; k++) dst[k] = src[lit + k] ^ ref[lit + k];
+		} else memcpy(dst, src + lit, n);
+		dst += n;
+		lit += n;
+	}
+	return dst - start;
+}
+
+void rewind_unpack(const uchar* src, size_t length, uchar* dst, uchar delta) {
+	//expand packed record into dst, xor onto dst when delta
+	const uchar* end = src + length;
+	uint32 n;
+	uchar run;
+	while (src < end) {
+		run = *src >> 7;
+		n = *src++ & 0x7F;
+		if (n == 0) {
+			n = src[0] | (src[1] << 8);
+			src += 2;
+		}
+		if (run) {
+			if (!delta) memset(dst, *src, n);
+			else if (*src != 0) for (uint32 k = 0; k < n; k++) dst[k] ^= *src;
+			src++;
+		} else {
+			if (!delta) memcpy(dst, src, n);
+			else for (uint32 k = 0; k < n; k++) dst[k] ^= src[k];
+			src += n;
+		}
+		dst += n;
+	}
+}
+
+static void rewind_evict() {
+	//drop oldest frame, deltas of a dropped keyframe go with it
+	do {
+		_rw_used -= REWIND_ENTRY(_rw_first)->size;
+		_rw_first++;
+	} while (_rw_first != _rw_next && REWIND_ENTRY(_rw_first)->key != _rw_first);
+}
+
+static uchar* rewind_alloc(size_t size) {
+	//reserve size bytes at head, evicting records in the way
+	rewind_entry* e;
+	if (_rw_head + size > _rw_arena_size) {
+		//wrap, records left in the tail are the oldest
+		while (_rw_first != _rw_next && REWIND_ENTRY(_rw_first)->offset >= _rw_head) rewind_evict();
+		_rw_head = 0;
+	}
+	while (_rw_first != _rw_next) {
+		e = REWIND_ENTRY(_rw_first);
+		if (e->offset + e->size <= _rw_head || e->offset >= _rw_head + size) break;
+		rewind_evict();
+	}
+	return _rw_arena + _rw_head;
+}
+
+void rewind_release() {
+	free(_rw_arena);
+	free(_rw_state);
+	free(_rw_key);
+	free(_rw_pack);
+	_rw_arena = _rw_state = _rw_key = _rw_pack = NULL;
+	_rw_arena_size = 0;
+}
+
+uchar rewind_init(size_t arena) {
+	//arena bytes bound the history together with REWIND_FRAMES
+	rewind_release();
+	_rw_size = core_state_size();
+	if (arena < REWIND_BOUND(_rw_size) * 2) arena = REWIND_BOUND(_rw_size) * 2;
+	_rw_arena = (uchar*)malloc(arena);
+	_rw_state = (uchar*)calloc(1, _rw_size);
+	_rw_key = (uchar*)calloc(1, _rw_size);
+	_rw_pack = (uchar*)malloc(REWIND_BOUND(_rw_size));
+	if (_rw_arena == NULL || _rw_state == NULL || _rw_key == NULL || _rw_pack == NULL) {
+		rewind_release();
+		return 0;
+	}
+	_rw_arena_size = arena;
+	_rw_head = 0;
+	_rw_used = 0;
+	_rw_first = _rw_next = 0;
+	_rw_key_frame = 0xFFFFFFFF;
+	return 1;
+}
+
+void rewind_push() {
+	//record the machine at a frame boundary
+	rewind_entry* e;
+	uchar* dst;
+	size_t size;
+	uchar key;
+	if (_rw_arena == NULL) return;
+	core_save_state(_rw_state, _rw_size);
+	key = (_rw_key_frame == 0xFFFFFFFF || _rw_next - _rw_key_frame >= REWIND_KEY_INTERVAL);
+	if (_rw_next - _rw_first == REWIND_FRAMES) rewind_evict();
+	if (!key && _rw_next - _rw_key_frame > _rw_next - _rw_first) key = 1;		//keyframe evicted
+	if (key) size = rewind_pack(_rw_state, NULL, _rw_size, _rw_pack);
+	else size = rewind_pack(_rw_state, _rw_key, _rw_size, _rw_pack);
+	dst = rewind_alloc(size);
+	if (!key && _rw_next - _rw_key_frame > _rw_next - _rw_first) {
+		//arena wrapped over the keyframe, store this frame as the new one
+		key = 1;
+		size = rewind_pack(_rw_state, NULL, _rw_size, _rw_pack);
+		dst = rewind_alloc(size);
+	}
+	memcpy(dst, _rw_pack, size);
+	e = REWIND_ENTRY(_rw_next);
+	e->offset = _rw_head;
+	e->size = size;
+	if (key) {
+		e->key = _rw_next;
+		memcpy(_rw_key, _rw_state, _rw_size);
+		_rw_key_frame = _rw_next;
+	} else {
+		e->key = _rw_key_frame;
+	}
+	_rw_head += size;
+	_rw_used += size;
+	_rw_next++;
+}
+
+uchar rewind_step(uint32 frames) {
+	//restore the state pushed frames pushes ago (1 = last push), newer history is dropped
+	rewind_entry* e;
+	rewind_entry* k;
+	uint32 frame;
+	if (_rw_first == _rw_next) return 0;
+	if (frames == 0) frames = 1;
+	if (frames > _rw_next - _rw_first) frames = _rw_next - _rw_first;
+	frame = _rw_next - frames;
+	e = REWIND_ENTRY(frame);
+	if (_rw_key_frame != e->key) {
+		k = REWIND_ENTRY(e->key);
+		rewind_unpack(_rw_arena + k->offset, k->size, _rw_key, 0);
+		_rw_key_frame = e->key;
+	}
+	memcpy(_rw_state, _rw_key, _rw_size);
+	if (e->key != frame) rewind_unpack(_rw_arena + e->offset, e->size, _rw_state, 1);
+	if (!core_load_state(_rw_state, _rw_size)) return 0;
+	//restored frame becomes the newest, next push continues after it
+	_rw_next = frame + 1;
+	_rw_head = e->offset + e->size;
+	_rw_used = 0;
+	for (uint32 f = _rw_first; f != _rw_next; f++) _rw_used += REWIND_ENTRY(f)->size;
+	return 1;
+}
+
+uint32 rewind_get_frames() {
+	return _rw_next - _rw_first;
+}
+
+size_t rewind_get_usage() {
+	//packed bytes of live history, arena is allocated up front
+	return _rw_used;
+}
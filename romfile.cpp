@@ -0,0 +1,462 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+rom file loader
+
+the file is mapped read only and never copied, prg and chr are views into the
+mapping, every instance of the same rom shares one page cache copy. headers:
+
+	0-3		"NES" 1A
+	4		prg rom, 16KB units (nes 2.0: lsb, msb in byte 9 low nibble)
+	5		chr rom, 8KB units (nes 2.0: lsb, msb in byte 9 high nibble), 0 = chr ram
+	6		bit 0 vertical mirroring, bit 1 battery, bit 2 trainer, bit 3 four screen, bit 4-7 mapper 0-3
+	7		bit 0-1 console, bit 2-3 = 2 nes 2.0, bit 4-7 mapper 4-7
+	8		ines: prg ram 8KB units		nes 2.0: bit 0-3 mapper 8-11, bit 4-7 submapper
+	9		ines: bit 0 pal				nes 2.0: prg/chr size msb
+	10		nes 2.0: prg ram / nvram shift
+	11		nes 2.0: chr ram / nvram shift
+	12		nes 2.0: bit 0-1 timing (ntsc, pal, multi, dendy)
+
+a size msb nibble of F selects exponent notation, 2^(lsb >> 2) * ((lsb & 3) * 2 + 1).
+*/
+
+extern void core_start(uint8 num_banks, uint8 mapper, uchar* rom, int len, uint8 ch_bank, uchar* chrom, int chlen, uint8 config);
+extern uchar core_set_mem(uint16 address, uchar val);
+
+#define ROM_OK				0
+#define ROM_ERR_OPEN		1
+#define ROM_ERR_MAGIC		2
+#define ROM_ERR_SIZE		3			//file shorter than the header says
+#define ROM_ERR_PRG			4			//no prg rom or a size the mapper cannot hold
+#define ROM_ERR_MAPPER		5			//mapper not emulated
+
+#define ROM_MIRROR_H		0
+#define ROM_MIRROR_V		1
+#define ROM_MIRROR_4		2
+
+#define ROM_TIMING_NTSC		0
+#define ROM_TIMING_PAL		1
+#define ROM_TIMING_MULTI	2
+#define ROM_TIMING_DENDY	3
+
+#define ROM_MMC1_BANKS		20			//bank_table entries of the mmc1 context
+
+typedef struct nes_rom {
+	const uchar* base;				//mapping
+	size_t size;
+	const uchar* prg;
+	uint32 prg_size;
+	const uchar* chr;				//NULL with chr ram
+	uint32 chr_size;
+	const uchar* trainer;			//512 bytes for 0x7000, NULL when absent
+	uint32 prg_ram;
+	uint32 chr_ram;
+	uint16 mapper;
+	uint8 submapper;
+	uint8 mirroring;
+	uint8 battery;
+	uint8 timing;
+	uint8 nes2;
+	uint8 flags6;					//ppu_init config, as core_init passes it
+} nes_rom;
+
+static const char* _rom_errors[] = { "ok", "cannot open file", "not an ines file", "file truncated", "bad prg size", "mapper not supported" };
+static uchar _rom_chr_ram[0x2000];		//chr ram carts start from zeroed pattern tables
+
+const char* rom_error(uchar code) {
+	return (code < sizeof(_rom_errors) / sizeof(_rom_errors[0])) ? _rom_errors[code] : "unknown";
+}
+
+static uchar rom_unit_size(uint8 lsb, uint8 msb, uint32 unit, uint32* size) {
+	//nes 2.0 rom size, msb 0x0F is 2^e * (m * 2 + 1) bytes, more than 4GB cannot be in a file this maps
+	uint64 bytes;
+	if (msb == 0x0F) {
+		if ((lsb >> 2) >= 31) return ROM_ERR_SIZE;
+		bytes = ((uint64)1 << (lsb >> 2)) * ((lsb & 3) * 2 + 1);
+		if (bytes > 0xFFFFFFFF) return ROM_ERR_SIZE;
+		size[0] = (uint32)bytes;
+	}
+	else size[0] = ((msb << 8) | lsb) * unit;
+	return ROM_OK;
+}
+
+static uchar rom_check(const nes_rom* rom) {
+	//what core_config can run
+	switch (rom->mapper) {
+	case 0:
+		if (rom->prg_size != 0x4000 && rom->prg_size != 0x8000) return ROM_ERR_PRG;
+		break;
+	case 1:
+		if (rom->prg_size < 0x8000 || rom->prg_size > ROM_MMC1_BANKS * 0x4000 || (rom->prg_size & 0x3FFF)) return ROM_ERR_PRG;
+		break;
+	default:
+		return ROM_ERR_MAPPER;
+	}
+	return ROM_OK;
+}
+
+uchar rom_parse(const uchar* buffer, size_t size, nes_rom* rom) {
+	//decode and validate a header, prg/chr/trainer become views into buffer
+	const uchar* h = buffer;
+	size_t need;
+	memset(rom, 0, sizeof(nes_rom));
+	rom->base = buffer;
+	rom->size = size;
+	if (size < 16 || memcmp(h, "NES\x1A", 4) != 0) return ROM_ERR_MAGIC;
+	rom->nes2 = ((h[7] & 0x0C) == 0x08);
+	rom->flags6 = h[6];
+	rom->mirroring = (h[6] & 0x08) ? ROM_MIRROR_4 : (h[6] & 0x01) ? ROM_MIRROR_V : ROM_MIRROR_H;
+	rom->battery = (h[6] >> 1) & 1;
+	if (rom->nes2) {
+		rom->mapper = ((h[8] & 0x0F) << 8) | (h[7] & 0xF0) | (h[6] >> 4);
+		rom->submapper = h[8] >> 4;
+		if (rom_unit_size(h[4], h[9] & 0x0F, 0x4000, &rom->prg_size) != ROM_OK) return ROM_ERR_SIZE;
+		if (rom_unit_size(h[5], h[9] >> 4, 0x2000, &rom->chr_size) != ROM_OK) return ROM_ERR_SIZE;
+		rom->prg_ram = (h[10] & 0x0F) ? (64 << (h[10] & 0x0F)) : 0;
+		rom->chr_ram = (h[11] & 0x0F) ? (64 << (h[11] & 0x0F)) : 0;
+		rom->timing = h[12] & 0x03;
+	} else {
+		//bytes 12-15 carry text in old dumps ("DiskDude!"), byte 7 is garbage then
+		if (h[12] | h[13] | h[14] | h[15]) rom->mapper = h[6] >> 4;
+		else rom->mapper = (h[7] & 0xF0) | (h[6] >> 4);
+		rom->prg_size = h[4] * 0x4000;
+		rom->chr_size = h[5] * 0x2000;
+		rom->prg_ram = (h[8] ? h[8] : 1) * 0x2000;
+		rom->chr_ram = h[5] ? 0 : 0x2000;
+		rom->timing = (h[9] & 0x01) ? ROM_TIMING_PAL : ROM_TIMING_NTSC;
+	}
+	need = 16;
+	if (h[6] & 0x04) {
+		rom->trainer = buffer + need;
+		need += 512;
+	}
+	rom->prg = buffer + need;
+	need += rom->prg_size;
+	rom->chr = rom->chr_size ? buffer + need : NULL;
+	need += rom->chr_size;
+	if (size < need) return ROM_ERR_SIZE;
+	if (rom->chr_size != 0 && rom->chr_size < 0x2000) return ROM_ERR_SIZE;
+	return rom_check(rom);
+}
+
+void rom_start(const nes_rom* rom) {
+	//power on the machine with this cartridge, the core only reads prg and chr
+	uchar* chr = (uchar*)rom->chr;
+	if (chr == NULL) {
+		memset(_rom_chr_ram, 0, sizeof(_rom_chr_ram));
+		chr = _rom_chr_ram;
+	}
+	core_start(rom->prg_size / 0x4000, (uint8)rom->mapper, (uchar*)rom->prg, rom->prg_size, rom->chr_size / 0x2000, chr,
+		rom->chr_size ? rom->chr_size : sizeof(_rom_chr_ram), rom->flags6);
+	if (rom->trainer != NULL) {
+		//512 bytes of patch code the game expects in cartridge ram at $7000
+		for (uint16 i = 0; i < 512; i++) core_set_mem(0x7000 + i, rom->trainer[i]);
+	}
+}
+
+void rom_print(const nes_rom* rom) {
+	static const char* mirroring[] = { "horizontal", "vertical", "four screen" };
+	static const char* timing[] = { "ntsc", "pal", "multi", "dendy" };
+	printf("%s mapper %u.%u, prg %uKB, chr %uKB%s, %s, %s%s%s\n", rom->nes2 ? "nes 2.0" : "ines", rom->mapper, rom->submapper,
+		rom->prg_size >> 10, (rom->chr_size ? rom->chr_size : rom->chr_ram) >> 10, rom->chr_size ? "" : " ram",
+		mirroring[rom->mirroring], timing[rom->timing], rom->battery ? ", battery" : "", rom->trainer ? ", trainer" : "");
+}
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const uchar* rom_map(const char* path, size_t* size) {
+	//whole file read only, shared with every process mapping it
+	struct stat st;
+	void* base;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+	*size = st.st_size;
+	return (const uchar*)base;
+}
+
+void rom_unmap(const uchar* base, size_t size) {
+	munmap((void*)base, size);
+}
+#else
+const uchar* rom_map(const char* path, size_t* size) {
+	HANDLE file, mapping;
+	LARGE_INTEGER length;
+	const uchar* base = NULL;
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	if (GetFileSizeEx(file, &length) && length.QuadPart != 0) {
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL) {
+			base = (const uchar*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);			//view keeps the mapping alive
+			*size = (size_t)length.QuadPart;
+		}
+	}
+	CloseHandle(file);
+	return base;
+}
+
+void rom_unmap(const uchar* base, size_t size) {
+	UnmapViewOfFile(base);
+}
+#endif
+
+static uchar rom_catalog_apply(nes_rom* rom, uchar status);
+
+nes_rom* rom_open(const char* path, uchar* error) {
+	//map and parse, NULL with the reason in error when the file cannot run
+	size_t size = 0;
+	const uchar* base = rom_map(path, &size);
+	nes_rom* rom;
+	uchar ret = ROM_ERR_OPEN;
+	if (base != NULL) {
+		rom = (nes_rom*)malloc(sizeof(nes_rom));
+		if (rom != NULL) {
+			ret = rom_parse(base, size, rom);
+			if (ret == ROM_OK || ret == ROM_ERR_MAPPER || ret == ROM_ERR_PRG) ret = rom_catalog_apply(rom, ret);
+		}
+		if (ret == ROM_OK) {
+			if (error != NULL) *error = ROM_OK;
+			return rom;
+		}
+		free(rom);
+		rom_unmap(base, size);
+	}
+	if (error != NULL) *error = ret;
+	return NULL;
+}
+
+void rom_close(nes_rom* rom) {
+	if (rom == NULL) return;
+	rom_unmap(rom->base, rom->size);
+	free(rom);
+}
+
+/*
+rom catalog
+
+every file under a directory is mapped, parsed and hashed on all cores, the
+result is written as a csv for people and a binary index for startup:
+
+	uint32 magic "VCAT", uint32 version, uint32 count, uint32 record size
+	rom_record[count], sorted by hash
+
+a build looks a rom up by hash in the mapped index and takes its header fields
+from the record, a corrected record overrides what the file says.
+*/
+
+extern uint64 hash_bytes(const uchar* data, size_t size, uint64 seed);
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#define CATALOG_MAGIC		0x54414356		//"VCAT"
+#define CATALOG_VERSION		1
+
+typedef struct rom_record {
+	uint64 hash;					//rom_hash, sort key
+	uint64 prg_hash;
+	uint64 chr_hash;
+	uint32 prg_size;
+	uint32 chr_size;
+	uint16 mapper;
+	uint8 submapper;
+	uint8 mirroring;
+	uint8 timing;
+	uint8 battery;
+	uint8 flags6;
+	uint8 status;					//rom_parse result, ROM_OK when this build runs it
+} rom_record;
+
+static const rom_record* _catalog = NULL;
+static uint32 _catalog_count = 0;
+static const uchar* _catalog_base = NULL;
+static size_t _catalog_size = 0;
+
+uint64 rom_hash(const nes_rom* rom) {
+	//identity of prg and chr, header bytes are not part of it
+	uint64 h = hash_bytes(rom->prg, rom->prg_size, 0);
+	return rom->chr ? hash_bytes(rom->chr, rom->chr_size, h) : h;
+}
+
+static void rom_record_scan(const char* path, rom_record* r) {
+	nes_rom rom;
+	size_t size = 0;
+	const uchar* base = rom_map(path, &size);
+	memset(r, 0, sizeof(rom_record));
+	if (base == NULL) {
+		r->status = ROM_ERR_OPEN;
+		return;
+	}
+	r->status = rom_parse(base, size, &rom);
+	if (r->status != ROM_ERR_MAGIC) {
+		r->prg_size = rom.prg_size;
+		r->chr_size = rom.chr_size;
+		r->mapper = rom.mapper;
+		r->submapper = rom.submapper;
+		r->mirroring = rom.mirroring;
+		r->timing = rom.timing;
+		r->battery = rom.battery;
+		r->flags6 = rom.flags6;
+	}
+	if (r->status != ROM_ERR_MAGIC && r->status != ROM_ERR_SIZE) {
+		r->prg_hash = hash_bytes(rom.prg, rom.prg_size, 0);
+		r->chr_hash = rom.chr ? hash_bytes(rom.chr, rom.chr_size, 0) : 0;
+		r->hash = rom_hash(&rom);
+	}
+	rom_unmap(base, size);
+}
+
+#if !defined(_WIN32)
+#include <dirent.h>
+
+static void rom_walk(const std::string& dir, std::vector<std::string>& files) {
+	struct dirent* e;
+	struct stat st;
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) return;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.') continue;
+		std::string path = dir + "/" + e->d_name;
+		if (stat(path.c_str(), &st) != 0) continue;
+		if (S_ISDIR(st.st_mode)) rom_walk(path, files);
+		else if (S_ISREG(st.st_mode)) files.push_back(path);
+	}
+	closedir(d);
+}
+#else
+static void rom_walk(const std::string& dir, std::vector<std::string>& files) {
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE) return;
+	do {
+		if (data.cFileName[0] == '.') continue;
+		std::string path = dir + "\\" + data.cFileName;
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) rom_walk(path, files);
+		else files.push_back(path);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+}
+#endif
+
+int32 rom_catalog_build(const char* dir, const char* index, const char* csv) {
+	//scan every file under dir on all cores, returns the number of roms this build runs, -1 when nothing was written
+	std::vector<std::string> files;
+	std::vector<rom_record> records;
+	std::vector<std::thread> workers;
+	std::atomic<uint32> next(0);
+	uint32 threads = std::thread::hardware_concurrency();
+	uint32 header[4];
+	uint64 bytes = 0;
+	int32 runnable = 0;
+	FILE* ff;
+	rom_walk(dir, files);
+	std::sort(files.begin(), files.end());
+	records.resize(files.size());
+	if (threads == 0) threads = 1;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32 t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			uint32 i;
+			while ((i = next++) < files.size()) rom_record_scan(files[i].c_str(), &records[i]);
+		}));
+	}
+	for (auto& w : workers) w.join();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (csv != NULL && (ff = fopen(csv, "w")) != NULL) {
+		fprintf(ff, "path,hash,prg_hash,chr_hash,mapper,submapper,prg_kb,chr_kb,mirroring,timing,battery,status\n");
+		for (size_t i = 0; i < files.size(); i++) {
+			const rom_record* r = &records[i];
+			if (r->status == ROM_ERR_MAGIC) continue;
+			fprintf(ff, "\"%s\",%016llx,%016llx,%016llx,%u,%u,%u,%u,%u,%u,%u,%s\n", files[i].c_str(), (unsigned long long)r->hash,
+				(unsigned long long)r->prg_hash, (unsigned long long)r->chr_hash, r->mapper, r->submapper, r->prg_size >> 10,
+				r->chr_size >> 10, r->mirroring, r->timing, r->battery, rom_error(r->status));
+		}
+		fclose(ff);
+	}
+	//index keeps hashed roms only, one record per distinct rom, a runnable header wins over a broken copy
+	for (size_t i = 0; i < records.size(); i++) {
+		bytes += records[i].prg_size + records[i].chr_size;
+		if (records[i].status == ROM_OK) runnable++;
+	}
+	records.erase(std::remove_if(records.begin(), records.end(), [](const rom_record& r) { return r.hash == 0; }), records.end());
+	std::stable_sort(records.begin(), records.end(), [](const rom_record& a, const rom_record& b) {
+		return (a.hash != b.hash) ? (a.hash < b.hash) : (a.status == ROM_OK && b.status != ROM_OK);
+	});
+	records.erase(std::unique(records.begin(), records.end(), [](const rom_record& a, const rom_record& b) { return a.hash == b.hash; }), records.end());
+	ff = fopen(index, "wb");
+	if (ff == NULL) return -1;
+	header[0] = CATALOG_MAGIC;
+	header[1] = CATALOG_VERSION;
+	header[2] = (uint32)records.size();
+	header[3] = sizeof(rom_record);
+	fwrite(header, sizeof(header), 1, ff);
+	if (!records.empty()) fwrite(records.data(), sizeof(rom_record), records.size(), ff);
+	fclose(ff);
+	printf("catalog  %zu files, %zu roms, %d runnable, %u threads, %.3fs, %.0f files/s, %.1f MB/s\n", files.size(), records.size(),
+		runnable, threads, elapsed, files.size() / elapsed, bytes / elapsed / (1 << 20));
+	return runnable;
+}
+
+uchar rom_catalog_open(const char* index) {
+	//map an index written by rom_catalog_build, rom_open applies it from then on
+	const uint32* header;
+	if (_catalog_base != NULL) rom_unmap(_catalog_base, _catalog_size);
+	_catalog = NULL;
+	_catalog_count = 0;
+	_catalog_base = rom_map(index, &_catalog_size);
+	if (_catalog_base == NULL) return 0;
+	header = (const uint32*)_catalog_base;
+	if (_catalog_size < 16 || header[0] != CATALOG_MAGIC || header[1] != CATALOG_VERSION || header[3] != sizeof(rom_record) ||
+		_catalog_size < 16 + (size_t)header[2] * sizeof(rom_record)) {
+		rom_unmap(_catalog_base, _catalog_size);
+		_catalog_base = NULL;
+		return 0;
+	}
+	_catalog = (const rom_record*)(_catalog_base + 16);
+	_catalog_count = header[2];
+	return 1;
+}
+
+static const rom_record* rom_catalog_find(uint64 hash) {
+	uint32 lo = 0, hi = _catalog_count;
+	while (lo < hi) {
+		uint32 mid = (lo + hi) / 2;
+		if (_catalog[mid].hash < hash) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo < _catalog_count && _catalog[lo].hash == hash) ? &_catalog[lo] : NULL;
+}
+
+static uchar rom_catalog_apply(nes_rom* rom, uchar status) {
+	//header fields of a catalogued rom come from its record
+	const rom_record* r;
+	if (_catalog == NULL || (r = rom_catalog_find(rom_hash(rom))) == NULL) return status;
+	rom->mapper = r->mapper;
+	rom->submapper = r->submapper;
+	rom->mirroring = r->mirroring;
+	rom->timing = r->timing;
+	rom->battery = r->battery;
+	rom->flags6 = (r->flags6 & 0xF6) | ((r->mirroring == ROM_MIRROR_V) ? 0x01 : 0) | ((r->mirroring == ROM_MIRROR_4) ? 0x08 : 0);
+	return rom_check(rom);
+}
@@ -0,0 +1,242 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+content addressed snapshot store
+
+a saved state is cut into SNAP_PAGE byte pages, every distinct page is kept
+once with a reference count, a snapshot is the list of its page ids. rom is
+not part of a state, what dedups is untouched ram, unchanged nametables and
+pages equal across frames or instances.
+
+the pool is one shared mapping, clones forked after snap_init save into the
+same pool so pages dedup across instances too. with a spill file the whole
+pool, header and tables included, is a shared mapping of that file instead of
+anonymous memory. the store does not evict anything itself, under memory
+pressure the kernel writes back and drops whatever pages of the mapping it
+reclaims, so resident size is left to the page cache.
+
+	store header | page table[capacity] | buckets[capacity] | page data[capacity]
+*/
+
+extern size_t core_state_size();
+extern size_t core_save_state(uchar* buffer, size_t size);
+extern uchar core_load_state(const uchar* buffer, size_t size);
+extern uint64 hash_bytes(const uchar* data, size_t size, uint64 seed);
+
+#include <new>
+#include <atomic>
+
+#define SNAP_PAGE_SHIFT		8
+#define SNAP_PAGE			(1 << SNAP_PAGE_SHIFT)
+#define SNAP_NONE			0					//page id 0 is never used
+
+typedef struct snap_page {
+	uint64 hash;
+	uint32 refs;						//0 = free
+	uint32 next;						//bucket chain, free list when free
+} snap_page;
+
+typedef struct snap_store {
+	std::atomic_flag lock;				//shared with forked clones
+	uint32 capacity;					//pages including the unused id 0
+	uint32 used;						//distinct pages held
+	uint32 free;						//free list head
+	uint32 top;							//pages never handed out start here
+	uint64 refs;						//page references of all live snapshots
+	uint64 hits;						//pages found already stored
+	uint64 misses;
+} snap_store;
+
+static snap_store* _snap = NULL;
+static snap_page* _snap_table;
+static uint32* _snap_bucket;
+static uchar* _snap_data;
+static size_t _snap_size = 0;			//bytes mapped
+static size_t _snap_state_size = 0;
+static uchar* _snap_state = NULL;		//state being cut into pages or restored
+static uint32 _snap_pages = 0;			//pages per snapshot
+
+#define SNAP_ALIGN(size)	(((size) + 63) & ~(size_t)63)
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void* snap_map(size_t size, const char* spill) {
+	void* base;
+	int fd;
+	if (spill == NULL) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		return (base == MAP_FAILED) ? NULL : base;
+	}
+	fd = open(spill, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return NULL;
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return (base == MAP_FAILED) ? NULL : base;
+}
+
+static void snap_unmap(void* base, size_t size) {
+	munmap(base, size);
+}
+#else
+static void* snap_map(size_t size, const char* spill) {
+	//no spill file and no sharing between instances on this host
+	return calloc(1, size);
+}
+
+static void snap_unmap(void* base, size_t size) {
+	free(base);
+}
+#endif
+
+static __forceinline void snap_lock() {
+	while (_snap->lock.test_and_set(std::memory_order_acquire));
+}
+
+static __forceinline void snap_unlock() {
+	_snap->lock.clear(std::memory_order_release);
+}
+
+void snap_release() {
+	if (_snap != NULL) snap_unmap(_snap, _snap_size);
+	free(_snap_state);
+	_snap = NULL;
+	_snap_state = NULL;
+	_snap_size = 0;
+}
+
+uchar snap_init(uint32 capacity, const char* spill) {
+	//pool of capacity pages, spill names a file on local disk to back it, NULL keeps it in memory
+	size_t table, bucket;
+	snap_release();
+	capacity++;
+	table = SNAP_ALIGN(capacity * sizeof(snap_page));
+	bucket = SNAP_ALIGN(capacity * sizeof(uint32));
+	_snap_size = SNAP_ALIGN(sizeof(snap_store)) + table + bucket + (size_t)capacity * SNAP_PAGE;
+	_snap = (snap_store*)snap_map(_snap_size, spill);
+	_snap_state_size = core_state_size();
+	_snap_pages = (_snap_state_size + SNAP_PAGE - 1) >> SNAP_PAGE_SHIFT;
+	_snap_state = (uchar*)calloc(_snap_pages, SNAP_PAGE);			//tail of the last page stays zero
+	if (_snap == NULL || _snap_state == NULL) {
+		snap_release();
+		return 0;
+	}
+	_snap_table = (snap_page*)((uchar*)_snap + SNAP_ALIGN(sizeof(snap_store)));
+	_snap_bucket = (uint32*)((uchar*)_snap_table + table);
+	_snap_data = (uchar*)_snap_bucket + bucket;
+	new (_snap) snap_store();			//value initialized, all zero
+	_snap->lock.clear();
+	_snap->capacity = capacity;
+	_snap->free = SNAP_NONE;
+	_snap->top = 1;
+	return 1;
+}
+
+uint32 snap_get_pages() {
+	//page ids per snapshot, the size of the id array given to snap_save
+	return _snap_pages;
+}
+
+static void snap_unref(uint32 id) {
+	//drop one reference, unlink the page from its bucket when it was the last
+	snap_page* p = &_snap_table[id];
+	uint32* link;
+	_snap->refs--;
+	if (--p->refs != 0) return;
+	link = &_snap_bucket[p->hash % _snap->capacity];
+	while (*link != id) link = &_snap_table[*link].next;
+	*link = p->next;
+	p->next = _snap->free;
+	_snap->free = id;
+	_snap->used--;
+}
+
+static uint32 snap_ref(const uchar* page) {
+	//id of a page with these bytes, stored when new, SNAP_NONE when the pool is full
+	uint64 h = hash_bytes(page, SNAP_PAGE, 0);
+	uint32* bucket = &_snap_bucket[h % _snap->capacity];
+	uint32 id;
+	snap_page* p;
+	for (id = *bucket; id != SNAP_NONE; id = p->next) {
+		p = &_snap_table[id];
+		if (p->hash == h && memcmp(_snap_data + ((size_t)id << SNAP_PAGE_SHIFT), page, SNAP_PAGE) == 0) {
+			p->refs++;
+			_snap->refs++;
+			_snap->hits++;
+			return id;
+		}
+	}
+	if (_snap->free != SNAP_NONE) {
+		id = _snap->free;
+		_snap->free = _snap_table[id].next;
+	} else if (_snap->top < _snap->capacity) {
+		id = _snap->top++;
+	} else return SNAP_NONE;
+	p = &_snap_table[id];
+	memcpy(_snap_data + ((size_t)id << SNAP_PAGE_SHIFT), page, SNAP_PAGE);
+	p->hash = h;
+	p->refs = 1;
+	p->next = *bucket;
+	*bucket = id;
+	_snap->used++;
+	_snap->refs++;
+	_snap->misses++;
+	return id;
+}
+
+void snap_free(const uint32* ids) {
+	//release a snapshot taken with snap_save
+	if (_snap == NULL) return;
+	snap_lock();
+	for (uint32 i = 0; i < _snap_pages; i++) {
+		if (ids[i] != SNAP_NONE) snap_unref(ids[i]);
+	}
+	snap_unlock();
+}
+
+uchar snap_save(uint32* ids) {
+	//snapshot the machine into snap_get_pages() ids, 0 when the pool is full
+	uint32 i;
+	if (_snap == NULL) return 0;
+	core_save_state(_snap_state, _snap_state_size);
+	snap_lock();
+	for (i = 0; i < _snap_pages; i++) {
+		ids[i] = snap_ref(_snap_state + ((size_t)i << SNAP_PAGE_SHIFT));
+		if (ids[i] == SNAP_NONE) break;
+	}
+	if (i != _snap_pages) {
+		while (i-- > 0) snap_unref(ids[i]);
+		snap_unlock();
+		return 0;
+	}
+	snap_unlock();
+	return 1;
+}
+
+uchar snap_load(const uint32* ids) {
+	//restore the machine from a snapshot
+	if (_snap == NULL) return 0;
+	for (uint32 i = 0; i < _snap_pages; i++) {
+		memcpy(_snap_state + ((size_t)i << SNAP_PAGE_SHIFT), _snap_data + ((size_t)ids[i] << SNAP_PAGE_SHIFT), SNAP_PAGE);
+	}
+	return core_load_state(_snap_state, _snap_state_size);
+}
+
+void snap_report() {
+	//live snapshot bytes against distinct page bytes held
+	if (_snap == NULL || _snap->used == 0) return;
+	printf("snap     %u pages (%.1f MB) hold %.1f MB of snapshots, ratio %.1f, %.1f%% pages deduped\n", _snap->used,
+		((double)_snap->used * SNAP_PAGE) / (1 << 20), ((double)_snap->refs * SNAP_PAGE) / (1 << 20),
+		(double)_snap->refs / _snap->used, _snap->hits * 100.0 / (_snap->hits + _snap->misses));
+}
@@ -0,0 +1,280 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "defs.h"
+#else
+#include "port.h"
+#endif
+
+/*
+rolling machine state hash
+
+leaves are xxh64 hashes of the dirty bitmap pages (cpu ram, cartridge ram, vram,
+oam) plus one leaf for the registers. leaves are combined 64 at a time into
+blocks and blocks into the root, only pages written since the last frame are
+rehashed. every frame appends to the stream:
+
+	uint32 frame, uint64 root, uint16 count, count x { uint16 leaf, uint64 hash }
+
+so a reader can rebuild every leaf of any frame by replaying the changes.
+*/
+
+extern void core_dirty_config(uint8 shift);
+extern uint32 core_dirty_get(uint8 region, uint64* bitmap, uchar clear);
+extern uchar* core_dirty_memory(uint8 region, uint32* size);
+extern size_t core_get_regs(uchar* buffer);
+
+#define HASH_MAGIC			0x48535648		//"VHSH"
+#define HASH_VERSION		1
+#define HASH_REGIONS		4				//dirty regions, registers leaf follows
+#define HASH_MAX_LEAVES		2048
+#define HASH_BLOCK			64				//leaves per block
+#define HASH_PRIME1			0x9E3779B185EBCA87ULL
+#define HASH_PRIME2			0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3			0x165667B19E3779F9ULL
+#define HASH_PRIME4			0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5			0x27D4EB2F165667C5ULL
+#define HASH_ROTL(x, r)		(((x) << (r)) | ((x) >> (64 - (r))))
+
+static const char* _hash_names[] = { "ram", "sram", "vram", "oam", "regs" };
+static uint8 _hash_shift = 8;
+static uint32 _hash_pages[HASH_REGIONS];		//pages per region
+static uint32 _hash_first[HASH_REGIONS + 1];	//first leaf of each region
+static uint32 _hash_count = 0;					//leaves including registers
+static uint64 _hash_leaf[HASH_MAX_LEAVES];
+static uint64 _hash_block[HASH_MAX_LEAVES / HASH_BLOCK];
+static uint64 _hash_root = 0;
+static uint32 _hash_frame = 0;
+static FILE* _hash_stream = NULL;
+
+static __forceinline uint64 hash_read64(const uchar* p) {
+	uint64 v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static __forceinline uint64 hash_round(uint64 acc, uint64 input) {
+	acc += input * HASH_PRIME2;
+	acc = HASH_ROTL(acc, 31);
+	return acc * HASH_PRIME1;
+}
+
+static __forceinline uint64 hash_merge(uint64 acc, uint64 val) {
+	acc ^= hash_round(0, val);
+	return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+uint64 hash_bytes(const uchar* data, size_t size, uint64 seed) {
+	//xxh64
+	const uchar* end = data + size;
+	uint64 h;
+	if (size >= 32) {
+		uint64 v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+		uint64 v2 = seed + HASH_PRIME2;
+		uint64 v3 = seed;
+		uint64 v4 = seed - HASH_PRIME1;
+		do {
+			v1 = hash_round(v1, hash_read64(data));
+			v2 = hash_round(v2, hash_read64(data + 8));
+			v3 = hash_round(v3, hash_read64(data + 16));
+			v4 = hash_round(v4, hash_read64(data + 24));
+			data += 32;
+		} while (data + 32 <= end);
+		h = HASH_ROTL(v1, 1) + HASH_ROTL(v2, 7) + HASH_ROTL(v3, 12) + HASH_ROTL(v4, 18);
+		h = hash_merge(h, v1);
+		h = hash_merge(h, v2);
+		h = hash_merge(h, v3);
+		h = hash_merge(h, v4);
+	} else {
+		h = seed + HASH_PRIME5;
+	}
+	h += size;
+	for (; data + 8 <= end; data += 8) {
+		h ^= hash_round(0, hash_read64(data));
+		h = HASH_ROTL(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+	}
+	if (data + 4 <= end) {
+		uint32 k;
+		memcpy(&k, data, 4);
+		h ^= (uint64)k * HASH_PRIME1;
+		h = HASH_ROTL(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+		data += 4;
+	}
+	for (; data < end; data++) {
+		h ^= (*data) * HASH_PRIME5;
+		h = HASH_ROTL(h, 11) * HASH_PRIME1;
+	}
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	h *= HASH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64 hash_combine(const uint64* hashes, uint32 count) {
+	return hash_bytes((const uchar*)hashes, count * sizeof(uint64), 0);
+}
+
+static void hash_put(const void* data, size_t size) {
+	if (_hash_stream != NULL) fwrite(data, 1, size, _hash_stream);
+}
+
+uchar hash_init(uint8 shift, const char* path) {
+	//leaves of 1 << shift bytes, stream written to path when given
+	//the hasher owns the dirty bitmaps from here on, hash_frame clears them
+	uint32 i;
+	uint32 header[3 + HASH_REGIONS];
+	core_dirty_config(shift);					//every page starts dirty
+	_hash_shift = shift;
+	_hash_count = 0;
+	for (i = 0; i < HASH_REGIONS; i++) {
+		_hash_pages[i] = core_dirty_get(i, NULL, 0);
+		_hash_first[i] = _hash_count;
+		_hash_count += _hash_pages[i];
+	}
+	_hash_first[HASH_REGIONS] = _hash_count++;
+	if (_hash_count > HASH_MAX_LEAVES) return 0;
+	memset(_hash_leaf, 0, sizeof(_hash_leaf));
+	memset(_hash_block, 0, sizeof(_hash_block));
+	_hash_root = 0;
+	_hash_frame = 0;
+	if (_hash_stream != NULL) fclose(_hash_stream);
+	_hash_stream = NULL;
+	if (path == NULL) return 1;
+	_hash_stream = fopen(path, "wb");
+	if (_hash_stream == NULL) return 0;
+	header[0] = HASH_MAGIC;
+	header[1] = (HASH_VERSION << 16) | shift;
+	header[2] = _hash_count;
+	for (i = 0; i < HASH_REGIONS; i++) header[3 + i] = _hash_pages[i];
+	hash_put(header, sizeof(header));
+	return 1;
+}
+
+void hash_close() {
+	if (_hash_stream != NULL) fclose(_hash_stream);
+	_hash_stream = NULL;
+}
+
+uint64 hash_frame() {
+	//rehash pages written since the last call, returns the state root of this frame
+	static uint16 changed[HASH_MAX_LEAVES];
+	uint64 bitmap[16];
+	uchar regs[512];
+	uint64 blocks[HASH_MAX_LEAVES / HASH_BLOCK];
+	uint16 count = 0;
+	uint32 region, page, leaf, size, length;
+	uint64 h;
+	uchar* memory;
+	memset(blocks, 0, sizeof(blocks));
+	for (region = 0; region < HASH_REGIONS; region++) {
+		if (_hash_pages[region] == 0) continue;
+		core_dirty_get(region, bitmap, 1);
+		memory = core_dirty_memory(region, &size);
+		for (page = 0; page < _hash_pages[region]; page++) {
+			if (((bitmap[page >> 6] >> (page & 63)) & 1) == 0) continue;
+			length = size - (page << _hash_shift);
+			if (length > (1u << _hash_shift)) length = 1 << _hash_shift;
+			h = hash_bytes(memory + (page << _hash_shift), length, region);
+			leaf = _hash_first[region] + page;
+			if (h == _hash_leaf[leaf]) continue;			//rewritten with the same bytes
+			_hash_leaf[leaf] = h;
+			changed[count++] = leaf;
+			blocks[leaf / HASH_BLOCK] = 1;
+		}
+	}
+	leaf = _hash_first[HASH_REGIONS];
+	h = hash_bytes(regs, core_get_regs(regs), HASH_REGIONS);
+	if (h != _hash_leaf[leaf]) {
+		_hash_leaf[leaf] = h;
+		changed[count++] = leaf;
+		blocks[leaf / HASH_BLOCK] = 1;
+	}
+	if (count != 0) {
+		for (page = 0; page * HASH_BLOCK < _hash_count; page++) {
+			if (!blocks[page]) continue;
+			length = _hash_count - page * HASH_BLOCK;
+			if (length > HASH_BLOCK) length = HASH_BLOCK;
+			_hash_block[page] = hash_combine(_hash_leaf + page * HASH_BLOCK, length);
+		}
+		_hash_root = hash_combine(_hash_block, (_hash_count + HASH_BLOCK - 1) / HASH_BLOCK);
+	}
+	if (_hash_stream != NULL) {
+		hash_put(&_hash_frame, sizeof(_hash_frame));
+		hash_put(&_hash_root, sizeof(_hash_root));
+		hash_put(&count, sizeof(count));
+		for (uint16 i = 0; i < count; i++) {
+			hash_put(&changed[i], sizeof(uint16));
+			hash_put(&_hash_leaf[changed[i]], sizeof(uint64));
+		}
+	}
+	_hash_frame++;
+	return _hash_root;
+}
+
+typedef struct hash_reader {
+	FILE* ff;
+	uint32 header[3 + HASH_REGIONS];
+	uint32 frame;
+	uint64 root;
+	uint64 leaf[HASH_MAX_LEAVES];
+} hash_reader;
+
+static uchar hash_read_frame(hash_reader* r) {
+	//apply the next record to the leaves, 0 at end of stream
+	uint16 count, index;
+	uint64 h;
+	if (fread(&r->frame, sizeof(r->frame), 1, r->ff) != 1) return 0;
+	if (fread(&r->root, sizeof(r->root), 1, r->ff) != 1) return 0;
+	if (fread(&count, sizeof(count), 1, r->ff) != 1) return 0;
+	while (count--) {
+		if (fread(&index, sizeof(index), 1, r->ff) != 1) return 0;
+		if (fread(&h, sizeof(h), 1, r->ff) != 1) return 0;
+		if (index < HASH_MAX_LEAVES) r->leaf[index] = h;
+	}
+	return 1;
+}
+
+int32 hash_compare(const char* path_a, const char* path_b) {
+	//replay two streams, report the first frame whose roots differ and the pages behind it, -1 if none
+	static hash_reader a, b;
+	hash_reader* r[2] = { &a, &b };
+	const char* paths[2] = { path_a, path_b };
+	uint32 i, region, page, shift, shown = 0, frames = 0;
+	int32 ret = -1;
+	for (i = 0; i < 2; i++) {
+		memset(r[i], 0, sizeof(hash_reader));
+		r[i]->ff = fopen(paths[i], "rb");
+		if (r[i]->ff == NULL || fread(r[i]->header, sizeof(r[i]->header), 1, r[i]->ff) != 1 || r[i]->header[0] != HASH_MAGIC) {
+			printf("%s: not a hash stream\n", paths[i]);
+			if (r[0]->ff != NULL) fclose(r[0]->ff);
+			if (i == 1 && r[1]->ff != NULL) fclose(r[1]->ff);
+			return -1;
+		}
+	}
+	if (memcmp(a.header, b.header, sizeof(a.header)) != 0) {
+		printf("streams use different page layouts\n");
+	} else {
+		shift = a.header[1] & 0xFF;
+		while (hash_read_frame(&a) && hash_read_frame(&b)) {
+			frames++;
+			if (a.root == b.root) continue;
+			printf("first divergent frame %u\n", a.frame);
+			for (i = 0; i < a.header[2] && shown < 32; i++) {
+				if (a.leaf[i] == b.leaf[i]) continue;
+				//leaf to region and page
+				page = i;
+				for (region = 0; region < HASH_REGIONS && page >= a.header[3 + region]; region++) page -= a.header[3 + region];
+				if (region == HASH_REGIONS) printf("  %s\n", _hash_names[region]);
+				else printf("  %s %04X-%04X\n", _hash_names[region], page << shift, ((page + 1) << shift) - 1);
+				shown++;
+			}
+			ret = a.frame;
+			break;
+		}
+		if (ret < 0) printf("no divergence in %u common frames\n", frames);
+	}
+	fclose(a.ff);
+	fclose(b.ff);
+	return ret;
+}